@@ -0,0 +1,237 @@
+// Host simulation of the deep-sleep duty cycle on a simulated clock.
+// Drives the firmware's duty_cycle scheduler with a synthetic tank and reports how often the
+// radio comes up, alarm latency, and the energy budget for the chosen configuration.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "duty_cycle.h"
+#include "trace_source.h"
+
+#define SIM_RATE_HZ 10          // Tank model resolution; far finer than any wake interval
+#define SUPPLY_V 3.3
+
+typedef struct {
+    double sleep_ua;            // Deep sleep, sensor divider included
+    double awake_ma;            // CPU and ADC, radio off
+    double radio_ma;            // Average while Wi-Fi/MQTT is up
+    uint32_t wake_ms;           // Boot, sample and classify
+    uint32_t radio_ms;          // Fast reconnect, publish and wait for acks
+    double uplink_fail;         // Probability an uplink attempt fails
+    double battery_mah;
+} energy_model_t;
+
+typedef struct {
+    uint64_t episodes;
+    uint64_t alarmed;
+    uint64_t false_alarms;
+    double latency_sum_s;
+    double latency_max_s;
+    bool in_leak;
+    bool episode_alarmed;
+    int64_t leak_start_ms;
+} alarm_score_t;
+
+static uint32_t sim_rng = 12345;
+
+static double sim_uniform(void)
+{
+    sim_rng ^= sim_rng << 13;
+    sim_rng ^= sim_rng >> 17;
+    sim_rng ^= sim_rng << 5;
+    return (sim_rng + 1.0) / 4294967297.0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --days D           simulated duration (default 7)\n"
+            "  --wake-s S         wake interval (default %d)\n"
+            "  --status-s S       status upload interval (default %d)\n"
+            "  --retry-s S        retry delay after a failed uplink (default %d)\n"
+            "  --use-min-s S      shortest time between flushes (default 1800)\n"
+            "  --use-max-s S      longest time between flushes (default 14400)\n"
+            "  --leak-every N     every Nth idle period develops a leak (default 6)\n"
+            "  --sleep-ua UA      deep-sleep current (default 15)\n"
+            "  --awake-ma MA      awake current with radio off (default 40)\n"
+            "  --radio-ma MA      average current with radio on (default 130)\n"
+            "  --wake-ms MS       awake time per wake without radio (default 150)\n"
+            "  --radio-ms MS      radio-on time per uplink (default 2500)\n"
+            "  --uplink-fail P    probability an uplink fails (default 0.02)\n"
+            "  --battery-mah MAH  battery capacity (default 2600)\n"
+            "  --seed N           simulator seed (default 1)\n",
+            prog, DUTY_WAKE_INTERVAL_MS / 1000, DUTY_STATUS_INTERVAL_MS / 1000, DUTY_RETRY_INTERVAL_MS / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "days", required_argument, NULL, 'D' },
+        { "wake-s", required_argument, NULL, 'w' },
+        { "status-s", required_argument, NULL, 'S' },
+        { "retry-s", required_argument, NULL, 'r' },
+        { "use-min-s", required_argument, NULL, 'u' },
+        { "use-max-s", required_argument, NULL, 'U' },
+        { "leak-every", required_argument, NULL, 'l' },
+        { "sleep-ua", required_argument, NULL, 'z' },
+        { "awake-ma", required_argument, NULL, 'a' },
+        { "radio-ma", required_argument, NULL, 'R' },
+        { "wake-ms", required_argument, NULL, 'm' },
+        { "radio-ms", required_argument, NULL, 'M' },
+        { "uplink-fail", required_argument, NULL, 'f' },
+        { "battery-mah", required_argument, NULL, 'b' },
+        { "seed", required_argument, NULL, 's' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    double days = 7;
+    duty_cycle_config_t cfg;
+    duty_cycle_default_config(&cfg);
+    energy_model_t em = {
+        .sleep_ua = 15, .awake_ma = 40, .radio_ma = 130, .wake_ms = 150, .radio_ms = 2500,
+        .uplink_fail = 0.02, .battery_mah = 2600,
+    };
+    synth_config_t synth;
+    synth_default_config(&synth);
+    synth.rate_hz = SIM_RATE_HZ;
+    synth.idle_min_s = 1800;
+    synth.idle_max_s = 14400;
+    synth.leak_every = 6;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'D': days = atof(optarg); break;
+        case 'w': cfg.wake_interval_ms = (uint32_t)(atof(optarg) * 1000); break;
+        case 'S': cfg.status_interval_ms = (uint32_t)(atof(optarg) * 1000); break;
+        case 'r': cfg.retry_interval_ms = (uint32_t)(atof(optarg) * 1000); break;
+        case 'u': synth.idle_min_s = atof(optarg); break;
+        case 'U': synth.idle_max_s = atof(optarg); break;
+        case 'l': synth.leak_every = atoi(optarg); break;
+        case 'z': em.sleep_ua = atof(optarg); break;
+        case 'a': em.awake_ma = atof(optarg); break;
+        case 'R': em.radio_ma = atof(optarg); break;
+        case 'm': em.wake_ms = (uint32_t)atoi(optarg); break;
+        case 'M': em.radio_ms = (uint32_t)atoi(optarg); break;
+        case 'f': em.uplink_fail = atof(optarg); break;
+        case 'b': em.battery_mah = atof(optarg); break;
+        case 's': synth.seed = (uint32_t)strtoul(optarg, NULL, 0); sim_rng = synth.seed * 2654435761u + 1; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (cfg.wake_interval_ms == 0 || days <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    synth.duration_s = days * 86400.0;
+    trace_source_t tank;
+    trace_source_open_synthetic(&tank, &synth, 1);
+
+    duty_cycle_state_t st = { 0 };
+    leak_classifier_config_t ccfg;
+    duty_cycle_classifier_config(&ccfg, &cfg);
+    duty_cycle_resume(&st, &ccfg);
+    // A threshold changed while asleep must reach the retained classifier on the next warm wake
+    leak_classifier_config_t changed = ccfg;
+    changed.leak_threshold_mv += 100;
+    if (!duty_cycle_resume(&st, &changed) || st.classifier.cfg.leak_threshold_mv != changed.leak_threshold_mv) {
+        fprintf(stderr, "warm wake did not apply the changed leak threshold\n");
+        return 1;
+    }
+    duty_cycle_resume(&st, &ccfg);
+
+    uint32_t uplinks_by_reason[DUTY_UPLINK_HISTORY_FULL + 1] = { 0 };
+    alarm_score_t score = { 0 };
+    uint64_t sample_index = 0;
+    int voltage = 0;
+    tank_state_t truth = TANK_STATE_FULL;
+    const int64_t end_ms = (int64_t)(synth.duration_s * 1000);
+
+    while (st.wake_ms < end_ms) {
+        // Advance the tank to this wake, tracking true leak episodes on the way
+        uint64_t target = (uint64_t)(st.wake_ms * SIM_RATE_HZ / 1000);
+        bool exhausted = false;
+        while (sample_index <= target) {
+            if (tank.base.read_frame(&tank.base, &voltage, 1, 0) <= 0) {
+                exhausted = true;
+                break;
+            }
+            truth = tank.truth[0];
+            bool leaking = truth == TANK_STATE_LEAKING;
+            if (leaking && !score.in_leak) {
+                score.episodes++;
+                score.episode_alarmed = false;
+                score.leak_start_ms = (int64_t)(sample_index * 1000 / SIM_RATE_HZ);
+            }
+            score.in_leak = leaking;
+            sample_index++;
+        }
+        if (exhausted) {
+            break;
+        }
+
+        uint32_t awake_ms = em.wake_ms;
+        int64_t now = duty_cycle_now_ms(&st, awake_ms);
+        duty_action_t action = duty_cycle_step(&st, &cfg, now, voltage);
+        if (action != DUTY_SLEEP) {
+            bool ok = sim_uniform() >= em.uplink_fail;
+            awake_ms += em.radio_ms;
+            now = duty_cycle_now_ms(&st, awake_ms);
+            uplinks_by_reason[action]++;
+            if (action == DUTY_UPLINK_ALARM && ok) {
+                if (score.in_leak && !score.episode_alarmed) {
+                    double latency_s = (now - score.leak_start_ms) / 1000.0;
+                    score.alarmed++;
+                    score.episode_alarmed = true;
+                    score.latency_sum_s += latency_s;
+                    if (latency_s > score.latency_max_s) {
+                        score.latency_max_s = latency_s;
+                    }
+                } else if (!score.in_leak) {
+                    score.false_alarms++;
+                }
+            }
+            duty_cycle_uplink_result(&st, now, ok, em.radio_ms);
+        }
+        duty_cycle_sleep_ms(&st, &cfg, awake_ms);
+    }
+    trace_source_close(&tank);
+
+    //-------------Report---------------//
+    double total_s = st.wake_ms / 1000.0;
+    double awake_s = st.stats.awake_ms / 1000.0;
+    double radio_s = st.stats.radio_ms / 1000.0;
+    double cpu_s = awake_s - radio_s;
+    double sleep_s = total_s - awake_s;
+    double mah = (sleep_s * em.sleep_ua / 1000.0 + cpu_s * em.awake_ma + radio_s * em.radio_ma) / 3600.0;
+    double sim_days = total_s / 86400.0;
+    double mah_per_day = mah / sim_days;
+    uint32_t attempts = st.stats.uplinks + st.stats.uplink_failures;
+
+    printf("config    wake %u s, status %u s, retry %u s, %.1f days simulated\n",
+           (unsigned)(cfg.wake_interval_ms / 1000), (unsigned)(cfg.status_interval_ms / 1000),
+           (unsigned)(cfg.retry_interval_ms / 1000), sim_days);
+    printf("wakes     %lu (%.0f/day)\n", (unsigned long)st.stats.wakes, st.stats.wakes / sim_days);
+    printf("uplinks   %lu ok, %lu failed (%.1f/day): %lu alarm, %lu status, %lu history full\n",
+           (unsigned long)st.stats.uplinks, (unsigned long)st.stats.uplink_failures, attempts / sim_days,
+           (unsigned long)uplinks_by_reason[DUTY_UPLINK_ALARM], (unsigned long)uplinks_by_reason[DUTY_UPLINK_STATUS],
+           (unsigned long)uplinks_by_reason[DUTY_UPLINK_HISTORY_FULL]);
+    printf("duty      radio on %.3f%%, awake %.3f%%, history dropped %lu readings\n",
+           100.0 * radio_s / total_s, 100.0 * awake_s / total_s, (unsigned long)st.history.dropped);
+    printf("leaks     %lu episodes, %lu alarmed, %lu missed, %lu false alarms, latency mean %.0f s, max %.0f s\n",
+           (unsigned long)score.episodes, (unsigned long)score.alarmed,
+           (unsigned long)(score.episodes - score.alarmed), (unsigned long)score.false_alarms,
+           score.alarmed ? score.latency_sum_s / score.alarmed : 0.0, score.latency_max_s);
+    printf("energy    %.2f mAh/day (%.1f mWh/day): sleep %.2f, awake %.2f, radio %.2f mAh/day\n",
+           mah_per_day, mah_per_day * SUPPLY_V,
+           sleep_s * em.sleep_ua / 1000.0 / 3600.0 / sim_days, cpu_s * em.awake_ma / 3600.0 / sim_days,
+           radio_s * em.radio_ma / 3600.0 / sim_days);
+    printf("battery   %.0f days on %.0f mAh (always-on at %.0f mA: %.1f days)\n",
+           em.battery_mah / mah_per_day, em.battery_mah, em.radio_ma, em.battery_mah / (em.radio_ma * 24.0));
+    return 0;
+}
@@ -0,0 +1,632 @@
+// Host fleet load simulator: N virtual detectors, each with its own broker connection, synthetic tank,
+// classifier and the firmware's publish path, run in real time against a local broker.
+// A separate subscriber matches every message it receives to its publish, so the report covers
+// what the broker saw (messages/s, bytes/s) and how long delivery took end to end.
+//   mosquitto -p 1883 &
+//   ./build_host/fleet_sim --devices 1000 --minutes 10 --mode exception
+
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "leak_classifier.h"
+#include "mqtt_lite.h"
+#include "payload_codec.h"
+#include "report_policy.h"
+#include "sensor_channel.h"
+#include "telemetry_batch.h"
+#include "trace_source.h"
+
+#define SIM_RATE_HZ 10              // Classifier input rate; the firmware's output only changes every report
+#define CHECK_INTERVAL_MS 1500      // SENSOR_CHECK_INTERVAL_MS: readings reach the publisher at least this often
+#define POLL_INTERVAL_MS 5000       // MQTT_PUBLISH_INTERVAL_MS: the REPORT_BY_EXCEPTION=0 publish period
+#define KEEPALIVE_S 60
+#define PENDING_SLOTS 64            // Publishes per device awaiting their copy at the subscriber
+#define ACK_SLOTS 16                // QoS 1 publishes per device awaiting PUBACK
+
+typedef enum {
+    MODE_POLL,                      // Latest snapshot every POLL_INTERVAL_MS
+    MODE_EXCEPTION,                 // Report policy: transitions, deadband, heartbeat
+    MODE_BATCH,                     // Report policy plus every reading in a /batch message
+} publish_mode_t;
+
+typedef enum {
+    CLASS_ALARM,
+    CLASS_TELEMETRY,
+    CLASS_BATCH,
+    CLASS_COUNT
+} message_class_t;
+
+static const char *const mode_names[] = { "poll", "exception", "batch" };
+static const char *const class_names[CLASS_COUNT] = { "alarm", "telemetry", "batch" };
+
+typedef struct {
+    bool used;
+    uint32_t hash;
+    uint64_t sent_us;
+} pending_t;
+
+typedef struct {
+    uint16_t id;
+    uint64_t sent_us;
+} ack_wait_t;
+
+typedef struct {
+    mqtt_lite_t mqtt;
+    trace_source_t tank;
+    leak_classifier_t classifier;
+    report_policy_t policy;
+    telemetry_batch_t batch;
+    char topic[64];
+    uint64_t samples;
+    uint32_t next_report_ms;
+    uint32_t next_poll_ms;
+    uint32_t events;                // SENSOR_EVENT_* latched until a snapshot carries them
+    tank_state_t latest_state;
+    int latest_mv;
+    bool have_latest;
+    bool have_alarm;
+    tank_state_t alarm_state;
+    pending_t pending[PENDING_SLOTS];
+    int pending_head;
+    int pending_count;
+    ack_wait_t acks[ACK_SLOTS];
+    int ack_next;
+} device_t;
+
+// Latency samples in microseconds, sorted for percentiles at the end
+typedef struct {
+    uint32_t *values;
+    size_t count;
+    size_t cap;
+} samples_t;
+
+typedef struct {
+    publish_mode_t mode;
+    payload_codec_t codec;
+    const char *topic_prefix;
+    uint32_t batch_ms;
+    uint64_t sent[CLASS_COUNT];
+    uint64_t payload_bytes[CLASS_COUNT];
+    uint64_t publish_failed;
+    uint64_t received;
+    uint64_t matched;
+    uint64_t unmatched;
+    uint64_t retained_skipped;
+    uint64_t pending_overwritten;
+    uint64_t transitions;
+    samples_t e2e;
+    samples_t puback;
+} fleet_t;
+
+static fleet_t fleet;
+static device_t *devices;
+static int device_count;
+
+static void samples_add(samples_t *s, uint64_t value)
+{
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 4096;
+        uint32_t *values = realloc(s->values, cap * sizeof(*values));
+        if (values == NULL) {
+            return;
+        }
+        s->values = values;
+        s->cap = cap;
+    }
+    s->values[s->count++] = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const samples_t *s, double p)
+{
+    if (s->count == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p / 100.0 * (s->count - 1) + 0.5);
+    return s->values[i] / 1000.0;
+}
+
+static void print_latency(const char *name, samples_t *s)
+{
+    qsort(s->values, s->count, sizeof(*s->values), cmp_u32);
+    printf("%-10s %lu samples, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n", name,
+           (unsigned long)s->count, percentile_ms(s, 50), percentile_ms(s, 90), percentile_ms(s, 99),
+           percentile_ms(s, 99.9), percentile_ms(s, 100));
+}
+
+// FNV-1a over topic and payload: identifies a publish when its copy reaches the subscriber
+static uint32_t message_hash(const char *topic, size_t topic_len, const uint8_t *payload, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < topic_len; i++) {
+        h = (h ^ (uint8_t)topic[i]) * 16777619u;
+    }
+    h = (h ^ 0xff) * 16777619u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ payload[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void track_pending(device_t *d, uint32_t hash, uint64_t sent_us)
+{
+    if (d->pending_count == PENDING_SLOTS) {
+        // The subscriber never got the oldest one, or is far behind
+        d->pending_head = (d->pending_head + 1) % PENDING_SLOTS;
+        d->pending_count--;
+        fleet.pending_overwritten++;
+    }
+    pending_t *p = &d->pending[(d->pending_head + d->pending_count) % PENDING_SLOTS];
+    p->used = true;
+    p->hash = hash;
+    p->sent_us = sent_us;
+    d->pending_count++;
+}
+
+static bool publish(device_t *d, message_class_t cls, const char *topic, const uint8_t *payload, size_t len, int qos,
+                    bool retain)
+{
+    uint64_t now_us = mqtt_lite_now_us();
+    int id = mqtt_lite_publish(&d->mqtt, topic, payload, len, qos, retain);
+    if (id < 0) {
+        fleet.publish_failed++;
+        return false;
+    }
+    fleet.sent[cls]++;
+    fleet.payload_bytes[cls] += len;
+    track_pending(d, message_hash(topic, strlen(topic), payload, len), now_us);
+    if (id > 0) {
+        d->acks[d->ack_next] = (ack_wait_t){ .id = (uint16_t)id, .sent_us = now_us };
+        d->ack_next = (d->ack_next + 1) % ACK_SLOTS;
+    }
+    return true;
+}
+
+// Same classes as publish_snapshot() in main.c: events and state changes are retained QoS 1 alarms
+static void publish_snapshot(device_t *d)
+{
+    uint8_t payload[PAYLOAD_MAX_LEN];
+    char topic[sizeof(d->topic) + sizeof(PAYLOAD_CBOR_SUBTOPIC)];
+    payload_fields_t fields = {
+        .voltage_mv = d->latest_mv,
+        .state = d->latest_state,
+        .full_tank = d->latest_state == TANK_STATE_FULL,
+        .leak_detected = (d->events & SENSOR_EVENT_LEAK) != 0,
+        .flush_detected = (d->events & SENSOR_EVENT_FLUSH) != 0,
+    };
+    int len = payload_encode(fleet.codec, &fields, payload, sizeof(payload));
+    if (len < 0) {
+        return;
+    }
+    snprintf(topic, sizeof(topic), "%s%s", d->topic, fleet.codec == PAYLOAD_CODEC_CBOR ? PAYLOAD_CBOR_SUBTOPIC : "");
+    bool alarm = d->events != 0 || !d->have_alarm || d->latest_state != d->alarm_state;
+    if (!publish(d, alarm ? CLASS_ALARM : CLASS_TELEMETRY, topic, payload, (size_t)len, alarm ? 1 : 0, alarm)) {
+        return;
+    }
+    if (alarm) {
+        d->have_alarm = true;
+        d->alarm_state = d->latest_state;
+    }
+    d->events = 0;
+}
+
+static void flush_batch(device_t *d, uint32_t now_ms)
+{
+    static uint8_t message[TELEMETRY_BATCH_MAX_ENCODED];
+    char topic[sizeof(d->topic) + sizeof(TELEMETRY_BATCH_SUBTOPIC)];
+    if (!telemetry_batch_due(&d->batch, now_ms, fleet.batch_ms)) {
+        return;
+    }
+    int len = telemetry_batch_encode(&d->batch, 0, message, sizeof(message));
+    telemetry_batch_clear(&d->batch);
+    if (len > 0) {
+        snprintf(topic, sizeof(topic), "%s%s", d->topic, TELEMETRY_BATCH_SUBTOPIC);
+        publish(d, CLASS_BATCH, topic, message, (size_t)len, 1, false);
+    }
+}
+
+// A reading the sensor task would hand to the publisher
+static void handle_reading(device_t *d, tank_state_t state, int voltage, uint32_t now_ms)
+{
+    d->latest_state = state;
+    d->latest_mv = voltage;
+    d->have_latest = true;
+    if (fleet.mode == MODE_BATCH) {
+        telemetry_sample_t sample = {
+            .timestamp_ms = now_ms,
+            .voltage_mv = voltage,
+            .state = (uint8_t)state,
+            .flags = (state == TANK_STATE_FULL ? PAYLOAD_FLAG_FULL_TANK : 0) |
+                     (state == TANK_STATE_LEAKING ? PAYLOAD_FLAG_LEAK : 0) |
+                     (state == TANK_STATE_FLUSHING ? PAYLOAD_FLAG_FLUSH : 0),
+        };
+        telemetry_batch_add(&d->batch, &sample, now_ms);
+    }
+    if (fleet.mode != MODE_POLL) {
+        report_reason_t reason = report_policy_evaluate(&d->policy, state, voltage, d->events != 0, now_ms);
+        if (reason != REPORT_NONE) {
+            publish_snapshot(d);
+            report_policy_commit(&d->policy, reason, state, voltage, now_ms);
+        }
+    }
+}
+
+// Run the device's tank and firmware up to sim_ms
+static void device_advance(device_t *d, uint32_t sim_ms)
+{
+    uint64_t target = (uint64_t)sim_ms * SIM_RATE_HZ / 1000;
+    while (d->samples < target) {
+        int sample;
+        if (d->tank.base.read_frame(&d->tank.base, &sample, 1, 0) <= 0) {
+            break;
+        }
+        uint32_t now_ms = (uint32_t)(d->samples * 1000 / SIM_RATE_HZ);
+        d->samples++;
+        tank_state_t prev = d->classifier.state;
+        tank_state_t state = leak_classifier_feed(&d->classifier, &sample, 1);
+        if (state != prev) {
+            fleet.transitions++;
+            if (state == TANK_STATE_FLUSHING) {
+                d->events |= SENSOR_EVENT_FLUSH;
+            } else if (state == TANK_STATE_LEAKING) {
+                d->events |= SENSOR_EVENT_LEAK;
+            }
+        }
+        if (state != prev || (int32_t)(now_ms - d->next_report_ms) >= 0) {
+            d->next_report_ms = now_ms + CHECK_INTERVAL_MS;
+            handle_reading(d, state, leak_classifier_voltage(&d->classifier), now_ms);
+        }
+    }
+    if (fleet.mode == MODE_POLL && d->have_latest && (int32_t)(sim_ms - d->next_poll_ms) >= 0) {
+        d->next_poll_ms += POLL_INTERVAL_MS;
+        publish_snapshot(d);
+    }
+    if (fleet.mode == MODE_BATCH) {
+        flush_batch(d, sim_ms);
+    }
+}
+
+static void on_ack(mqtt_lite_t *c, uint16_t packet_id)
+{
+    device_t *d = c->user;
+    for (int i = 0; i < ACK_SLOTS; i++) {
+        if (d->acks[i].sent_us != 0 && d->acks[i].id == packet_id) {
+            samples_add(&fleet.puback, mqtt_lite_now_us() - d->acks[i].sent_us);
+            d->acks[i].sent_us = 0;
+            return;
+        }
+    }
+}
+
+static void on_message(mqtt_lite_t *c, const char *topic, size_t topic_len, const uint8_t *payload, size_t len,
+                       bool retained)
+{
+    (void)c;
+    uint64_t now_us = mqtt_lite_now_us();
+    if (retained) {
+        // Left on the broker by an earlier run; not part of this one
+        fleet.retained_skipped++;
+        return;
+    }
+    fleet.received++;
+    size_t prefix_len = strlen(fleet.topic_prefix);
+    char index_text[16] = { 0 };
+    if (topic_len > prefix_len + 2 && memcmp(topic, fleet.topic_prefix, prefix_len) == 0 &&
+        topic[prefix_len] == '/' && topic[prefix_len + 1] == 'd') {
+        size_t n = topic_len - prefix_len - 2;
+        memcpy(index_text, topic + prefix_len + 2, n < sizeof(index_text) - 1 ? n : sizeof(index_text) - 1);
+    }
+    int index = atoi(index_text);
+    if (index_text[0] == '\0' || index < 0 || index >= device_count) {
+        fleet.unmatched++;
+        return;
+    }
+
+    device_t *d = &devices[index];
+    uint32_t hash = message_hash(topic, topic_len, payload, len);
+    for (int i = 0; i < d->pending_count; i++) {
+        pending_t *p = &d->pending[(d->pending_head + i) % PENDING_SLOTS];
+        if (p->used && p->hash == hash) {
+            samples_add(&fleet.e2e, now_us - p->sent_us);
+            fleet.matched++;
+            p->used = false;
+            while (d->pending_count > 0 && !d->pending[d->pending_head].used) {
+                d->pending_head = (d->pending_head + 1) % PENDING_SLOTS;
+                d->pending_count--;
+            }
+            return;
+        }
+    }
+    fleet.unmatched++;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --devices N        virtual detectors, one connection each (default 100)\n"
+            "  --minutes M        wall-clock run time (default 5)\n"
+            "  --mode MODE        poll, exception or batch (default exception)\n"
+            "  --codec CODEC      json or cbor (default json)\n"
+            "  --speedup X        simulated seconds per wall second; intervals shrink with it (default 1)\n"
+            "  --host HOST        broker (default localhost)\n"
+            "  --port PORT        broker port (default 1883)\n"
+            "  --user USER        broker username\n"
+            "  --pass PASS        broker password\n"
+            "  --topic PREFIX     topic prefix, device i publishes on PREFIX/d<i> (default /leak/sim)\n"
+            "  --deadband-mv MV   report-by-exception deadband (default %d)\n"
+            "  --heartbeat-s S    report-by-exception heartbeat (default %d)\n"
+            "  --batch-s S        batch deadline (default %d)\n"
+            "  --use-min-s S      shortest time between flushes (default 600)\n"
+            "  --use-max-s S      longest time between flushes (default 3600)\n"
+            "  --leak-every N     every Nth idle period develops a leak (default 6)\n"
+            "  --no-subscriber    skip end-to-end latency measurement\n"
+            "  --seed N           simulator seed (default 1)\n"
+            "Thousands of devices need as many open files: raise ulimit -n first.\n",
+            prog, REPORT_DEADBAND_MV, REPORT_HEARTBEAT_MS / 1000, TELEMETRY_BATCH_DEADLINE_MS / 1000);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "devices", required_argument, NULL, 'n' },
+        { "minutes", required_argument, NULL, 'm' },
+        { "mode", required_argument, NULL, 'M' },
+        { "codec", required_argument, NULL, 'c' },
+        { "speedup", required_argument, NULL, 'x' },
+        { "host", required_argument, NULL, 'H' },
+        { "port", required_argument, NULL, 'p' },
+        { "user", required_argument, NULL, 'u' },
+        { "pass", required_argument, NULL, 'P' },
+        { "topic", required_argument, NULL, 't' },
+        { "deadband-mv", required_argument, NULL, 'd' },
+        { "heartbeat-s", required_argument, NULL, 'b' },
+        { "batch-s", required_argument, NULL, 'B' },
+        { "use-min-s", required_argument, NULL, 'i' },
+        { "use-max-s", required_argument, NULL, 'I' },
+        { "leak-every", required_argument, NULL, 'l' },
+        { "no-subscriber", no_argument, NULL, 'N' },
+        { "seed", required_argument, NULL, 's' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    double minutes = 5;
+    double speedup = 1;
+    const char *host = "localhost";
+    int port = 1883;
+    const char *user = NULL;
+    const char *pass = NULL;
+    int deadband_mv = REPORT_DEADBAND_MV;
+    uint32_t heartbeat_ms = REPORT_HEARTBEAT_MS;
+    bool subscriber = true;
+    device_count = 100;
+    fleet.mode = MODE_EXCEPTION;
+    fleet.codec = PAYLOAD_CODEC_JSON;
+    fleet.topic_prefix = "/leak/sim";
+    fleet.batch_ms = TELEMETRY_BATCH_DEADLINE_MS;
+    synth_config_t synth;
+    synth_default_config(&synth);
+    synth.rate_hz = SIM_RATE_HZ;
+    synth.idle_min_s = 600;
+    synth.idle_max_s = 3600;
+    synth.leak_every = 6;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'n': device_count = atoi(optarg); break;
+        case 'm': minutes = atof(optarg); break;
+        case 'M':
+            fleet.mode = strcmp(optarg, "poll") == 0 ? MODE_POLL : strcmp(optarg, "batch") == 0 ? MODE_BATCH
+                       : strcmp(optarg, "exception") == 0 ? MODE_EXCEPTION : (publish_mode_t)-1;
+            break;
+        case 'c': fleet.codec = strcmp(optarg, "cbor") == 0 ? PAYLOAD_CODEC_CBOR : PAYLOAD_CODEC_JSON; break;
+        case 'x': speedup = atof(optarg); break;
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'u': user = optarg; break;
+        case 'P': pass = optarg; break;
+        case 't': fleet.topic_prefix = optarg; break;
+        case 'd': deadband_mv = atoi(optarg); break;
+        case 'b': heartbeat_ms = (uint32_t)(atof(optarg) * 1000); break;
+        case 'B': fleet.batch_ms = (uint32_t)(atof(optarg) * 1000); break;
+        case 'i': synth.idle_min_s = atof(optarg); break;
+        case 'I': synth.idle_max_s = atof(optarg); break;
+        case 'l': synth.leak_every = atoi(optarg); break;
+        case 'N': subscriber = false; break;
+        case 's': synth.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (device_count <= 0 || minutes <= 0 || speedup <= 0 || (int)fleet.mode < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    devices = calloc((size_t)device_count, sizeof(*devices));
+    struct pollfd *fds = calloc((size_t)device_count + 1, sizeof(*fds));
+    if (devices == NULL || fds == NULL) {
+        fprintf(stderr, "out of memory for %d devices\n", device_count);
+        return 1;
+    }
+
+    mqtt_lite_t sub = { .fd = -1, .on_message = on_message };
+    if (subscriber) {
+        char filter[128];
+        snprintf(filter, sizeof(filter), "%s/#", fleet.topic_prefix);
+        if (!mqtt_lite_connect(&sub, host, port, "fleet_sim_sub", user, pass, KEEPALIVE_S) ||
+            !mqtt_lite_subscribe(&sub, filter, 0)) {
+            fprintf(stderr, "subscriber cannot connect to %s:%d\n", host, port);
+            return 1;
+        }
+    }
+
+    leak_classifier_config_t ccfg;
+    leak_classifier_default_config(&ccfg, 1000000 / SIM_RATE_HZ);
+    synth.duration_s = minutes * 60 * speedup + 60;
+    uint32_t seed = synth.seed;
+    int connected = 0;
+    for (int i = 0; i < device_count; i++) {
+        device_t *d = &devices[i];
+        char client_id[32];
+        snprintf(client_id, sizeof(client_id), "fleet_sim_%d", i);
+        snprintf(d->topic, sizeof(d->topic), "%s/d%d", fleet.topic_prefix, i);
+        d->mqtt.user = d;
+        d->mqtt.on_ack = on_ack;
+        if (!mqtt_lite_connect(&d->mqtt, host, port, client_id, user, pass, KEEPALIVE_S)) {
+            fprintf(stderr, "device %d cannot connect (open files limit?)\n", i);
+            continue;
+        }
+        connected++;
+        synth.seed = seed + (uint32_t)i * 7919u;
+        trace_source_open_synthetic(&d->tank, &synth, 1);
+        leak_classifier_init(&d->classifier, &ccfg);
+        report_policy_init(&d->policy, deadband_mv, heartbeat_ms);
+        telemetry_batch_init(&d->batch);
+        // Spread the fleet over the intervals, as real devices boot at different times
+        d->next_report_ms = (uint32_t)((uint64_t)i * CHECK_INTERVAL_MS / device_count);
+        d->next_poll_ms = (uint32_t)((uint64_t)i * POLL_INTERVAL_MS / device_count);
+    }
+    if (connected == 0) {
+        fprintf(stderr, "no device could connect to %s:%d\n", host, port);
+        return 1;
+    }
+
+    //-------------Run---------------//
+    uint64_t tick_us = (uint64_t)(1000000 / SIM_RATE_HZ / speedup);
+    if (tick_us < 1000) {
+        tick_us = 1000;
+    }
+    uint64_t start_us = mqtt_lite_now_us();
+    uint64_t end_us = start_us + (uint64_t)(minutes * 60e6);
+    uint64_t next_tick_us = start_us;
+    uint64_t sub_rx_start = sub.rx_bytes;
+    while (1) {
+        uint64_t now_us = mqtt_lite_now_us();
+        if (now_us >= end_us) {
+            break;
+        }
+        if (now_us >= next_tick_us) {
+            uint32_t sim_ms = (uint32_t)((now_us - start_us) / 1000 * speedup);
+            for (int i = 0; i < device_count; i++) {
+                device_t *d = &devices[i];
+                if (d->mqtt.fd < 0) {
+                    continue;
+                }
+                device_advance(d, sim_ms);
+                if (now_us - d->mqtt.last_tx_us > KEEPALIVE_S * 1000000ull / 2) {
+                    mqtt_lite_ping(&d->mqtt);
+                }
+            }
+            if (sub.fd >= 0 && now_us - sub.last_tx_us > KEEPALIVE_S * 1000000ull / 2) {
+                mqtt_lite_ping(&sub);
+            }
+            next_tick_us += tick_us;
+        }
+
+        int nfds = 0;
+        for (int i = 0; i < device_count; i++) {
+            fds[nfds++] = (struct pollfd){ .fd = devices[i].mqtt.fd, .events = POLLIN };
+        }
+        fds[nfds++] = (struct pollfd){ .fd = sub.fd, .events = POLLIN };
+        now_us = mqtt_lite_now_us();
+        int timeout_ms = next_tick_us > now_us ? (int)((next_tick_us - now_us + 999) / 1000) : 0;
+        if (poll(fds, (nfds_t)nfds, timeout_ms) > 0) {
+            for (int i = 0; i < device_count; i++) {
+                if (fds[i].revents != 0 && !mqtt_lite_read(&devices[i].mqtt)) {
+                    fprintf(stderr, "device %d disconnected\n", i);
+                }
+            }
+            if (fds[device_count].revents != 0 && !mqtt_lite_read(&sub)) {
+                fprintf(stderr, "subscriber disconnected\n");
+            }
+        }
+    }
+    double wall_s = (mqtt_lite_now_us() - start_us) / 1e6;
+
+    // Give the last messages and acks a moment to arrive
+    uint64_t drain_end_us = mqtt_lite_now_us() + 1000000;
+    while (mqtt_lite_now_us() < drain_end_us) {
+        int nfds = 0;
+        for (int i = 0; i < device_count; i++) {
+            fds[nfds++] = (struct pollfd){ .fd = devices[i].mqtt.fd, .events = POLLIN };
+        }
+        fds[nfds++] = (struct pollfd){ .fd = sub.fd, .events = POLLIN };
+        if (poll(fds, (nfds_t)nfds, 50) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < nfds; i++) {
+            if (fds[i].revents != 0) {
+                mqtt_lite_read(i < device_count ? &devices[i].mqtt : &sub);
+            }
+        }
+    }
+
+    //-------------Report---------------//
+    uint64_t messages = 0;
+    uint64_t payload = 0;
+    uint64_t tx = 0;
+    uint64_t rx = 0;
+    uint64_t unconfirmed = 0;
+    int alive = 0;
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        messages += fleet.sent[c];
+        payload += fleet.payload_bytes[c];
+    }
+    for (int i = 0; i < device_count; i++) {
+        device_t *d = &devices[i];
+        tx += d->mqtt.tx_bytes;
+        rx += d->mqtt.rx_bytes;
+        alive += d->mqtt.fd >= 0;
+        for (int p = 0; p < d->pending_count; p++) {
+            unconfirmed += d->pending[(d->pending_head + p) % PENDING_SLOTS].used;
+        }
+        mqtt_lite_disconnect(&d->mqtt);
+        trace_source_close(&d->tank);
+    }
+    double sim_hours = wall_s * speedup / 3600.0;
+
+    printf("config     %d devices (%d connected, %d at the end), mode %s, codec %s, %.1f min wall, speedup %.1f\n",
+           device_count, connected, alive, mode_names[fleet.mode], payload_codec_name(fleet.codec), wall_s / 60,
+           speedup);
+    printf("published  %lu messages: %lu alarm, %lu telemetry, %lu batch, %lu failed; %lu transitions\n",
+           (unsigned long)messages, (unsigned long)fleet.sent[CLASS_ALARM], (unsigned long)fleet.sent[CLASS_TELEMETRY],
+           (unsigned long)fleet.sent[CLASS_BATCH], (unsigned long)fleet.publish_failed,
+           (unsigned long)fleet.transitions);
+    printf("rate       %.1f msg/s, %.0f payload B/s, %.0f MQTT B/s to the broker, %.0f B/s back (acks, pings)\n",
+           messages / wall_s, payload / wall_s, tx / wall_s, rx / wall_s);
+    printf("per device %.1f msg/h, %.0f MQTT B/h (simulated time)\n", messages / (double)connected / sim_hours,
+           tx / (double)connected / sim_hours);
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (fleet.sent[c] > 0) {
+            printf("  %-9s %.2f msg/s, mean payload %.0f B\n", class_names[c], fleet.sent[c] / wall_s,
+                   (double)fleet.payload_bytes[c] / fleet.sent[c]);
+        }
+    }
+    print_latency("puback", &fleet.puback);
+    if (subscriber) {
+        printf("delivered  %lu received, %lu matched, %lu unmatched, %lu unconfirmed, %lu overwritten, "
+               "%lu retained skipped, %.0f B/s to the subscriber\n",
+               (unsigned long)fleet.received, (unsigned long)fleet.matched, (unsigned long)fleet.unmatched,
+               (unsigned long)unconfirmed, (unsigned long)fleet.pending_overwritten,
+               (unsigned long)fleet.retained_skipped, (sub.rx_bytes - sub_rx_start) / wall_s);
+        print_latency("end-to-end", &fleet.e2e);
+        mqtt_lite_disconnect(&sub);
+    }
+    free(fleet.e2e.values);
+    free(fleet.puback.values);
+    free(fds);
+    free(devices);
+    return 0;
+}
@@ -0,0 +1,490 @@
+// Host benchmark and trace-replay harness for the detection and payload pipeline.
+// Replays a synthetic or recorded voltage trace through the firmware's classifier as fast
+// as the host allows and reports throughput, detection latency and error rates.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adc_lut.h"
+#include "leak_classifier.h"
+#include "payload_codec.h"
+#include "sample_scheduler.h"
+#include "tank_analytics.h"
+#include "telemetry_batch.h"
+#include "trace_source.h"
+
+#define FRAME_SAMPLES 256       // Same frame size as LEAK_SENSOR_FRAME_SAMPLES on the device
+#define GRACE_MS 3000           // Detection up to this long after the true episode ends still counts
+#define REPORT_MS 1500          // The sensor task reports at least this often; analytics sees these readings
+
+typedef struct {
+    tank_state_t state;
+    uint64_t episodes;
+    uint64_t detected;
+    uint64_t false_entries;
+    uint64_t duplicate_entries;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+    // Current episode
+    bool in_episode;
+    bool episode_detected;
+    uint64_t episode_start;
+    uint64_t episode_end;
+} episode_score_t;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void score_truth(episode_score_t *sc, tank_state_t truth, uint64_t i)
+{
+    bool active = (truth == sc->state);
+    if (active && !sc->in_episode) {
+        sc->in_episode = true;
+        sc->episode_detected = false;
+        sc->episode_start = i;
+        sc->episodes++;
+    } else if (!active && sc->in_episode) {
+        sc->in_episode = false;
+        sc->episode_end = i;
+    }
+}
+
+static void score_entry(episode_score_t *sc, uint64_t i, uint64_t grace)
+{
+    bool attributable = sc->episodes > 0 && (sc->in_episode || i < sc->episode_end + grace);
+    if (!attributable) {
+        sc->false_entries++;
+    } else if (sc->episode_detected) {
+        sc->duplicate_entries++;
+    } else {
+        uint64_t latency = i - sc->episode_start;
+        sc->episode_detected = true;
+        sc->detected++;
+        sc->latency_sum += latency;
+        if (latency > sc->latency_max) {
+            sc->latency_max = latency;
+        }
+    }
+}
+
+static void print_score(const episode_score_t *sc, uint32_t sample_period_us)
+{
+    uint64_t entries = sc->detected + sc->false_entries + sc->duplicate_entries;
+    uint64_t missed = sc->episodes - sc->detected;
+    double mean = sc->detected ? (double)sc->latency_sum / sc->detected : 0;
+    printf("%-9s episodes %-5llu detected %-5llu missed %-4llu (FN %5.1f%%)  false %-4llu dup %-4llu (FP %5.1f%%)\n",
+           leak_classifier_state_name(sc->state), (unsigned long long)sc->episodes,
+           (unsigned long long)sc->detected, (unsigned long long)missed,
+           sc->episodes ? 100.0 * missed / sc->episodes : 0.0,
+           (unsigned long long)sc->false_entries, (unsigned long long)sc->duplicate_entries,
+           entries ? 100.0 * (sc->false_entries + sc->duplicate_entries) / entries : 0.0);
+    printf("%-9s latency mean %.0f samples (%.0f ms), max %llu samples (%.0f ms)\n", "",
+           mean, mean * sample_period_us / 1000.0,
+           (unsigned long long)sc->latency_max, sc->latency_max * (double)sample_period_us / 1000.0);
+}
+
+// Pass 1: whole frames through the classifier, timed
+static void run_throughput(trace_source_t *t, const leak_classifier_config_t *cfg)
+{
+    static int frame[FRAME_SAMPLES];
+    leak_classifier_t c;
+    leak_classifier_init(&c, cfg);
+    trace_source_rewind(t);
+
+    uint64_t samples = 0;
+    double busy = 0;
+    int n;
+    while ((n = t->base.read_frame(&t->base, frame, FRAME_SAMPLES, 0)) > 0) {
+        double start = now_seconds();
+        leak_classifier_feed(&c, frame, n);
+        busy += now_seconds() - start;
+        samples += n;
+    }
+
+    double simulated = samples * (double)t->base.sample_period_us / 1e6;
+    printf("trace     %s, %llu samples, %.1f s simulated (%u us/sample)\n", t->base.name,
+           (unsigned long long)samples, simulated, t->base.sample_period_us);
+    printf("classify  %.1f Msamples/s, %.2f ns/sample, %.0fx real time, %u transitions\n",
+           busy > 0 ? samples / busy / 1e6 : 0.0, samples ? busy * 1e9 / samples : 0.0,
+           busy > 0 ? simulated / busy : 0.0, (unsigned)c.transitions);
+}
+
+// Pass 2: sample by sample, scored against ground truth
+static void run_scoring(trace_source_t *t, const leak_classifier_config_t *cfg, FILE *dump)
+{
+    static int frame[FRAME_SAMPLES];
+    episode_score_t scores[] = {
+        { .state = TANK_STATE_FLUSHING },
+        { .state = TANK_STATE_LEAKING },
+    };
+    const int n_scores = sizeof(scores) / sizeof(scores[0]);
+    uint64_t grace = (uint64_t)GRACE_MS * 1000 / t->base.sample_period_us;
+    uint64_t report_every = (uint64_t)REPORT_MS * 1000 / t->base.sample_period_us;
+    leak_classifier_t c;
+    leak_classifier_init(&c, cfg);
+    static tank_analytics_t analytics;
+    tank_analytics_init(&analytics, 0);
+    trace_source_rewind(t);
+
+    uint64_t i = 0;
+    uint64_t next_report = 0;
+    int n;
+    while ((n = t->base.read_frame(&t->base, frame, FRAME_SAMPLES, 0)) > 0) {
+        for (int k = 0; k < n; k++, i++) {
+            tank_state_t prev = c.state;
+            tank_state_t state = leak_classifier_feed(&c, &frame[k], 1);
+            // Same readings the firmware hands the publisher: every transition plus a periodic report
+            if (state != prev || i >= next_report) {
+                uint32_t now_ms = (uint32_t)(i * t->base.sample_period_us / 1000);
+                tank_analytics_update(&analytics, state, leak_classifier_voltage(&c), now_ms, (int)(now_ms / 3600000));
+                next_report = i + report_every;
+            }
+            for (int s = 0; s < n_scores; s++) {
+                score_truth(&scores[s], t->truth[k], i);
+                if (state != prev && state == scores[s].state) {
+                    score_entry(&scores[s], i, grace);
+                }
+            }
+            if (dump != NULL) {
+                fprintf(dump, "%d,%s\n", frame[k], leak_classifier_state_name(t->truth[k]));
+            }
+        }
+    }
+
+    char summary[TANK_ANALYTICS_MAX_ENCODED];
+    if (tank_analytics_encode(&analytics, (uint32_t)(i * t->base.sample_period_us / 1000), summary, sizeof(summary)) > 0) {
+        printf("analytics %s\n", summary);
+    }
+
+    if (!t->has_truth) {
+        printf("scoring   skipped, trace has no ground-truth column\n");
+        return;
+    }
+    for (int s = 0; s < n_scores; s++) {
+        print_score(&scores[s], t->base.sample_period_us);
+    }
+}
+
+// Pass 3: the firmware's adaptive mode, one frame-averaged reading per scheduled slot
+static void run_adaptive(trace_source_t *t, const leak_classifier_config_t *base)
+{
+    static int frame[FRAME_SAMPLES];
+    episode_score_t scores[] = {
+        { .state = TANK_STATE_FLUSHING },
+        { .state = TANK_STATE_LEAKING },
+    };
+    const int n_scores = sizeof(scores) / sizeof(scores[0]);
+    const uint32_t period_us = t->base.sample_period_us;
+    uint64_t grace = (uint64_t)GRACE_MS * 1000 / period_us;
+
+    sample_scheduler_t sched;
+    sample_scheduler_config_t sched_cfg;
+    sample_scheduler_default_config(&sched_cfg);
+    sample_scheduler_init(&sched, &sched_cfg);
+    uint32_t slot_ms = sched.period_ms;
+
+    leak_classifier_config_t cfg;
+    leak_classifier_default_config(&cfg, slot_ms * 1000);
+    cfg.leak_threshold_mv = base->leak_threshold_mv;
+    cfg.flush_threshold_mv = base->flush_threshold_mv;
+    cfg.hysteresis_mv = base->hysteresis_mv;
+    leak_classifier_t c;
+    leak_classifier_init(&c, &cfg);
+    trace_source_rewind(t);
+
+    uint64_t i = 0;             // Trace sample index
+    uint64_t next_slot = 0;     // Sample index of the next scheduled reading
+    uint64_t readings = 0;
+    bool done = false;
+    while (!done) {
+        // Skip to the next slot, keeping ground truth in step
+        while (i < next_slot) {
+            int want = next_slot - i < FRAME_SAMPLES ? (int)(next_slot - i) : FRAME_SAMPLES;
+            int n = t->base.read_frame(&t->base, frame, want, 0);
+            if (n <= 0) {
+                done = true;
+                break;
+            }
+            for (int k = 0; k < n; k++, i++) {
+                for (int s = 0; s < n_scores; s++) {
+                    score_truth(&scores[s], t->truth[k], i);
+                }
+            }
+        }
+        if (done) {
+            break;
+        }
+        // One reading: a full frame, averaged
+        int n = t->base.read_frame(&t->base, frame, FRAME_SAMPLES, 0);
+        if (n <= 0) {
+            break;
+        }
+        int64_t sum = 0;
+        for (int k = 0; k < n; k++) {
+            sum += frame[k];
+            for (int s = 0; s < n_scores; s++) {
+                score_truth(&scores[s], t->truth[k], i + k);
+            }
+        }
+        i += n;
+        int reading = (int)(sum / n);
+        readings++;
+
+        tank_state_t prev = c.state;
+        tank_state_t state = leak_classifier_feed(&c, &reading, 1);
+        for (int s = 0; s < n_scores; s++) {
+            if (state != prev && state == scores[s].state) {
+                score_entry(&scores[s], i, grace);
+            }
+        }
+
+        uint32_t now_ms = (uint32_t)(i * period_us / 1000);
+        uint32_t next_ms = sample_scheduler_next(&sched, state, reading, now_ms);
+        if (next_ms != slot_ms) {
+            leak_classifier_config_t retimed;
+            leak_classifier_default_config(&retimed, next_ms * 1000);
+            retimed.leak_threshold_mv = cfg.leak_threshold_mv;
+            retimed.flush_threshold_mv = cfg.flush_threshold_mv;
+            retimed.hysteresis_mv = cfg.hysteresis_mv;
+            leak_classifier_retime(&c, &retimed, slot_ms * 1000, next_ms * 1000);
+            slot_ms = next_ms;
+        }
+        next_slot = (i - n) + (uint64_t)slot_ms * 1000 / period_us;
+    }
+
+    double simulated_s = i * (double)period_us / 1e6;
+    const sample_scheduler_stats_t *st = &sched.stats;
+    printf("adaptive  %llu readings (%.2f/s, %llu ADC samples = %.3f%% of streaming), %u period changes\n",
+           (unsigned long long)readings, simulated_s > 0 ? readings / simulated_s : 0.0,
+           (unsigned long long)readings * FRAME_SAMPLES, i ? 100.0 * readings * FRAME_SAMPLES / i : 0.0,
+           (unsigned)st->period_changes);
+    printf("adaptive  readings full %u, flushing %u, refilling %u, leaking %u, slope triggers %u\n",
+           (unsigned)st->samples_per_state[TANK_STATE_FULL], (unsigned)st->samples_per_state[TANK_STATE_FLUSHING],
+           (unsigned)st->samples_per_state[TANK_STATE_REFILLING], (unsigned)st->samples_per_state[TANK_STATE_LEAKING],
+           (unsigned)st->slope_triggers);
+    if (t->has_truth) {
+        for (int s = 0; s < n_scores; s++) {
+            print_score(&scores[s], period_us);
+        }
+    }
+}
+
+// Encode cost and size of each telemetry payload format
+static void run_payload_bench(void)
+{
+    const int iterations = 1000000;
+    uint8_t buf[TELEMETRY_BATCH_MAX_ENCODED];
+    payload_fields_t fields = { .voltage_mv = 1750, .state = TANK_STATE_FULL, .full_tank = true };
+    volatile int sink = 0;
+
+    for (int codec = PAYLOAD_CODEC_JSON; codec <= PAYLOAD_CODEC_CBOR; codec++) {
+        double start = now_seconds();
+        int len = 0;
+        for (int i = 0; i < iterations; i++) {
+            fields.voltage_mv = 1700 + (i & 63);
+            len = payload_encode((payload_codec_t)codec, &fields, buf, PAYLOAD_MAX_LEN);
+            sink += len;
+        }
+        double elapsed = now_seconds() - start;
+        printf("payload   %-4s %3d bytes, %.0f ns/encode\n", payload_codec_name((payload_codec_t)codec), len,
+               elapsed * 1e9 / iterations);
+    }
+
+    static telemetry_batch_t batch;
+    telemetry_batch_init(&batch);
+    for (int i = 0; i < TELEMETRY_BATCH_CAPACITY; i++) {
+        telemetry_sample_t s = { .timestamp_ms = 1500LL * i, .voltage_mv = 1750 + (i % 7) - 3, .flags = 1 };
+        telemetry_batch_add(&batch, &s, (uint32_t)(1500 * i));
+    }
+    double start = now_seconds();
+    int len = 0;
+    for (int i = 0; i < iterations / 100; i++) {
+        len = telemetry_batch_encode(&batch, 1700000000000LL, buf, sizeof(buf));
+        sink += len;
+    }
+    double elapsed = now_seconds() - start;
+    printf("payload   batch of %d readings %d bytes (%.1f B/reading), %.0f ns/encode\n",
+           TELEMETRY_BATCH_CAPACITY, len, (double)len / TELEMETRY_BATCH_CAPACITY, elapsed * 1e9 / (iterations / 100));
+    (void)sink;
+}
+
+// Stand-in for the ESP32 line-fitting scheme: about 142 mV + 0.76 mV per code at 12 dB
+static int line_fitting_calibrate(void *ctx, int raw)
+{
+    (void)ctx;
+    return (int)((142LL * 65536 + (int64_t)raw * 49807) >> 16);
+}
+
+// Raw-to-mV conversion cost: a calibration call per sample against the LUT, with and without oversampling
+static void run_adc_lut_bench(void)
+{
+    const int conversions = 1 << 22;
+    static adc_lut_t lut;
+    uint16_t *raw = malloc(conversions * sizeof(*raw));
+    uint32_t rng = 1;
+    volatile int sink = 0;
+
+    for (int i = 0; i < conversions; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        raw[i] = (uint16_t)(2100 + (int)(rng % 33) - 16);   // Near the 1740 mV leak threshold, +-12 mV of noise
+    }
+    double start = now_seconds();
+    adc_lut_build(&lut, line_fitting_calibrate, NULL);
+    printf("adc       LUT build %.0f us, %d bytes\n", (now_seconds() - start) * 1e6, (int)sizeof(lut));
+
+    adc_lut_calibrate_fn volatile calibrate = line_fitting_calibrate;
+    start = now_seconds();
+    for (int i = 0; i < conversions; i++) {
+        sink += calibrate(NULL, raw[i]);
+    }
+    printf("adc       per-sample calibration %.1f ns/conversion\n", (now_seconds() - start) * 1e9 / conversions);
+
+    double lsb_mv = (lut.mv_q4[ADC_LUT_CODES - 1] - lut.mv_q4[0]) / (double)(1 << ADC_LUT_FRAC_BITS) / (ADC_LUT_CODES - 1);
+    for (int bits = 0; bits <= 3; bits++) {
+        adc_decimator_t dec = { 0 };
+        uint32_t code;
+        start = now_seconds();
+        for (int i = 0; i < conversions; i++) {
+            if (adc_decimator_push(&dec, raw[i], bits, &code)) {
+                sink += adc_lut_mv(&lut, code, bits);
+            }
+        }
+        printf("adc       LUT, %3dx oversampling %.1f ns/conversion, %.3f mV code step\n", 1 << (2 * bits),
+               (now_seconds() - start) * 1e9 / conversions, lsb_mv / (1 << bits));
+    }
+    free(raw);
+    (void)sink;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --trace FILE     replay a CSV trace (<mV>[,<state>] per line) instead of the simulator\n"
+            "  --rate HZ        sample rate of the trace (default 20000)\n"
+            "  --hours H        simulated duration (default 1)\n"
+            "  --noise MV       simulator noise standard deviation (default 15)\n"
+            "  --spikes P       simulator per-sample outlier probability (default 0.0005)\n"
+            "  --leak-every N   every Nth idle period develops a leak, 0 = never (default 4)\n"
+            "  --seed N         simulator seed (default 1)\n"
+            "  --leak-mv MV     classifier leak threshold (default 1740)\n"
+            "  --flush-mv MV    classifier flush threshold (default 1000)\n"
+            "  --hyst-mv MV     classifier hysteresis (default 30)\n"
+            "  --debounce-ms MS classifier debounce (default 500)\n"
+            "  --confirm-ms MS  classifier FULL -> LEAKING confirmation (default 3000)\n"
+            "  --dump FILE      write the replayed trace with ground truth as CSV\n"
+            "  --adaptive       also replay the adaptive sampling scheduler (frame-averaged readings)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "trace", required_argument, NULL, 't' },
+        { "rate", required_argument, NULL, 'r' },
+        { "hours", required_argument, NULL, 'H' },
+        { "noise", required_argument, NULL, 'n' },
+        { "spikes", required_argument, NULL, 'p' },
+        { "leak-every", required_argument, NULL, 'l' },
+        { "seed", required_argument, NULL, 's' },
+        { "leak-mv", required_argument, NULL, 'L' },
+        { "flush-mv", required_argument, NULL, 'F' },
+        { "hyst-mv", required_argument, NULL, 'y' },
+        { "debounce-ms", required_argument, NULL, 'd' },
+        { "confirm-ms", required_argument, NULL, 'c' },
+        { "dump", required_argument, NULL, 'o' },
+        { "adaptive", no_argument, NULL, 'A' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    synth_config_t synth;
+    synth_default_config(&synth);
+    const char *trace_path = NULL;
+    const char *dump_path = NULL;
+    bool adaptive = false;
+    int leak_mv = -1, flush_mv = -1, hyst_mv = -1, debounce_ms = -1, confirm_ms = -1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (opt) {
+        case 't': trace_path = optarg; break;
+        case 'r': synth.rate_hz = (uint32_t)atoi(optarg); break;
+        case 'H': synth.duration_s = atof(optarg) * 3600.0; break;
+        case 'n': synth.noise_mv = atoi(optarg); break;
+        case 'p': synth.spike_prob = atof(optarg); break;
+        case 'l': synth.leak_every = atoi(optarg); break;
+        case 's': synth.seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'L': leak_mv = atoi(optarg); break;
+        case 'F': flush_mv = atoi(optarg); break;
+        case 'y': hyst_mv = atoi(optarg); break;
+        case 'd': debounce_ms = atoi(optarg); break;
+        case 'c': confirm_ms = atoi(optarg); break;
+        case 'o': dump_path = optarg; break;
+        case 'A': adaptive = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (synth.rate_hz == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    trace_source_t trace;
+    if (trace_path != NULL) {
+        if (!trace_source_open_csv(&trace, trace_path, synth.rate_hz, FRAME_SAMPLES)) {
+            perror(trace_path);
+            return 1;
+        }
+    } else {
+        trace_source_open_synthetic(&trace, &synth, FRAME_SAMPLES);
+    }
+
+    // Same defaults the firmware derives for its sample rate, with optional overrides
+    leak_classifier_config_t cfg;
+    leak_classifier_default_config(&cfg, trace.base.sample_period_us);
+    if (leak_mv >= 0) cfg.leak_threshold_mv = leak_mv;
+    if (flush_mv >= 0) cfg.flush_threshold_mv = flush_mv;
+    if (hyst_mv >= 0) cfg.hysteresis_mv = hyst_mv;
+    if (debounce_ms >= 0) {
+        cfg.debounce_samples = (uint32_t)((uint64_t)debounce_ms * 1000 / trace.base.sample_period_us);
+        if (cfg.debounce_samples == 0) cfg.debounce_samples = 1;
+    }
+    if (confirm_ms >= 0) {
+        cfg.leak_confirm_samples = (uint32_t)((uint64_t)confirm_ms * 1000 / trace.base.sample_period_us);
+        if (cfg.leak_confirm_samples == 0) cfg.leak_confirm_samples = 1;
+    }
+    printf("config    leak %d mV, flush %d mV, hysteresis %d mV, EMA 1/%u, debounce %u samples, leak confirm %u samples\n",
+           cfg.leak_threshold_mv, cfg.flush_threshold_mv, cfg.hysteresis_mv, 1u << cfg.ema_shift,
+           (unsigned)cfg.debounce_samples, (unsigned)cfg.leak_confirm_samples);
+
+    FILE *dump = NULL;
+    if (dump_path != NULL && (dump = fopen(dump_path, "w")) == NULL) {
+        perror(dump_path);
+        return 1;
+    }
+
+    run_throughput(&trace, &cfg);
+    run_scoring(&trace, &cfg, dump);
+    if (adaptive) {
+        run_adaptive(&trace, &cfg);
+    }
+    run_adc_lut_bench();
+    run_payload_bench();
+
+    if (dump != NULL) {
+        fclose(dump);
+    }
+    trace_source_close(&trace);
+    return 0;
+}
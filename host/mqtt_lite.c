@@ -0,0 +1,306 @@
+#include "mqtt_lite.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define PKT_CONNECT 0x10
+#define PKT_CONNACK 0x20
+#define PKT_PUBLISH 0x30
+#define PKT_PUBACK 0x40
+#define PKT_SUBSCRIBE 0x82
+#define PKT_SUBACK 0x90
+#define PKT_PINGREQ 0xc0
+#define PKT_PINGRESP 0xd0
+#define PKT_DISCONNECT 0xe0
+
+uint64_t mqtt_lite_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool send_all(mqtt_lite_t *c, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(c->fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        c->tx_bytes += (uint64_t)n;
+        buf += n;
+        len -= (size_t)n;
+    }
+    c->last_tx_us = mqtt_lite_now_us();
+    return true;
+}
+
+// Fixed header: type byte plus the remaining length as a 1-4 byte varint
+static size_t put_header(uint8_t *buf, uint8_t type, size_t remaining)
+{
+    size_t n = 0;
+    buf[n++] = type;
+    do {
+        uint8_t b = remaining & 0x7f;
+        remaining >>= 7;
+        buf[n++] = remaining ? (b | 0x80) : b;
+    } while (remaining);
+    return n;
+}
+
+static size_t put_string(uint8_t *buf, const char *s, size_t len)
+{
+    buf[0] = (uint8_t)(len >> 8);
+    buf[1] = (uint8_t)len;
+    memcpy(buf + 2, s, len);
+    return 2 + len;
+}
+
+// Send a packet whose fixed header is followed by body parts; everything goes out in one write
+static bool send_packet(mqtt_lite_t *c, uint8_t type, const uint8_t *body, size_t body_len, const void *tail,
+                        size_t tail_len)
+{
+    uint8_t buf[2048];
+    if (5 + body_len + tail_len > sizeof(buf)) {
+        return false;
+    }
+    size_t n = put_header(buf, type, body_len + tail_len);
+    if (body_len > 0) {
+        memcpy(buf + n, body, body_len);
+        n += body_len;
+    }
+    if (tail_len > 0) {
+        memcpy(buf + n, tail, tail_len);
+        n += tail_len;
+    }
+    return send_all(c, buf, n);
+}
+
+bool mqtt_lite_connect(mqtt_lite_t *c, const char *host, int port, const char *client_id, const char *username,
+                       const char *password, uint16_t keepalive_s)
+{
+    c->fd = -1;
+    c->next_id = 1;
+    c->rx_len = 0;
+
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        return false;
+    }
+    for (struct addrinfo *ai = res; ai != NULL && c->fd < 0; ai = ai->ai_next) {
+        c->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (c->fd >= 0 && connect(c->fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (c->fd < 0) {
+        return false;
+    }
+    // Small packets go out as they are written, like the device's TLS records
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    uint8_t body[512];
+    size_t n = put_string(body, "MQTT", 4);
+    body[n++] = 4;                                  // Protocol level 3.1.1
+    body[n++] = 0x02 | (username ? 0x80 : 0) | (password ? 0x40 : 0);
+    body[n++] = (uint8_t)(keepalive_s >> 8);
+    body[n++] = (uint8_t)keepalive_s;
+    if (strlen(client_id) + (username ? strlen(username) : 0) + (password ? strlen(password) : 0) + 16 > sizeof(body) - n) {
+        mqtt_lite_disconnect(c);
+        return false;
+    }
+    n += put_string(body + n, client_id, strlen(client_id));
+    if (username) {
+        n += put_string(body + n, username, strlen(username));
+    }
+    if (password) {
+        n += put_string(body + n, password, strlen(password));
+    }
+    if (!send_packet(c, PKT_CONNECT, body, n, NULL, 0)) {
+        mqtt_lite_disconnect(c);
+        return false;
+    }
+
+    uint8_t ack[4];
+    size_t got = 0;
+    while (got < sizeof(ack)) {
+        ssize_t r = recv(c->fd, ack + got, sizeof(ack) - got, 0);
+        if (r <= 0) {
+            mqtt_lite_disconnect(c);
+            return false;
+        }
+        got += (size_t)r;
+    }
+    c->rx_bytes += got;
+    if (ack[0] != PKT_CONNACK || ack[1] != 2 || ack[3] != 0) {
+        mqtt_lite_disconnect(c);
+        return false;
+    }
+    return true;
+}
+
+int mqtt_lite_publish(mqtt_lite_t *c, const char *topic, const void *payload, size_t len, int qos, bool retain)
+{
+    if (c->fd < 0) {
+        return -1;
+    }
+    uint8_t body[2 + 256 + 2];
+    size_t topic_len = strlen(topic);
+    if (topic_len > 256) {
+        return -1;
+    }
+    size_t n = put_string(body, topic, topic_len);
+    uint16_t id = 0;
+    if (qos > 0) {
+        id = c->next_id++;
+        if (c->next_id == 0) {
+            c->next_id = 1;
+        }
+        body[n++] = (uint8_t)(id >> 8);
+        body[n++] = (uint8_t)id;
+    }
+    uint8_t type = PKT_PUBLISH | (uint8_t)((qos > 0 ? 1 : 0) << 1) | (retain ? 1 : 0);
+    if (!send_packet(c, type, body, n, payload, len)) {
+        return -1;
+    }
+    return id;
+}
+
+bool mqtt_lite_subscribe(mqtt_lite_t *c, const char *filter, int qos)
+{
+    uint8_t body[2 + 256 + 3];
+    size_t filter_len = strlen(filter);
+    if (c->fd < 0 || filter_len > 256) {
+        return false;
+    }
+    uint16_t id = c->next_id++;
+    size_t n = 0;
+    body[n++] = (uint8_t)(id >> 8);
+    body[n++] = (uint8_t)id;
+    n += put_string(body + n, filter, filter_len);
+    body[n++] = (uint8_t)(qos > 0 ? 1 : 0);
+    return send_packet(c, PKT_SUBSCRIBE, body, n, NULL, 0);
+}
+
+bool mqtt_lite_ping(mqtt_lite_t *c)
+{
+    return c->fd >= 0 && send_packet(c, PKT_PINGREQ, NULL, 0, NULL, 0);
+}
+
+static void handle_packet(mqtt_lite_t *c, uint8_t type, const uint8_t *body, size_t len)
+{
+    switch (type & 0xf0) {
+    case PKT_PUBLISH: {
+        if (len < 2) {
+            return;
+        }
+        size_t topic_len = ((size_t)body[0] << 8) | body[1];
+        int qos = (type >> 1) & 3;
+        size_t pos = 2 + topic_len + (qos > 0 ? 2 : 0);
+        if (pos > len) {
+            return;
+        }
+        if (qos > 0) {
+            uint8_t ack[2] = { body[2 + topic_len], body[3 + topic_len] };
+            send_packet(c, PKT_PUBACK, ack, sizeof(ack), NULL, 0);
+        }
+        if (c->on_message) {
+            c->on_message(c, (const char *)body + 2, topic_len, body + pos, len - pos, (type & 1) != 0);
+        }
+        break;
+    }
+    case PKT_PUBACK:
+        if (len >= 2 && c->on_ack) {
+            c->on_ack(c, (uint16_t)((body[0] << 8) | body[1]));
+        }
+        break;
+    default:
+        // SUBACK and PINGRESP carry nothing the host tools need
+        break;
+    }
+}
+
+bool mqtt_lite_read(mqtt_lite_t *c)
+{
+    if (c->fd < 0) {
+        return false;
+    }
+    ssize_t r = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len, MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        mqtt_lite_disconnect(c);
+        return false;
+    }
+    if (r > 0) {
+        c->rx_len += (size_t)r;
+        c->rx_bytes += (uint64_t)r;
+    }
+
+    size_t pos = 0;
+    while (c->rx_len - pos >= 2) {
+        size_t remaining = 0;
+        size_t hdr = 1;
+        int shift = 0;
+        bool complete = false;
+        while (pos + hdr < c->rx_len && hdr <= 4) {
+            uint8_t b = c->rx[pos + hdr++];
+            remaining |= (size_t)(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete) {
+            if (hdr > 4) {
+                mqtt_lite_disconnect(c);
+                return false;
+            }
+            break;
+        }
+        if (hdr + remaining > sizeof(c->rx)) {
+            // Larger than anything the simulated fleet sends
+            mqtt_lite_disconnect(c);
+            return false;
+        }
+        if (pos + hdr + remaining > c->rx_len) {
+            break;
+        }
+        handle_packet(c, c->rx[pos], c->rx + pos + hdr, remaining);
+        pos += hdr + remaining;
+        if (c->fd < 0) {
+            return false;
+        }
+    }
+    memmove(c->rx, c->rx + pos, c->rx_len - pos);
+    c->rx_len -= pos;
+    return true;
+}
+
+void mqtt_lite_disconnect(mqtt_lite_t *c)
+{
+    if (c->fd >= 0) {
+        send_packet(c, PKT_DISCONNECT, NULL, 0, NULL, 0);
+        close(c->fd);
+        c->fd = -1;
+    }
+}
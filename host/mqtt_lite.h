@@ -0,0 +1,47 @@
+#ifndef MQTT_LITE_H
+#define MQTT_LITE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal MQTT 3.1.1 client for the host tools: plain TCP, clean sessions, QoS 0 and 1, one socket per
+// client and no threads, so thousands of them can share one poll() loop. Writes block; reads are driven
+// by the caller when poll() reports the socket readable.
+
+#define MQTT_LITE_RX_BUFFER 4096
+
+typedef struct mqtt_lite mqtt_lite_t;
+
+// PUBLISH delivered to a subscriber (retained is set for messages replayed from the broker's store)
+typedef void (*mqtt_lite_message_cb)(mqtt_lite_t *c, const char *topic, size_t topic_len, const uint8_t *payload,
+                                     size_t len, bool retained);
+// PUBACK for a QoS 1 publish
+typedef void (*mqtt_lite_ack_cb)(mqtt_lite_t *c, uint16_t packet_id);
+
+struct mqtt_lite {
+    int fd;
+    uint16_t next_id;
+    uint64_t tx_bytes;          // Every byte written, MQTT framing included
+    uint64_t rx_bytes;
+    uint64_t last_tx_us;
+    mqtt_lite_message_cb on_message;
+    mqtt_lite_ack_cb on_ack;
+    void *user;
+    size_t rx_len;
+    uint8_t rx[MQTT_LITE_RX_BUFFER];
+};
+
+// Connect and wait for CONNACK. username/password may be NULL. Returns false with c->fd == -1 on failure.
+bool mqtt_lite_connect(mqtt_lite_t *c, const char *host, int port, const char *client_id, const char *username,
+                       const char *password, uint16_t keepalive_s);
+// Returns the packet id for QoS 1, 0 for QoS 0, or -1 if the connection failed
+int mqtt_lite_publish(mqtt_lite_t *c, const char *topic, const void *payload, size_t len, int qos, bool retain);
+bool mqtt_lite_subscribe(mqtt_lite_t *c, const char *filter, int qos);
+bool mqtt_lite_ping(mqtt_lite_t *c);
+// Read what the socket has and dispatch complete packets. Returns false once the connection is gone.
+bool mqtt_lite_read(mqtt_lite_t *c);
+void mqtt_lite_disconnect(mqtt_lite_t *c);
+uint64_t mqtt_lite_now_us(void);
+
+#endif // MQTT_LITE_H
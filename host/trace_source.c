@@ -0,0 +1,257 @@
+#include "trace_source.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tank model levels, chosen around the firmware's 1740/1000 mV thresholds
+#define FULL_MV 1800.0
+#define EMPTY_MV 800.0
+#define LEAK_FLOOR_MV 1650.0
+#define LEAK_THRESHOLD_MV 1740.0
+
+enum {
+    PHASE_IDLE,         // Full, nobody uses it
+    PHASE_FLUSH_DROP,   // Flapper open, tank empties
+    PHASE_FLUSH_HOLD,   // Tank empty, fill valve starting
+    PHASE_REFILL,       // Level ramps back to full
+    PHASE_LEAK_DRIFT,   // Flapper seeps, level creeps down
+    PHASE_LEAK_HOLD,    // Level settled below full
+};
+
+static uint32_t rng_next(uint32_t *state)
+{
+    // xorshift32: deterministic across platforms for a given seed
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static double rng_uniform(uint32_t *state)
+{
+    return (rng_next(state) + 1.0) / 4294967297.0;
+}
+
+static double rng_gauss(uint32_t *state)
+{
+    return sqrt(-2.0 * log(rng_uniform(state))) * cos(2.0 * M_PI * rng_uniform(state));
+}
+
+void synth_default_config(synth_config_t *cfg)
+{
+    cfg->rate_hz = 20000;
+    cfg->duration_s = 3600.0;
+    cfg->noise_mv = 15;
+    cfg->spike_prob = 0.0005;
+    cfg->spike_mv = 400;
+    cfg->leak_every = 4;
+    cfg->idle_min_s = 30.0;
+    cfg->idle_max_s = 120.0;
+    cfg->seed = 1;
+}
+
+static uint64_t seconds_to_samples(const trace_source_t *t, double s)
+{
+    return (uint64_t)(s * t->cfg.rate_hz);
+}
+
+static void enter_phase(trace_source_t *t, int phase)
+{
+    double secs = 0;
+    t->phase = phase;
+    switch (phase) {
+    case PHASE_IDLE:
+        secs = t->cfg.idle_min_s + (t->cfg.idle_max_s - t->cfg.idle_min_s) * rng_uniform(&t->rng);
+        t->level_mv = FULL_MV;
+        t->slope_mv = 0;
+        break;
+    case PHASE_FLUSH_DROP:
+        secs = 1.5 + rng_uniform(&t->rng);
+        t->slope_mv = (EMPTY_MV - t->level_mv) / secs;
+        break;
+    case PHASE_FLUSH_HOLD:
+        secs = 3.0 + 2.0 * rng_uniform(&t->rng);
+        t->level_mv = EMPTY_MV;
+        t->slope_mv = 0;
+        break;
+    case PHASE_REFILL:
+        secs = 20.0 + 15.0 * rng_uniform(&t->rng);
+        t->slope_mv = (FULL_MV - EMPTY_MV) / secs;
+        break;
+    case PHASE_LEAK_DRIFT:
+        secs = 40.0 + 40.0 * rng_uniform(&t->rng);
+        t->slope_mv = (LEAK_FLOOR_MV - FULL_MV) / secs;
+        break;
+    case PHASE_LEAK_HOLD:
+        // A leaking tank stays that way until the next use, a little longer than a normal idle period
+        secs = 2.0 * t->cfg.idle_min_s + (1.5 * t->cfg.idle_max_s - 2.0 * t->cfg.idle_min_s) * rng_uniform(&t->rng);
+        t->level_mv = LEAK_FLOOR_MV;
+        t->slope_mv = 0;
+        break;
+    }
+    t->phase_left = seconds_to_samples(t, secs);
+    if (t->phase_left == 0) {
+        t->phase_left = 1;
+    }
+}
+
+static void next_phase(trace_source_t *t)
+{
+    switch (t->phase) {
+    case PHASE_IDLE:
+        t->idle_periods++;
+        if (t->cfg.leak_every > 0 && t->idle_periods % t->cfg.leak_every == 0) {
+            enter_phase(t, PHASE_LEAK_DRIFT);
+        } else {
+            enter_phase(t, PHASE_FLUSH_DROP);
+        }
+        break;
+    case PHASE_FLUSH_DROP: enter_phase(t, PHASE_FLUSH_HOLD); break;
+    case PHASE_FLUSH_HOLD: enter_phase(t, PHASE_REFILL); break;
+    case PHASE_REFILL: enter_phase(t, PHASE_IDLE); break;
+    case PHASE_LEAK_DRIFT: enter_phase(t, PHASE_LEAK_HOLD); break;
+    case PHASE_LEAK_HOLD:
+    default:
+        // Someone flushes the leaking tank, which also reseats the flapper
+        enter_phase(t, PHASE_FLUSH_DROP);
+        break;
+    }
+}
+
+static tank_state_t phase_truth(const trace_source_t *t)
+{
+    switch (t->phase) {
+    case PHASE_FLUSH_DROP:
+    case PHASE_FLUSH_HOLD:
+        return TANK_STATE_FLUSHING;
+    case PHASE_REFILL:
+        return TANK_STATE_REFILLING;
+    case PHASE_LEAK_DRIFT:
+        // A leak is only observable once the level has left the full band
+        return t->level_mv < LEAK_THRESHOLD_MV ? TANK_STATE_LEAKING : TANK_STATE_FULL;
+    case PHASE_LEAK_HOLD:
+        return TANK_STATE_LEAKING;
+    default:
+        return TANK_STATE_FULL;
+    }
+}
+
+static int synth_read_frame(sample_source_t *src, int *voltages, int max_samples, uint32_t timeout_ms)
+{
+    trace_source_t *t = (trace_source_t *)src;
+    (void)timeout_ms;
+    if (t->samples_total >= t->sample_limit) {
+        return -1;
+    }
+    if (max_samples > t->truth_cap) {
+        max_samples = t->truth_cap;
+    }
+    int n = 0;
+    while (n < max_samples && t->samples_total < t->sample_limit) {
+        if (t->phase_left == 0) {
+            next_phase(t);
+        }
+        double mv = t->level_mv + t->cfg.noise_mv * rng_gauss(&t->rng);
+        if (rng_uniform(&t->rng) < t->cfg.spike_prob) {
+            mv += (rng_next(&t->rng) & 1) ? t->cfg.spike_mv : -t->cfg.spike_mv;
+        }
+        voltages[n] = (int)lround(mv);
+        t->truth[n] = phase_truth(t);
+        t->level_mv += t->slope_mv / t->cfg.rate_hz;
+        t->phase_left--;
+        t->samples_total++;
+        n++;
+    }
+    return n;
+}
+
+static void init_common(trace_source_t *t, const char *name, uint32_t rate_hz, int max_frame)
+{
+    memset(t, 0, sizeof(*t));
+    t->base.name = name;
+    t->base.sample_period_us = 1000000 / rate_hz;
+    t->base.ctx = t;
+    t->truth = calloc(max_frame, sizeof(tank_state_t));
+    t->truth_cap = max_frame;
+}
+
+void trace_source_open_synthetic(trace_source_t *t, const synth_config_t *cfg, int max_frame)
+{
+    init_common(t, "synthetic", cfg->rate_hz, max_frame);
+    t->base.read_frame = synth_read_frame;
+    t->cfg = *cfg;
+    t->has_truth = true;
+    trace_source_rewind(t);
+}
+
+static tank_state_t parse_state(const char *s)
+{
+    for (int st = TANK_STATE_FULL; st <= TANK_STATE_LEAKING; st++) {
+        if (strcmp(s, leak_classifier_state_name((tank_state_t)st)) == 0) {
+            return (tank_state_t)st;
+        }
+    }
+    return (tank_state_t)atoi(s);
+}
+
+static int csv_read_frame(sample_source_t *src, int *voltages, int max_samples, uint32_t timeout_ms)
+{
+    trace_source_t *t = (trace_source_t *)src;
+    char line[64];
+    (void)timeout_ms;
+    if (max_samples > t->truth_cap) {
+        max_samples = t->truth_cap;
+    }
+    int n = 0;
+    while (n < max_samples && fgets(line, sizeof(line), t->file) != NULL) {
+        char *comma = strchr(line, ',');
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        voltages[n] = atoi(line);
+        if (comma != NULL) {
+            comma[strcspn(comma, "\r\n")] = '\0';
+            t->truth[n] = parse_state(comma + 1);
+        } else {
+            t->has_truth = false;
+            t->truth[n] = TANK_STATE_FULL;
+        }
+        n++;
+    }
+    t->samples_total += n;
+    return n > 0 ? n : -1;
+}
+
+bool trace_source_open_csv(trace_source_t *t, const char *path, uint32_t rate_hz, int max_frame)
+{
+    init_common(t, "csv", rate_hz, max_frame);
+    t->base.read_frame = csv_read_frame;
+    t->file = fopen(path, "r");
+    t->has_truth = true;
+    return t->file != NULL;
+}
+
+void trace_source_rewind(trace_source_t *t)
+{
+    t->samples_total = 0;
+    if (t->file != NULL) {
+        rewind(t->file);
+        return;
+    }
+    t->sample_limit = seconds_to_samples(t, t->cfg.duration_s);
+    t->rng = t->cfg.seed ? t->cfg.seed : 1;
+    t->idle_periods = 0;
+    enter_phase(t, PHASE_IDLE);
+}
+
+void trace_source_close(trace_source_t *t)
+{
+    if (t->file != NULL) {
+        fclose(t->file);
+        t->file = NULL;
+    }
+    free(t->truth);
+    t->truth = NULL;
+}
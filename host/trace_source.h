@@ -0,0 +1,52 @@
+#ifndef TRACE_SOURCE_H
+#define TRACE_SOURCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sample_source.h"
+#include "leak_classifier.h"
+
+// Host-side sample sources: a seeded synthetic tank simulator and a CSV trace replayer.
+// Both record the ground-truth tank state for every sample they hand out.
+
+typedef struct {
+    uint32_t rate_hz;
+    double duration_s;
+    int noise_mv;           // Gaussian noise standard deviation
+    double spike_prob;      // Per-sample probability of a single-sample outlier
+    int spike_mv;           // Outlier amplitude
+    int leak_every;         // Every Nth idle period develops a slow leak (0 = never)
+    double idle_min_s;      // Time between uses is uniform in [idle_min_s, idle_max_s]
+    double idle_max_s;
+    uint32_t seed;
+} synth_config_t;
+
+typedef struct {
+    sample_source_t base;
+    // Ground truth for the samples returned by the last read_frame call
+    tank_state_t *truth;
+    int truth_cap;
+    bool has_truth;
+    uint64_t samples_total;     // Samples handed out so far
+    // Synthetic generator state
+    synth_config_t cfg;
+    uint64_t sample_limit;
+    uint32_t rng;
+    int phase;
+    uint64_t phase_left;
+    double level_mv;
+    double slope_mv;
+    uint32_t idle_periods;
+    // CSV replay state
+    FILE *file;
+} trace_source_t;
+
+void synth_default_config(synth_config_t *cfg);
+void trace_source_open_synthetic(trace_source_t *t, const synth_config_t *cfg, int max_frame);
+// CSV lines: "<mV>" or "<mV>,<state>" where state is a name (full, flushing, ...) or number
+bool trace_source_open_csv(trace_source_t *t, const char *path, uint32_t rate_hz, int max_frame);
+void trace_source_rewind(trace_source_t *t);
+void trace_source_close(trace_source_t *t);
+
+#endif // TRACE_SOURCE_H
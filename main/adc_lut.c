@@ -0,0 +1,33 @@
+#include "adc_lut.h"
+
+#define KNOT_CODES (1 << ADC_LUT_KNOT_SHIFT)
+
+static uint16_t knot_q4(adc_lut_calibrate_fn calibrate, void *ctx, int raw)
+{
+    int mv = calibrate(ctx, raw);
+    if (mv < 0) {
+        mv = 0;
+    } else if (mv > (UINT16_MAX >> ADC_LUT_FRAC_BITS)) {
+        mv = UINT16_MAX >> ADC_LUT_FRAC_BITS;
+    }
+    return (uint16_t)(mv << ADC_LUT_FRAC_BITS);
+}
+
+// The calibration API answers in whole mV. Interpolating between knots spaced a few mV
+// apart recovers the sub-mV slope the oversampled codes need.
+void adc_lut_build(adc_lut_t *lut, adc_lut_calibrate_fn calibrate, void *ctx)
+{
+    int top = ADC_LUT_CODES - 1;
+    uint16_t lo = knot_q4(calibrate, ctx, 0);
+    for (int start = 0; start < top; start += KNOT_CODES) {
+        int end = start + KNOT_CODES < top ? start + KNOT_CODES : top;
+        uint16_t hi = knot_q4(calibrate, ctx, end);
+        int span = end - start;
+        for (int raw = start; raw < end; raw++) {
+            lut->mv_q4[raw] = (uint16_t)(lo + ((int32_t)(hi - lo) * (raw - start) + span / 2) / span);
+        }
+        lo = hi;
+    }
+    lut->mv_q4[top] = lo;
+    lut->mv_q4[ADC_LUT_CODES] = lo;
+}
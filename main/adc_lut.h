@@ -0,0 +1,53 @@
+#ifndef ADC_LUT_H
+#define ADC_LUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Raw ADC code -> millivolt lookup table, built once from the calibration scheme at init.
+// Entries are mV in 1/16 mV so oversampled codes can be interpolated below one millivolt.
+
+#define ADC_LUT_RAW_BITS 12
+#define ADC_LUT_CODES (1 << ADC_LUT_RAW_BITS)
+#define ADC_LUT_FRAC_BITS 4
+#define ADC_LUT_KNOT_SHIFT 4        // Calibration is queried every 16 codes, linear in between
+
+// Calibrated voltage in mV of one raw code
+typedef int (*adc_lut_calibrate_fn)(void *ctx, int raw);
+
+typedef struct {
+    uint16_t mv_q4[ADC_LUT_CODES + 1];  // Last entry repeats the top code so interpolation needs no bounds check
+} adc_lut_t;
+
+// Oversample and decimate: 4^bits raw codes sum into one code with `bits` extra bits of resolution
+typedef struct {
+    uint32_t sum;
+    uint32_t count;
+} adc_decimator_t;
+
+void adc_lut_build(adc_lut_t *lut, adc_lut_calibrate_fn calibrate, void *ctx);
+
+// Returns true and sets *code once 4^bits samples have been accumulated
+static inline bool adc_decimator_push(adc_decimator_t *d, uint32_t raw, int bits, uint32_t *code)
+{
+    d->sum += raw;
+    if (++d->count < (1u << (2 * bits))) {
+        return false;
+    }
+    *code = d->sum >> bits;
+    d->sum = 0;
+    d->count = 0;
+    return true;
+}
+
+// Rounded mV of a code carrying `bits` bits below the raw resolution
+static inline int adc_lut_mv(const adc_lut_t *lut, uint32_t code, int bits)
+{
+    uint32_t idx = code >> bits;
+    int32_t frac = (int32_t)(code & ((1u << bits) - 1));
+    int32_t lo = lut->mv_q4[idx];
+    int32_t q4 = lo + (((int32_t)lut->mv_q4[idx + 1] - lo) * frac >> bits);
+    return (q4 + (1 << (ADC_LUT_FRAC_BITS - 1))) >> ADC_LUT_FRAC_BITS;
+}
+
+#endif // ADC_LUT_H
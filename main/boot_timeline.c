@@ -0,0 +1,134 @@
+#include "boot_timeline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+static const char *TAG = "BOOT";
+
+#define TIMELINE_MAGIC 0x7B0071AEu
+#define WAIT_POLL_MS 20
+
+static const char *const phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_APP_MAIN] = "app_main",
+    [BOOT_PHASE_SENSOR_READY] = "sensor",
+    [BOOT_PHASE_FIRST_SAMPLE] = "sample",
+    [BOOT_PHASE_NVS_INIT] = "nvs",
+    [BOOT_PHASE_NETIF_READY] = "netif",
+    [BOOT_PHASE_PROV_CHECKED] = "prov",
+    [BOOT_PHASE_WIFI_STARTED] = "wifi",
+    [BOOT_PHASE_ASSOCIATED] = "assoc",
+    [BOOT_PHASE_GOT_IP] = "ip",
+    [BOOT_PHASE_MQTT_START] = "mqtt",
+    [BOOT_PHASE_MQTT_DIAL] = "dial",
+    [BOOT_PHASE_TLS_READY] = "tls",
+    [BOOT_PHASE_CONNACK] = "connack",
+    [BOOT_PHASE_FIRST_PUBACK] = "puback",
+};
+
+typedef struct {
+    uint32_t marks_us[BOOT_PHASE_COUNT];    // 0 = phase not reached
+    uint32_t boot;                          // Boot number since power-on, deep-sleep wakes included
+    bool wake;                              // Woke from deep sleep rather than a reset
+} timeline_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t boots;
+    timeline_t current;
+    timeline_t previous;
+} timeline_store_t;
+
+static RTC_DATA_ATTR timeline_store_t store;
+
+void boot_timeline_start(void)
+{
+    bool wake = esp_reset_reason() == ESP_RST_DEEPSLEEP;
+    if (store.magic != TIMELINE_MAGIC || !wake) {
+        memset(&store, 0, sizeof(store));
+        store.magic = TIMELINE_MAGIC;
+    } else if (store.current.marks_us[BOOT_PHASE_MQTT_START] != 0) {
+        // Keep the last wake that brought the radio up; sample-only wakes would just overwrite it
+        store.previous = store.current;
+    }
+    memset(&store.current, 0, sizeof(store.current));
+    store.current.boot = ++store.boots;
+    store.current.wake = wake;
+    boot_timeline_mark(BOOT_PHASE_APP_MAIN);
+}
+
+void boot_timeline_mark(boot_phase_t phase)
+{
+    if (store.current.marks_us[phase] == 0) {
+        uint32_t now_us = (uint32_t)esp_timer_get_time();
+        store.current.marks_us[phase] = now_us != 0 ? now_us : 1;
+    }
+}
+
+uint32_t boot_timeline_get(boot_phase_t phase)
+{
+    return store.current.marks_us[phase];
+}
+
+bool boot_timeline_wait(boot_phase_t phase, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (boot_timeline_get(phase) == 0) {
+        if (xTaskGetTickCount() - start >= timeout) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(WAIT_POLL_MS));
+    }
+    return true;
+}
+
+int boot_timeline_encode(bool previous, char *buf, size_t buf_len)
+{
+    const timeline_t *t = previous ? &store.previous : &store.current;
+    if (t->boot == 0) {
+        return -1;
+    }
+    int len = snprintf(buf, buf_len, "{\"boot\":%lu,\"wake\":%s,\"us\":{", (unsigned long)t->boot,
+                       t->wake ? "true" : "false");
+    bool first = true;
+    for (int i = 0; i < BOOT_PHASE_COUNT && len > 0 && (size_t)len < buf_len; i++) {
+        if (t->marks_us[i] == 0) {
+            continue;
+        }
+        len += snprintf(buf + len, buf_len - len, "%s\"%s\":%lu", first ? "" : ",", phase_names[i],
+                        (unsigned long)t->marks_us[i]);
+        first = false;
+    }
+    if (len < 0 || (size_t)len + 2 >= buf_len) {
+        return -1;
+    }
+    buf[len++] = '}';
+    buf[len++] = '}';
+    buf[len] = '\0';
+    return len;
+}
+
+void boot_timeline_log(void)
+{
+    char line[BOOT_TIMELINE_MAX_ENCODED];
+    int len = 0;
+    uint32_t prev_us = 0;
+    for (int i = 0; i < BOOT_PHASE_COUNT && (size_t)len < sizeof(line); i++) {
+        uint32_t at_us = store.current.marks_us[i];
+        if (at_us == 0) {
+            continue;
+        }
+        // Phases run partly in parallel (sampling starts before the network), so show absolute times
+        // and the step from the previous marker in phase order
+        len += snprintf(line + len, sizeof(line) - len, " %s %lu.%lu ms (%+ld)", phase_names[i],
+                        (unsigned long)(at_us / 1000), (unsigned long)(at_us % 1000 / 100),
+                        (long)((int32_t)(at_us - prev_us) / 1000));
+        prev_us = at_us;
+    }
+    ESP_LOGI(TAG, "Boot %lu%s timeline:%s", (unsigned long)store.current.boot, store.current.wake ? " (wake)" : "",
+             line);
+}
@@ -0,0 +1,47 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+// Boot and connection phase markers: esp_timer timestamps from reset to the first acknowledged publish,
+// kept in RTC memory so the timeline of the previous boot or wake survives deep sleep
+#define BOOT_TIMELINE_SUBTOPIC "/boot"
+#define BOOT_TIMELINE_MAX_ENCODED 384
+
+typedef enum {
+    BOOT_PHASE_APP_MAIN,        // app_main entered
+    BOOT_PHASE_SENSOR_READY,    // ADC and calibration set up
+    BOOT_PHASE_FIRST_SAMPLE,    // First scan handed to the sensor task
+    BOOT_PHASE_NVS_INIT,
+    BOOT_PHASE_NETIF_READY,     // esp_netif, default event loop and station netif created
+    BOOT_PHASE_PROV_CHECKED,    // Stored credentials found, or the provisioning flow started
+    BOOT_PHASE_WIFI_STARTED,    // esp_wifi_start() returned
+    BOOT_PHASE_ASSOCIATED,
+    BOOT_PHASE_GOT_IP,          // DHCP lease (or the cached one) applied
+    BOOT_PHASE_MQTT_START,      // MQTT client started
+    BOOT_PHASE_MQTT_DIAL,       // Client begins DNS, TCP and the TLS handshake
+    BOOT_PHASE_TLS_READY,       // TLS handshake done
+    BOOT_PHASE_CONNACK,         // Broker session up; the span since TLS_READY is any WebSocket upgrade plus CONNECT
+    BOOT_PHASE_FIRST_PUBACK,
+    BOOT_PHASE_COUNT
+} boot_phase_t;
+
+// Call first thing in app_main. After a deep-sleep wake, the last timeline that reached MQTT_START
+// becomes the previous one; any other reset clears both.
+void boot_timeline_start(void);
+// Record a phase; only its first occurrence in a boot is kept. Safe from any task.
+void boot_timeline_mark(boot_phase_t phase);
+// Microseconds since reset at which the phase was reached, 0 if not yet
+uint32_t boot_timeline_get(boot_phase_t phase);
+// Poll until a phase is reached. Returns false on timeout.
+bool boot_timeline_wait(boot_phase_t phase, TickType_t timeout);
+// JSON record of this boot's timeline (or the previous radio wake's). Returns the length, or -1 if it does not fit
+// or there is no previous timeline.
+int boot_timeline_encode(bool previous, char *buf, size_t buf_len);
+// One log line with the duration of every phase reached
+void boot_timeline_log(void);
+
+#endif // BOOT_TIMELINE_H
@@ -0,0 +1,498 @@
+#include "device_config.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "mem_profile.h"
+#include "metrics.h"
+#include "report_policy.h"
+#include "sample_scheduler.h"
+#include "telemetry_batch.h"
+
+static const char *TAG = "DEVICE_CONFIG";
+
+// Scalar keys with their accepted range
+typedef struct {
+    const char *key;
+    size_t offset;
+    int32_t min;
+    int32_t max;
+} config_field_t;
+
+#define FIELD(name, lo, hi) { #name, offsetof(device_config_t, name), lo, hi }
+
+static const config_field_t scalar_fields[] = {
+    FIELD(check_ms, 500, 3600000),
+    FIELD(publish_ms, 1000, 3600000),
+    FIELD(deadband_mv, 5, 2000),
+    FIELD(heartbeat_ms, 10000, 86400000),
+    // Above SAMPLE_PERIOD_MAX_MS a short flush can fall between two readings; allowed for power saving
+    FIELD(sample_min_ms, 10, 60000),
+    FIELD(sample_max_ms, 10, 60000),
+    FIELD(batch_ms, 5000, 3600000),
+    FIELD(diag_ms, 10000, 86400000),
+};
+
+#define SCALAR_COUNT (sizeof(scalar_fields) / sizeof(scalar_fields[0]))
+
+#define THRESHOLD_MIN_MV 100
+#define THRESHOLD_MAX_MV 3300
+
+// Keys a layer sets: one bit per scalar field, then one per probe for each threshold list
+#define SCALAR_BIT(i) (1u << (i))
+#define LEAK_BIT(p) (1u << (SCALAR_COUNT + (p)))
+#define FLUSH_BIT(p) (1u << (SCALAR_COUNT + LEAK_SENSOR_MAX_PROBES + (p)))
+_Static_assert(SCALAR_COUNT + 2 * LEAK_SENSOR_MAX_PROBES <= 32, "config_layer_t.set has one bit per key");
+
+typedef struct {
+    uint32_t set;
+    device_config_t values;     // Only the keys in set mean anything
+} config_layer_t;
+
+// Saved with a header so a blob from an older layout is ignored rather than misread
+typedef struct {
+    uint16_t version;
+    uint16_t size;
+    config_layer_t layers[DEVICE_CONFIG_LAYER_COUNT];
+} stored_layers_t;
+
+// Version 1 saved the merged configuration only
+#define LEGACY_CONFIG_VERSION 1
+typedef struct {
+    uint16_t version;
+    uint16_t size;
+    device_config_t cfg;
+} stored_config_t;
+
+static config_layer_t layers[DEVICE_CONFIG_LAYER_COUNT];
+static device_config_t active;
+static SemaphoreHandle_t lock;
+static atomic_uint generation;
+static char device_id[13];
+
+static void default_config(device_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    for (int p = 0; p < LEAK_SENSOR_MAX_PROBES; p++) {
+        const leak_sensor_probe_t *probe = liquid_level_sensor_probe(p < liquid_level_sensor_probe_count() ? p : 0);
+        cfg->leak_mv[p] = probe->leak_threshold_mv;
+        cfg->flush_mv[p] = probe->flush_threshold_mv;
+    }
+    cfg->check_ms = SENSOR_CHECK_INTERVAL_MS;
+    cfg->publish_ms = MQTT_PUBLISH_INTERVAL_MS;
+    cfg->deadband_mv = REPORT_DEADBAND_MV;
+    cfg->heartbeat_ms = REPORT_HEARTBEAT_MS;
+    cfg->sample_min_ms = SAMPLE_PERIOD_MIN_MS;
+    cfg->sample_max_ms = SAMPLE_PERIOD_MAX_MS;
+    cfg->batch_ms = TELEMETRY_BATCH_DEADLINE_MS;
+    cfg->diag_ms = METRICS_PUBLISH_INTERVAL_MS;
+}
+
+// Range and cross-field checks. Returns NULL if valid, else what is wrong.
+static const char *validate(const device_config_t *cfg)
+{
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        int32_t v = *(const int32_t *)((const char *)cfg + scalar_fields[i].offset);
+        if (v < scalar_fields[i].min || v > scalar_fields[i].max) {
+            return scalar_fields[i].key;
+        }
+    }
+    for (int p = 0; p < liquid_level_sensor_probe_count(); p++) {
+        if (cfg->leak_mv[p] < THRESHOLD_MIN_MV || cfg->leak_mv[p] > THRESHOLD_MAX_MV) {
+            return "leak_mv";
+        }
+        if (cfg->flush_mv[p] < THRESHOLD_MIN_MV || cfg->flush_mv[p] >= cfg->leak_mv[p]) {
+            return "flush_mv";
+        }
+    }
+    if (cfg->sample_min_ms > cfg->sample_max_ms) {
+        return "sample_min_ms";
+    }
+    return NULL;
+}
+
+static int32_t *scalar_of(device_config_t *cfg, size_t i)
+{
+    return (int32_t *)((char *)cfg + scalar_fields[i].offset);
+}
+
+// Copy the keys a layer sets over cfg
+static void overlay(device_config_t *cfg, const config_layer_t *layer)
+{
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        if (layer->set & SCALAR_BIT(i)) {
+            *scalar_of(cfg, i) = *(const int32_t *)((const char *)&layer->values + scalar_fields[i].offset);
+        }
+    }
+    for (int p = 0; p < LEAK_SENSOR_MAX_PROBES; p++) {
+        if (layer->set & LEAK_BIT(p)) {
+            cfg->leak_mv[p] = layer->values.leak_mv[p];
+        }
+        if (layer->set & FLUSH_BIT(p)) {
+            cfg->flush_mv[p] = layer->values.flush_mv[p];
+        }
+    }
+}
+
+// Defaults, then each layer in order of precedence
+static void merge(const config_layer_t *from, device_config_t *cfg)
+{
+    default_config(cfg);
+    for (int i = 0; i < DEVICE_CONFIG_LAYER_COUNT; i++) {
+        overlay(cfg, &from[i]);
+    }
+}
+
+// A version 1 configuration becomes a device layer holding whatever differs from the defaults
+static void layer_from_config(config_layer_t *layer, const device_config_t *cfg)
+{
+    device_config_t defaults;
+    default_config(&defaults);
+    memset(layer, 0, sizeof(*layer));
+    layer->values = *cfg;
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        if (*scalar_of(&layer->values, i) != *scalar_of(&defaults, i)) {
+            layer->set |= SCALAR_BIT(i);
+        }
+    }
+    for (int p = 0; p < LEAK_SENSOR_MAX_PROBES; p++) {
+        if (cfg->leak_mv[p] != defaults.leak_mv[p]) {
+            layer->set |= LEAK_BIT(p);
+        }
+        if (cfg->flush_mv[p] != defaults.flush_mv[p]) {
+            layer->set |= FLUSH_BIT(p);
+        }
+    }
+}
+
+static bool load_layers(nvs_handle_t nvs)
+{
+    stored_layers_t stored;
+    size_t len = sizeof(stored);
+    if (nvs_get_blob(nvs, DEVICE_CONFIG_NVS_LAYERS_KEY, &stored, &len) != ESP_OK || len != sizeof(stored) ||
+        stored.version != DEVICE_CONFIG_VERSION || stored.size != sizeof(stored.layers)) {
+        return false;
+    }
+    memcpy(layers, stored.layers, sizeof(layers));
+    return true;
+}
+
+static bool load_legacy(nvs_handle_t nvs)
+{
+    stored_config_t stored;
+    size_t len = sizeof(stored);
+    if (nvs_get_blob(nvs, DEVICE_CONFIG_NVS_KEY, &stored, &len) != ESP_OK || len != sizeof(stored) ||
+        stored.version != LEGACY_CONFIG_VERSION || stored.size != sizeof(stored.cfg)) {
+        return false;
+    }
+    layer_from_config(&layers[DEVICE_CONFIG_DEVICE], &stored.cfg);
+    return true;
+}
+
+static void load_saved(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(DEVICE_CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    bool loaded = load_layers(nvs) || load_legacy(nvs);
+    nvs_close(nvs);
+    if (!loaded) {
+        return;
+    }
+    device_config_t cfg;
+    merge(layers, &cfg);
+    const char *invalid = validate(&cfg);
+    if (invalid != NULL) {
+        ESP_LOGW(TAG, "Saved configuration rejected (%s), using defaults", invalid);
+        memset(layers, 0, sizeof(layers));
+        return;
+    }
+    active = cfg;
+    ESP_LOGI(TAG, "Loaded saved configuration");
+}
+
+static esp_err_t save(const config_layer_t *from)
+{
+    stored_layers_t stored = {
+        .version = DEVICE_CONFIG_VERSION,
+        .size = sizeof(stored.layers),
+    };
+    memcpy(stored.layers, from, sizeof(stored.layers));
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(DEVICE_CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs, DEVICE_CONFIG_NVS_LAYERS_KEY, &stored, sizeof(stored));
+    if (err == ESP_OK) {
+        nvs_erase_key(nvs, DEVICE_CONFIG_NVS_KEY);
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+void device_config_init(void)
+{
+    MEM_MUTEX_CREATE(&lock);
+    default_config(&active);
+
+    uint8_t mac[6] = { 0 };
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(device_id, sizeof(device_id), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    // Wi-Fi setup repeats this and erases a truncated partition; until then a failure just means defaults
+    if (nvs_flash_init() == ESP_OK) {
+        load_saved();
+    }
+}
+
+void device_config_get(device_config_t *cfg)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *cfg = active;
+    xSemaphoreGive(lock);
+}
+
+uint32_t device_config_generation(void)
+{
+    return atomic_load(&generation);
+}
+
+const char *device_config_device_id(void)
+{
+    return device_id;
+}
+
+static const char *skip_ws(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+    return p;
+}
+
+static const char *parse_int(const char *p, int32_t *out)
+{
+    char *end;
+    long v = strtol(p, &end, 10);
+    if (end == p || v < INT32_MIN || v > INT32_MAX) {
+        return NULL;
+    }
+    *out = (int32_t)v;
+    return end;
+}
+
+// Key as it may safely appear in an error message
+static void report_key(char *err, size_t err_len, const char *what, const char *key, size_t key_len)
+{
+    char clean[24];
+    size_t n = 0;
+    for (size_t i = 0; i < key_len && n + 1 < sizeof(clean); i++) {
+        char c = key[i];
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_') {
+            clean[n++] = c;
+        }
+    }
+    clean[n] = '\0';
+    snprintf(err, err_len, "%s %s", what, clean);
+}
+
+// Apply one "key": value pair to a layer. Returns the position after the value, or NULL on error.
+static const char *parse_member(const char *p, config_layer_t *layer, char *err, size_t err_len)
+{
+    if (*p != '"') {
+        snprintf(err, err_len, "expected key");
+        return NULL;
+    }
+    const char *key = ++p;
+    while (*p != '"' && *p != '\0') {
+        p++;
+    }
+    if (*p != '"') {
+        snprintf(err, err_len, "unterminated key");
+        return NULL;
+    }
+    size_t key_len = p - key;
+    p = skip_ws(p + 1);
+    if (*p != ':') {
+        snprintf(err, err_len, "expected ':'");
+        return NULL;
+    }
+    p = skip_ws(p + 1);
+
+    int32_t *thresholds = NULL;
+    uint32_t first_bit = 0;
+    if (key_len == 7 && strncmp(key, "leak_mv", 7) == 0) {
+        thresholds = layer->values.leak_mv;
+        first_bit = LEAK_BIT(0);
+    } else if (key_len == 8 && strncmp(key, "flush_mv", 8) == 0) {
+        thresholds = layer->values.flush_mv;
+        first_bit = FLUSH_BIT(0);
+    }
+    if (thresholds != NULL) {
+        int32_t v;
+        if (*p != '[') {
+            // One number sets every probe
+            if ((p = parse_int(p, &v)) == NULL) {
+                report_key(err, err_len, "bad value for", key, key_len);
+                return NULL;
+            }
+            for (int i = 0; i < LEAK_SENSOR_MAX_PROBES; i++) {
+                thresholds[i] = v;
+                layer->set |= first_bit << i;
+            }
+            return p;
+        }
+        // Per-probe list in registry order; a shorter list leaves the remaining probes alone
+        p = skip_ws(p + 1);
+        for (int i = 0; *p != ']'; i++) {
+            if (i >= liquid_level_sensor_probe_count() || (p = parse_int(p, &v)) == NULL) {
+                report_key(err, err_len, "bad list for", key, key_len);
+                return NULL;
+            }
+            thresholds[i] = v;
+            layer->set |= first_bit << i;
+            p = skip_ws(p);
+            if (*p == ',') {
+                p = skip_ws(p + 1);
+            } else if (*p != ']') {
+                report_key(err, err_len, "bad list for", key, key_len);
+                return NULL;
+            }
+        }
+        return p + 1;
+    }
+
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        const config_field_t *f = &scalar_fields[i];
+        if (strlen(f->key) == key_len && strncmp(key, f->key, key_len) == 0) {
+            if ((p = parse_int(p, scalar_of(&layer->values, i))) == NULL) {
+                report_key(err, err_len, "bad value for", key, key_len);
+            }
+            layer->set |= SCALAR_BIT(i);
+            return p;
+        }
+    }
+    report_key(err, err_len, "unknown key", key, key_len);
+    return NULL;
+}
+
+esp_err_t device_config_apply_json(device_config_layer_t source, const char *json, size_t len, bool *changed,
+                                   char *err, size_t err_len)
+{
+    char text[DEVICE_CONFIG_MAX_MESSAGE + 1];
+    *changed = false;
+    if (len > DEVICE_CONFIG_MAX_MESSAGE) {
+        snprintf(err, err_len, "update too large");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(text, json, len);
+    text[len] = '\0';
+
+    // Patch a copy of the layer; nothing is replaced until the whole update checks out
+    config_layer_t layer;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    layer = layers[source];
+    xSemaphoreGive(lock);
+    const char *p = skip_ws(text);
+    if (*p != '{') {
+        snprintf(err, err_len, "expected a JSON object");
+        return ESP_ERR_INVALID_ARG;
+    }
+    p = skip_ws(p + 1);
+    while (*p != '}') {
+        if ((p = parse_member(p, &layer, err, err_len)) == NULL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        p = skip_ws(p);
+        if (*p == ',') {
+            p = skip_ws(p + 1);
+        } else if (*p != '}') {
+            snprintf(err, err_len, "expected ',' or '}'");
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    // Checked merged with the other layer: a fleet threshold has to work with this device's overrides
+    config_layer_t next[DEVICE_CONFIG_LAYER_COUNT];
+    device_config_t cfg;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    memcpy(next, layers, sizeof(next));
+    next[source] = layer;
+    merge(next, &cfg);
+    const char *invalid = validate(&cfg);
+    if (invalid != NULL) {
+        xSemaphoreGive(lock);
+        snprintf(err, err_len, "%s out of range", invalid);
+        return ESP_ERR_INVALID_ARG;
+    }
+    // A retained update is delivered again on every reconnect; only real changes touch flash
+    bool layer_changed = memcmp(&layer, &layers[source], sizeof(layer)) != 0;
+    *changed = memcmp(&cfg, &active, sizeof(cfg)) != 0;
+    layers[source] = layer;
+    if (*changed) {
+        active = cfg;
+        atomic_fetch_add(&generation, 1);
+    }
+    xSemaphoreGive(lock);
+
+    if (layer_changed) {
+        esp_err_t save_err = save(next);
+        if (save_err != ESP_OK) {
+            // Running with it anyway; it just will not survive a reboot
+            ESP_LOGE(TAG, "Failed to save configuration: %s", esp_err_to_name(save_err));
+        }
+    }
+    return ESP_OK;
+}
+
+static int append(char *buf, size_t buf_len, int pos, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static int append(char *buf, size_t buf_len, int pos, const char *fmt, ...)
+{
+    if (pos < 0 || (size_t)pos >= buf_len) {
+        return -1;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + pos, buf_len - pos, fmt, args);
+    va_end(args);
+    return (n < 0 || (size_t)n >= buf_len - pos) ? -1 : pos + n;
+}
+
+static int append_list(char *buf, size_t buf_len, int pos, const char *key, const int32_t *values)
+{
+    pos = append(buf, buf_len, pos, ",\"%s\":[", key);
+    for (int p = 0; p < liquid_level_sensor_probe_count(); p++) {
+        pos = append(buf, buf_len, pos, "%s%ld", p > 0 ? "," : "", (long)values[p]);
+    }
+    return append(buf, buf_len, pos, "]");
+}
+
+int device_config_encode(const char *result, char *buf, size_t buf_len)
+{
+    device_config_t cfg;
+    device_config_get(&cfg);
+
+    int pos = append(buf, buf_len, 0, "{\"gen\":%lu,\"result\":\"%s\"", (unsigned long)device_config_generation(),
+                     result);
+    pos = append_list(buf, buf_len, pos, "leak_mv", cfg.leak_mv);
+    pos = append_list(buf, buf_len, pos, "flush_mv", cfg.flush_mv);
+    for (size_t i = 0; i < SCALAR_COUNT; i++) {
+        pos = append(buf, buf_len, pos, ",\"%s\":%ld", scalar_fields[i].key,
+                     (long)*(const int32_t *)((const char *)&cfg + scalar_fields[i].offset));
+    }
+    return append(buf, buf_len, pos, "}");
+}
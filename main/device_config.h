@@ -0,0 +1,66 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "leak_sensor.h"
+
+// Runtime configuration: thresholds and rates that can be changed over MQTT without reflashing.
+// Updates are JSON objects with any subset of the keys below, published to
+//   MQTT_TOPIC "/config/<device id>/set"   one device (device id = station MAC in hex)
+//   MQTT_TOPIC "/config/all/set"           every device
+// The two topics feed separate layers, each holding only the keys its updates set: the active configuration is
+// the defaults, then the fleet layer, then the device layer, so a fleet update never overrides a key set for this
+// device, whatever order the retained messages arrive in. A whole update is validated (against the merged result)
+// before anything changes, then applied to the running tasks, both layers are saved to NVS and the active
+// configuration is published retained to MQTT_TOPIC "/config/<device id>".
+#define DEVICE_CONFIG_SUBTOPIC "/config"
+#define DEVICE_CONFIG_NVS_NAMESPACE "devcfg"
+#define DEVICE_CONFIG_NVS_KEY "active"           // Version 1: the merged configuration, read as a device layer
+#define DEVICE_CONFIG_NVS_LAYERS_KEY "layers"
+#define DEVICE_CONFIG_VERSION 2
+#define DEVICE_CONFIG_MAX_MESSAGE 384       // Largest update accepted; with its topic it fits the MQTT receive buffer
+#define DEVICE_CONFIG_MAX_ENCODED 384
+
+// Defaults for the keys that have no home module
+#define SENSOR_CHECK_INTERVAL_MS 1500       // Report every probe at least this often
+#define MQTT_PUBLISH_INTERVAL_MS 5000       // Fixed publish interval when not reporting by exception
+
+typedef struct {
+    int32_t leak_mv[LEAK_SENSOR_MAX_PROBES];    // "leak_mv": per-probe full/leak threshold (number = every probe)
+    int32_t flush_mv[LEAK_SENSOR_MAX_PROBES];   // "flush_mv": per-probe flush threshold
+    int32_t check_ms;                           // "check_ms": report every probe at least this often
+    int32_t publish_ms;                         // "publish_ms": fixed publish interval (REPORT_BY_EXCEPTION=0)
+    int32_t deadband_mv;                        // "deadband_mv": report-by-exception voltage deadband
+    int32_t heartbeat_ms;                       // "heartbeat_ms": report-by-exception heartbeat
+    int32_t sample_min_ms;                      // "sample_min_ms": fastest adaptive sampling period
+    int32_t sample_max_ms;                      // "sample_max_ms": slowest adaptive sampling period
+    int32_t batch_ms;                           // "batch_ms": telemetry batch deadline
+    int32_t diag_ms;                            // "diag_ms": diagnostics publish interval
+} device_config_t;
+
+// Update sources, lowest precedence first
+typedef enum {
+    DEVICE_CONFIG_FLEET,
+    DEVICE_CONFIG_DEVICE,
+    DEVICE_CONFIG_LAYER_COUNT
+} device_config_layer_t;
+
+// Load defaults, then any valid configuration saved in NVS. Call before the tasks start.
+void device_config_init(void);
+// Consistent copy of the active configuration
+void device_config_get(device_config_t *cfg);
+// Bumped on every applied update, so tasks can cheaply notice a change
+uint32_t device_config_generation(void);
+// Validate and apply a JSON update to one layer. On error nothing changes and err says why.
+// *changed is false when the active configuration stayed the same.
+esp_err_t device_config_apply_json(device_config_layer_t layer, const char *json, size_t len, bool *changed,
+                                   char *err, size_t err_len);
+// JSON record of the active configuration, with the result of the last update
+int device_config_encode(const char *result, char *buf, size_t buf_len);
+// Station MAC as 12 hex digits
+const char *device_config_device_id(void);
+
+#endif // DEVICE_CONFIG_H
@@ -0,0 +1,115 @@
+#include "duty_cycle.h"
+
+#include <string.h>
+#include "payload_codec.h"
+
+void duty_cycle_default_config(duty_cycle_config_t *cfg)
+{
+    cfg->wake_interval_ms = DUTY_WAKE_INTERVAL_MS;
+    cfg->status_interval_ms = DUTY_STATUS_INTERVAL_MS;
+    cfg->retry_interval_ms = DUTY_RETRY_INTERVAL_MS;
+}
+
+void duty_cycle_classifier_config(leak_classifier_config_t *ccfg, const duty_cycle_config_t *cfg)
+{
+    leak_classifier_default_config(ccfg, cfg->wake_interval_ms * 1000);
+    ccfg->leak_confirm_samples = DUTY_LEAK_CONFIRM_WAKES;
+}
+
+bool duty_cycle_resume(duty_cycle_state_t *st, const leak_classifier_config_t *ccfg)
+{
+    if (st->magic == DUTY_CYCLE_MAGIC) {
+        // Thresholds may have changed since the last wake; the period has not, so nothing is rescaled
+        leak_classifier_retime(&st->classifier, ccfg, 0, 0);
+        return true;
+    }
+    memset(st, 0, sizeof(*st));
+    st->magic = DUTY_CYCLE_MAGIC;
+    st->last_state = TANK_STATE_FULL;
+    leak_classifier_init(&st->classifier, ccfg);
+    telemetry_batch_init(&st->history);
+    return false;
+}
+
+int64_t duty_cycle_now_ms(const duty_cycle_state_t *st, uint32_t awake_ms)
+{
+    return st->wake_ms + awake_ms;
+}
+
+duty_action_t duty_cycle_step(duty_cycle_state_t *st, const duty_cycle_config_t *cfg, int64_t now_ms, int voltage_mv)
+{
+    st->stats.wakes++;
+
+    //-------------Detection---------------//
+    tank_state_t state = leak_classifier_feed(&st->classifier, &voltage_mv, 1);
+    if (state == TANK_STATE_LEAKING && st->last_state != TANK_STATE_LEAKING) {
+        st->alarm_pending = true;
+        st->stats.alarms++;
+    }
+    st->last_state = state;
+
+    telemetry_sample_t sample = {
+        .timestamp_ms = now_ms,
+        .voltage_mv = leak_classifier_voltage(&st->classifier),
+        .state = (uint8_t)state,
+        .flags = (state == TANK_STATE_FULL ? PAYLOAD_FLAG_FULL_TANK : 0) |
+                 (state == TANK_STATE_LEAKING ? PAYLOAD_FLAG_LEAK : 0) |
+                 (state == TANK_STATE_FLUSHING ? PAYLOAD_FLAG_FLUSH : 0),
+    };
+    bool history_full = telemetry_batch_add(&st->history, &sample, (uint32_t)now_ms);
+
+    //-------------Uplink decision---------------//
+    // A leak alarm goes out on the wake that raised it, and is retried every wake until delivered
+    if (st->alarm_pending) {
+        return DUTY_UPLINK_ALARM;
+    }
+    // Back off after a failure so an unreachable AP does not keep the radio on every wake
+    if (st->attempt_failed && now_ms - st->last_attempt_ms < cfg->retry_interval_ms) {
+        return DUTY_SLEEP;
+    }
+    if (!st->uplinked || now_ms - st->last_uplink_ms >= cfg->status_interval_ms) {
+        return DUTY_UPLINK_STATUS;
+    }
+    if (history_full) {
+        return DUTY_UPLINK_HISTORY_FULL;
+    }
+    return DUTY_SLEEP;
+}
+
+void duty_cycle_uplink_result(duty_cycle_state_t *st, int64_t now_ms, bool ok, uint32_t radio_ms)
+{
+    st->last_attempt_ms = now_ms;
+    st->attempt_failed = !ok;
+    st->stats.radio_ms += radio_ms;
+    if (!ok) {
+        st->stats.uplink_failures++;
+        return;
+    }
+    st->stats.uplinks++;
+    st->uplinked = true;
+    st->last_uplink_ms = now_ms;
+    st->alarm_pending = false;
+    telemetry_batch_clear(&st->history);
+}
+
+uint32_t duty_cycle_sleep_ms(duty_cycle_state_t *st, const duty_cycle_config_t *cfg, uint32_t awake_ms)
+{
+    uint32_t sleep_ms = DUTY_MIN_SLEEP_MS;
+    if (awake_ms + DUTY_MIN_SLEEP_MS < cfg->wake_interval_ms) {
+        sleep_ms = cfg->wake_interval_ms - awake_ms;
+    }
+    st->stats.awake_ms += awake_ms;
+    st->wake_ms += awake_ms + sleep_ms;
+    return sleep_ms;
+}
+
+const char *duty_action_name(duty_action_t action)
+{
+    switch (action) {
+    case DUTY_SLEEP: return "sleep";
+    case DUTY_UPLINK_ALARM: return "alarm";
+    case DUTY_UPLINK_STATUS: return "status";
+    case DUTY_UPLINK_HISTORY_FULL: return "history full";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "leak_classifier.h"
+#include "telemetry_batch.h"
+
+// Operating mode: 1 = wake on a timer, sample once, deep sleep again; the radio only comes up for
+// a new leak, the status interval, or a full history. 0 = always-on tasks.
+#ifndef DUTY_CYCLE_MODE
+#define DUTY_CYCLE_MODE 0
+#endif
+
+#define DUTY_WAKE_INTERVAL_MS 60000         // One reading per wake
+#define DUTY_STATUS_INTERVAL_MS 3600000     // Upload the history at least this often
+#define DUTY_RETRY_INTERVAL_MS 300000       // After a failed uplink, wait this long before the radio comes up again
+#define DUTY_MIN_SLEEP_MS 1000              // Never schedule a shorter sleep, even after a long uplink
+#define DUTY_LEAK_CONFIRM_WAKES 2           // Consecutive low wakes before FULL -> LEAKING
+#define DUTY_CYCLE_MAGIC 0x44435931         // "DCY1"
+
+// Pure scheduling and history logic with no driver dependencies, so the same code runs on
+// the device (state in RTC memory) and in the host simulator (state on a simulated clock).
+
+typedef enum {
+    DUTY_SLEEP = 0,
+    DUTY_UPLINK_ALARM,          // Tank entered LEAKING since the last upload
+    DUTY_UPLINK_STATUS,         // Status interval elapsed (or first boot)
+    DUTY_UPLINK_HISTORY_FULL,   // Next reading would overwrite history not yet uploaded
+} duty_action_t;
+
+typedef struct {
+    uint32_t wake_interval_ms;
+    uint32_t status_interval_ms;
+    uint32_t retry_interval_ms;
+} duty_cycle_config_t;
+
+typedef struct {
+    uint32_t wakes;
+    uint32_t uplinks;
+    uint32_t uplink_failures;
+    uint32_t alarms;
+    uint64_t awake_ms;          // Total time spent awake, radio included
+    uint64_t radio_ms;          // Total time the radio was on
+} duty_cycle_stats_t;
+
+// Everything that must survive deep sleep
+typedef struct {
+    uint32_t magic;
+    int64_t wake_ms;            // Monotonic ms since first power-on at the start of this wake
+    int64_t last_uplink_ms;
+    int64_t last_attempt_ms;
+    int64_t epoch_offset_ms;    // Wall clock minus monotonic ms once SNTP has synced, else 0
+    bool uplinked;              // At least one successful upload since power-on
+    bool attempt_failed;        // Most recent uplink attempt failed
+    bool alarm_pending;         // LEAKING entered and not yet uploaded
+    tank_state_t last_state;
+    leak_classifier_t classifier;
+    telemetry_batch_t history;  // Readings since the last successful upload
+    duty_cycle_stats_t stats;
+} duty_cycle_state_t;
+
+void duty_cycle_default_config(duty_cycle_config_t *cfg);
+// Classifier settings for one reading per wake: median-of-3 across wakes, leak confirmed over
+// DUTY_LEAK_CONFIRM_WAKES wakes so a single reading taken mid-refill is not an alarm
+void duty_cycle_classifier_config(leak_classifier_config_t *ccfg, const duty_cycle_config_t *cfg);
+// Returns true if st holds state retained from a previous wake, with ccfg applied to its classifier;
+// otherwise it is reset (cold boot)
+bool duty_cycle_resume(duty_cycle_state_t *st, const leak_classifier_config_t *ccfg);
+// Current monotonic time given the time awake in this wake
+int64_t duty_cycle_now_ms(const duty_cycle_state_t *st, uint32_t awake_ms);
+// Classify the wake's reading, append it to the history and decide whether to bring the radio up
+duty_action_t duty_cycle_step(duty_cycle_state_t *st, const duty_cycle_config_t *cfg, int64_t now_ms, int voltage_mv);
+void duty_cycle_uplink_result(duty_cycle_state_t *st, int64_t now_ms, bool ok, uint32_t radio_ms);
+// Account this wake and return how long to sleep so wakes stay on the interval grid
+uint32_t duty_cycle_sleep_ms(duty_cycle_state_t *st, const duty_cycle_config_t *cfg, uint32_t awake_ms);
+const char *duty_action_name(duty_action_t action);
+
+#endif // DUTY_CYCLE_H
@@ -0,0 +1,371 @@
+#include "event_log.h"
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "mem_profile.h"
+
+#if DEFERRED_LOGGING && EVENT_LOG_CONSOLE
+static const char *TAG = "EVENT_LOG";
+#endif
+
+_Static_assert((EVENT_LOG_RECORDS & (EVENT_LOG_RECORDS - 1)) == 0, "EVENT_LOG_RECORDS must be a power of two");
+
+typedef struct {
+    log_module_t module;
+    esp_log_level_t level;
+    const char *format;
+} log_format_t;
+
+static const log_format_t formats[LOG_EVENT_COUNT] = {
+    [LOG_EVENT_TANK_TRANSITION] = { LOG_MODULE_SENSOR, ESP_LOG_INFO, "Tank %s: %s -> %s (%dmV)" },
+    [LOG_EVENT_TANK_VOLTAGE] = { LOG_MODULE_SENSOR, ESP_LOG_INFO, "Tank %s voltage: %dmV" },
+    [LOG_EVENT_SENSOR_OVERRUN] = { LOG_MODULE_SENSOR, ESP_LOG_WARN, "Publisher behind, dropped reading (%u total)" },
+    [LOG_EVENT_SAMPLE_PERIOD] = { LOG_MODULE_SENSOR, ESP_LOG_DEBUG, "Sampling every %u ms" },
+    [LOG_EVENT_REPORTED] = { LOG_MODULE_PUBLISH, ESP_LOG_INFO, "Reported %s %s (%s)" },
+    [LOG_EVENT_REPORT_STATS] = { LOG_MODULE_PUBLISH, ESP_LOG_DEBUG,
+                                 "Reports %s: %u transition, %u deadband, %u heartbeat, %u suppressed" },
+    [LOG_EVENT_SNAPSHOT_SCHEDULED] = { LOG_MODULE_PUBLISH, ESP_LOG_INFO, "Scheduled %d byte %s %s for %s" },
+    [LOG_EVENT_SNAPSHOT_FAILED] = { LOG_MODULE_PUBLISH, ESP_LOG_WARN, "Publish failed, keeping events 0x%x latched" },
+    [LOG_EVENT_MQTT_PUBLISHED] = { LOG_MODULE_MQTT, ESP_LOG_INFO, "Published %d bytes, qos %d, msg_id=%d" },
+    [LOG_EVENT_MQTT_QUEUED] = { LOG_MODULE_MQTT, ESP_LOG_INFO, "%s, queued %d byte publish (%u pending)" },
+    [LOG_EVENT_MQTT_DISPATCHED] = { LOG_MODULE_MQTT, ESP_LOG_DEBUG, "Dispatched %s, %d bytes, msg_id=%d" },
+    [LOG_EVENT_MQTT_ACKED] = { LOG_MODULE_MQTT, ESP_LOG_INFO, "MQTT_EVENT_PUBLISHED, msg_id=%d" },
+};
+
+static const char *const module_names[LOG_MODULE_COUNT] = {
+    [LOG_MODULE_SENSOR] = "sensor",
+    [LOG_MODULE_PUBLISH] = "publish",
+    [LOG_MODULE_MQTT] = "mqtt",
+};
+
+static const char *const module_tags[LOG_MODULE_COUNT] = {
+    [LOG_MODULE_SENSOR] = "SENSOR",
+    [LOG_MODULE_PUBLISH] = "PUBLISH",
+    [LOG_MODULE_MQTT] = "MQTT",
+};
+
+// Indexed by esp_log_level_t
+static const char level_letters[] = "NEWIDV";
+
+static atomic_int levels[LOG_MODULE_COUNT];
+
+#if DEFERRED_LOGGING
+typedef struct {
+    atomic_uint_fast32_t seq;   // Write index + 1 once the record is complete, 0 while a writer fills it
+    event_log_record_t record;
+} log_slot_t;
+
+static log_slot_t ring[EVENT_LOG_RECORDS];
+static atomic_uint_fast32_t ring_head;  // Total records ever claimed
+
+#if EVENT_LOG_CONSOLE
+static SemaphoreHandle_t console_lock;
+static TaskHandle_t console_task_handle;
+static event_log_cursor_t console_cursor;
+#endif
+#endif
+
+static bool enabled(const log_format_t *f)
+{
+    return (int)f->level <= atomic_load_explicit(&levels[f->module], memory_order_relaxed);
+}
+
+#if DEFERRED_LOGGING
+void event_log_write(log_event_t id, const log_arg_t *args, int argc)
+{
+    if (!enabled(&formats[id])) {
+        return;
+    }
+    uint32_t index = (uint32_t)atomic_fetch_add_explicit(&ring_head, 1, memory_order_relaxed);
+    log_slot_t *slot = &ring[index & (EVENT_LOG_RECORDS - 1)];
+
+    // Readers that see seq change while they copy the record discard it
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->record.timestamp_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    slot->record.id = (uint16_t)id;
+    slot->record.argc = (uint8_t)(argc < EVENT_LOG_MAX_ARGS ? argc : EVENT_LOG_MAX_ARGS);
+    memcpy(slot->record.args, args, slot->record.argc * sizeof(log_arg_t));
+    atomic_store_explicit(&slot->seq, index + 1, memory_order_release);
+}
+
+void event_log_cursor_oldest(event_log_cursor_t *cursor)
+{
+    uint32_t head = (uint32_t)atomic_load_explicit(&ring_head, memory_order_acquire);
+    cursor->next = head > EVENT_LOG_RECORDS ? head - EVENT_LOG_RECORDS : 0;
+    cursor->lost = 0;
+}
+
+bool event_log_next(event_log_cursor_t *cursor, event_log_record_t *record)
+{
+    while (1) {
+        uint32_t head = (uint32_t)atomic_load_explicit(&ring_head, memory_order_acquire);
+        if (cursor->next == head) {
+            return false;
+        }
+        if (head - cursor->next > EVENT_LOG_RECORDS) {
+            cursor->lost += head - cursor->next - EVENT_LOG_RECORDS;
+            cursor->next = head - EVENT_LOG_RECORDS;
+        }
+        log_slot_t *slot = &ring[cursor->next & (EVENT_LOG_RECORDS - 1)];
+        uint32_t seq = (uint32_t)atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == 0) {
+            // Claimed but not written yet; pick it up on the next pass
+            return false;
+        }
+        if (seq == cursor->next + 1) {
+            *record = slot->record;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+                cursor->next++;
+                return true;
+            }
+        }
+        // Overwritten by a newer record before or while it was copied
+        cursor->lost++;
+        cursor->next++;
+    }
+}
+#endif
+
+// Each conversion is formatted on its own with the argument type its letter calls for
+static int format_message(const log_format_t *f, const event_log_record_t *record, char *buf, size_t buf_len, int len)
+{
+    int arg = 0;
+    for (const char *p = f->format; *p != '\0' && len >= 0 && (size_t)len < buf_len; p++) {
+        if (*p != '%') {
+            buf[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            buf[len++] = '%';
+            p++;
+            continue;
+        }
+        char spec[12] = "%";
+        size_t n = 1;
+        while (p[1] != '\0' && strchr("-+ #0123456789l", p[1]) != NULL) {
+            p++;
+            // Arguments are always 32 bits wide, so length modifiers are dropped
+            if (*p != 'l' && n < sizeof(spec) - 3) {
+                spec[n++] = *p;
+            }
+        }
+        if (p[1] == '\0') {
+            break;
+        }
+        char conv = *++p;
+        spec[n++] = conv;
+        spec[n] = '\0';
+        if (arg >= record->argc) {
+            len += snprintf(buf + len, buf_len - len, "?");
+        } else if (conv == 's') {
+            len += snprintf(buf + len, buf_len - len, spec, record->args[arg].s);
+        } else if (conv == 'd' || conv == 'i' || conv == 'c') {
+            len += snprintf(buf + len, buf_len - len, spec, (int)record->args[arg].i);
+        } else {
+            len += snprintf(buf + len, buf_len - len, spec, (unsigned)record->args[arg].u);
+        }
+        arg++;
+    }
+    if (len < 0) {
+        len = 0;
+    }
+    if ((size_t)len >= buf_len) {
+        len = (int)buf_len - 1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+int event_log_format(const event_log_record_t *record, char *buf, size_t buf_len)
+{
+    const log_format_t *f = &formats[record->id < LOG_EVENT_COUNT ? record->id : 0];
+    int len = snprintf(buf, buf_len, "%lu %c %s: ", (unsigned long)record->timestamp_ms, level_letters[f->level],
+                       module_tags[f->module]);
+    return format_message(f, record, buf, buf_len, len);
+}
+
+#if !DEFERRED_LOGGING || EVENT_LOG_CONSOLE
+// ESP_LOG adds the print time; the time the call site ran goes in front of the message
+static void print_record(const event_log_record_t *record)
+{
+    char message[EVENT_LOG_MAX_LINE];
+    const log_format_t *f = &formats[record->id];
+    format_message(f, record, message, sizeof(message), 0);
+    ESP_LOG_LEVEL(f->level, module_tags[f->module], "@%lu %s", (unsigned long)record->timestamp_ms, message);
+}
+#endif
+
+#if !DEFERRED_LOGGING
+void event_log_write(log_event_t id, const log_arg_t *args, int argc)
+{
+    if (!enabled(&formats[id])) {
+        return;
+    }
+    event_log_record_t record = {
+        .timestamp_ms = (uint32_t)(esp_timer_get_time() / 1000),
+        .id = (uint16_t)id,
+        .argc = (uint8_t)(argc < EVENT_LOG_MAX_ARGS ? argc : EVENT_LOG_MAX_ARGS),
+    };
+    memcpy(record.args, args, record.argc * sizeof(log_arg_t));
+    print_record(&record);
+}
+
+void event_log_cursor_oldest(event_log_cursor_t *cursor)
+{
+    cursor->next = 0;
+    cursor->lost = 0;
+}
+
+bool event_log_next(event_log_cursor_t *cursor, event_log_record_t *record)
+{
+    (void)cursor;
+    (void)record;
+    return false;
+}
+#endif
+
+void event_log_flush(void)
+{
+#if DEFERRED_LOGGING && EVENT_LOG_CONSOLE
+    if (console_lock == NULL) {
+        return;
+    }
+    event_log_record_t record;
+    xSemaphoreTake(console_lock, portMAX_DELAY);
+    uint32_t lost = console_cursor.lost;
+    while (event_log_next(&console_cursor, &record)) {
+        if (console_cursor.lost != lost) {
+            ESP_LOGW(TAG, "%lu record(s) overwritten before they were printed",
+                     (unsigned long)(console_cursor.lost - lost));
+            lost = console_cursor.lost;
+        }
+        print_record(&record);
+    }
+    xSemaphoreGive(console_lock);
+#endif
+}
+
+#if DEFERRED_LOGGING && EVENT_LOG_CONSOLE
+// Lowest priority above idle: the UART is only driven when nothing else wants the CPU
+static void console_task(void *pvParameters)
+{
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(EVENT_LOG_DRAIN_MS));
+        event_log_flush();
+    }
+}
+#endif
+
+void event_log_init(void)
+{
+    for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+        atomic_store(&levels[i], EVENT_LOG_DEFAULT_LEVEL);
+    }
+#if DEFERRED_LOGGING && EVENT_LOG_CONSOLE
+    MEM_MUTEX_CREATE(&console_lock);
+    MEM_TASK_CREATE(console_task, "log_console", LOG_CONSOLE_TASK_STACK, 1, &console_task_handle);
+#endif
+}
+
+int32_t event_log_stack_free(void)
+{
+#if DEFERRED_LOGGING && EVENT_LOG_CONSOLE
+    return console_task_handle != NULL ? (int32_t)uxTaskGetStackHighWaterMark(console_task_handle) : -1;
+#else
+    return -1;
+#endif
+}
+
+void event_log_set_level(log_module_t module, esp_log_level_t level)
+{
+    atomic_store_explicit(&levels[module], (int)level, memory_order_relaxed);
+}
+
+esp_log_level_t event_log_get_level(log_module_t module)
+{
+    return (esp_log_level_t)atomic_load_explicit(&levels[module], memory_order_relaxed);
+}
+
+// One "name=level" token; module is -1 for "*"
+static bool parse_token(const char *token, size_t len, int *module, esp_log_level_t *level)
+{
+    const char *eq = memchr(token, '=', len);
+    if (eq == NULL || eq == token || eq + 1 == token + len) {
+        return false;
+    }
+    size_t name_len = (size_t)(eq - token);
+    const char *letter = strchr(level_letters, toupper((unsigned char)eq[1]));
+    if (letter == NULL || eq[1] == '\0') {
+        return false;
+    }
+    *level = (esp_log_level_t)(letter - level_letters);
+    if (name_len == 1 && token[0] == '*') {
+        *module = -1;
+        return true;
+    }
+    for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+        if (strlen(module_names[i]) == name_len && strncasecmp(module_names[i], token, name_len) == 0) {
+            *module = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t event_log_set_levels(const char *spec, size_t len)
+{
+    esp_log_level_t next[LOG_MODULE_COUNT];
+    for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+        next[i] = event_log_get_level((log_module_t)i);
+    }
+    // Check every token before touching a level, like a configuration update
+    size_t pos = 0;
+    while (pos < len) {
+        while (pos < len && (spec[pos] == ',' || isspace((unsigned char)spec[pos]))) {
+            pos++;
+        }
+        size_t start = pos;
+        while (pos < len && spec[pos] != ',' && !isspace((unsigned char)spec[pos])) {
+            pos++;
+        }
+        if (pos == start) {
+            break;
+        }
+        int module;
+        esp_log_level_t level;
+        if (!parse_token(spec + start, pos - start, &module, &level)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+            if (module < 0 || module == i) {
+                next[i] = level;
+            }
+        }
+    }
+    for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+        event_log_set_level((log_module_t)i, next[i]);
+    }
+    return ESP_OK;
+}
+
+int event_log_levels(char *buf, size_t buf_len)
+{
+    int len = 0;
+    for (int i = 0; i < LOG_MODULE_COUNT && len >= 0 && (size_t)len < buf_len; i++) {
+        len += snprintf(buf + len, buf_len - len, "%s%s=%c", i ? "," : "", module_names[i],
+                        level_letters[event_log_get_level((log_module_t)i)]);
+    }
+    if (len < 0 || (size_t)len >= buf_len) {
+        return -1;
+    }
+    return len;
+}
@@ -0,0 +1,103 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+// Deferred logging for the steady-state loops. A call site stores a format ID and its raw arguments in a
+// lock-free RAM ring (no formatting, no UART); a low-priority task decodes the ring to the console later,
+// and the whole ring can be uploaded over MQTT on request. Messages that are not on a hot path keep ESP_LOGx.
+#ifndef DEFERRED_LOGGING
+#define DEFERRED_LOGGING 1          // 0: format and print at the call site, like ESP_LOGx
+#endif
+#ifndef EVENT_LOG_CONSOLE
+#define EVENT_LOG_CONSOLE 1         // 0: keep records in RAM for an upload only (quietest for battery devices)
+#endif
+
+#define EVENT_LOG_RECORDS 128       // Ring size, a power of two; the oldest records are overwritten
+#define EVENT_LOG_MAX_ARGS 5
+#define EVENT_LOG_DRAIN_MS 2000     // Console drain period
+#define EVENT_LOG_DEFAULT_LEVEL ESP_LOG_INFO
+#define EVENT_LOG_MAX_LINE 128
+#define EVENT_LOG_SUBTOPIC "/log"   // Upload to MQTT_TOPIC "/log/<device id>", requested on ".../get"
+#define EVENT_LOG_UPLOAD_CHUNK 1024 // Lines per message up to this size; fits the MQTT out buffer with its topic
+
+// Runtime level per module; the console tag is the module name in capitals
+typedef enum {
+    LOG_MODULE_SENSOR,
+    LOG_MODULE_PUBLISH,
+    LOG_MODULE_MQTT,
+    LOG_MODULE_COUNT
+} log_module_t;
+
+// One entry per deferred message; the format table lives in event_log.c
+typedef enum {
+    LOG_EVENT_TANK_TRANSITION,
+    LOG_EVENT_TANK_VOLTAGE,
+    LOG_EVENT_SENSOR_OVERRUN,
+    LOG_EVENT_SAMPLE_PERIOD,
+    LOG_EVENT_REPORTED,
+    LOG_EVENT_REPORT_STATS,
+    LOG_EVENT_SNAPSHOT_SCHEDULED,
+    LOG_EVENT_SNAPSHOT_FAILED,
+    LOG_EVENT_MQTT_PUBLISHED,
+    LOG_EVENT_MQTT_QUEUED,
+    LOG_EVENT_MQTT_DISPATCHED,
+    LOG_EVENT_MQTT_ACKED,
+    LOG_EVENT_COUNT
+} log_event_t;
+
+// Formats use %d, %u, %x and %s only (flags and width allowed). A %s argument is kept as a pointer, so it
+// must outlive the ring: string literals, probe registry names and static topic buffers only.
+typedef union {
+    int32_t i;
+    uint32_t u;
+    const char *s;
+} log_arg_t;
+
+#define LOG_INT(v) ((log_arg_t){ .i = (int32_t)(v) })
+#define LOG_UINT(v) ((log_arg_t){ .u = (uint32_t)(v) })
+#define LOG_STR(v) ((log_arg_t){ .s = (v) })
+
+#define EVENT_LOG(id, ...)                                                                          \
+    event_log_write((id), (const log_arg_t[]){ __VA_ARGS__ },                                      \
+                    (int)(sizeof((const log_arg_t[]){ __VA_ARGS__ }) / sizeof(log_arg_t)))
+
+typedef struct {
+    uint32_t timestamp_ms;      // Since boot, when the call site ran
+    uint16_t id;
+    uint8_t argc;
+    log_arg_t args[EVENT_LOG_MAX_ARGS];
+} event_log_record_t;
+
+// Reader position; each reader (console drain, upload) keeps its own
+typedef struct {
+    uint32_t next;
+    uint32_t lost;              // Overwritten before this reader got to them
+} event_log_cursor_t;
+
+// Starts the console drain task when EVENT_LOG_CONSOLE is set. Call once, before the tasks that log.
+void event_log_init(void);
+// Store one record if its module's level lets it through. Safe from any task; never blocks.
+void event_log_write(log_event_t id, const log_arg_t *args, int argc);
+void event_log_set_level(log_module_t module, esp_log_level_t level);
+esp_log_level_t event_log_get_level(log_module_t module);
+// Apply "module=level[,module=level...]" with names like "sensor" or "*" and levels e, w, i, d, v or n(one)
+esp_err_t event_log_set_levels(const char *spec, size_t len);
+// Cursor at the oldest record still in the ring
+void event_log_cursor_oldest(event_log_cursor_t *cursor);
+// Next record, or false once the reader has caught up with the writers
+bool event_log_next(event_log_cursor_t *cursor, event_log_record_t *record);
+// "<ms> <level> <MODULE>: <message>" without a newline. Returns the length, truncated to fit.
+int event_log_format(const event_log_record_t *record, char *buf, size_t buf_len);
+// Print everything not yet drained, e.g. right before deep sleep
+void event_log_flush(void);
+// "module=level,..." for every module
+int event_log_levels(char *buf, size_t buf_len);
+// Stack high-water mark of the console task in bytes, or -1 when there is no console task
+int32_t event_log_stack_free(void);
+
+#endif // EVENT_LOG_H
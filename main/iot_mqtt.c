@@ -7,11 +7,13 @@
 #include "nvs_flash.h"
 #include "esp_event.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
+#include "freertos/event_groups.h"
 
 #include "lwip/sockets.h"
 #include "lwip/dns.h"
@@ -20,11 +22,144 @@
 #include "esp_log.h"
 #include "mqtt_client.h"
 #include "iot_mqtt.h"
+#include "mqtt_outbox.h"
+#include "mqtt_transport.h"
+#include "publish_queue.h"
+#include "device_config.h"
+#include "event_log.h"
+#include "metrics.h"
+#include "mem_profile.h"
+#include "boot_timeline.h"
+#include <stdatomic.h>
 
-static const char *TAG = "MQTT_WSS";
+static const char *TAG = "MQTT";
+
+_Static_assert(OUTBOX_DRAIN_MAX_CLIENT_BYTES <= MQTT_OUTBOX_LIMIT_BYTES - MQTT_ALARM_RESERVE_BYTES,
+               "Outbox replay must stay out of the share reserved for alarms");
 
 esp_mqtt_client_handle_t mqtt_client;
 
+static volatile bool mqtt_connected = false;
+static EventGroupHandle_t mqtt_event_group;
+#define MQTT_CONNECTED_BIT BIT0
+static bool outbox_ready = false;
+static TaskHandle_t dispatch_task_handle = NULL;
+
+// Snapshots waiting for the dispatch task, alarms ahead of coalesced telemetry. Alarms that cannot wait in RAM
+// (offline, evicted, or failed to publish) go to the flash outbox retained; every alarm still queued here is older
+// than those, so dispatching the queue first keeps alarms in order.
+static publish_queue_t publish_queue;
+static SemaphoreHandle_t publish_queue_lock;
+static uint32_t alarms_dropped;         // Alarms neither queued nor stored: no outbox, or the write failed
+
+static void dispatch_task(void *pvParameters);
+
+// Remote configuration: updates for this device or the whole fleet, active configuration reported back
+static char config_topic[64];
+static char config_set_topic[64];
+#define CONFIG_FLEET_SET_TOPIC MQTT_TOPIC DEVICE_CONFIG_SUBTOPIC "/all/set"
+
+// Event log upload: requested on log_get_topic (the payload may set module levels first), sent by the dispatch task
+static char log_topic[64];
+static char log_get_topic[64];
+static atomic_bool log_upload_requested;
+
+#if RUNTIME_METRICS
+// Publishes awaiting PUBACK/PUBCOMP, so acks can be timed. Publishing tasks claim slots round-robin
+// and store the msg_id last; the MQTT task releases a matching slot by compare-and-swap.
+// An ack that beats the tracking store, or arrives after its slot was reused, counts as unmatched.
+#define ACK_TRACK_SLOTS 16
+typedef struct {
+    atomic_int msg_id;          // 0 = free
+    int64_t sent_us;
+    int qos;
+} ack_track_t;
+static ack_track_t ack_track[ACK_TRACK_SLOTS];
+static atomic_uint ack_track_next;
+static int64_t mqtt_lost_us = 0;
+static TaskHandle_t client_task_handle = NULL;  // esp-mqtt's own task, the one running mqtt_event_handler
+
+static void ack_track_sent(int msg_id, int qos)
+{
+    if (msg_id <= 0 || qos == 0) {
+        return;
+    }
+    ack_track_t *t = &ack_track[atomic_fetch_add(&ack_track_next, 1) % ACK_TRACK_SLOTS];
+    atomic_store(&t->msg_id, 0);
+    t->sent_us = esp_timer_get_time();
+    t->qos = qos;
+    atomic_store(&t->msg_id, msg_id);
+}
+
+static void ack_track_acked(int msg_id)
+{
+    for (int i = 0; i < ACK_TRACK_SLOTS; i++) {
+        ack_track_t *t = &ack_track[i];
+        int64_t sent_us = t->sent_us;
+        int qos = t->qos;
+        int expected = msg_id;
+        if (msg_id > 0 && atomic_compare_exchange_strong(&t->msg_id, &expected, 0)) {
+            uint32_t latency_ms = (uint32_t)((esp_timer_get_time() - sent_us) / 1000);
+            metrics_observe(qos == 2 ? METRIC_PUBACK_QOS2_MS : METRIC_PUBACK_QOS1_MS, latency_ms);
+            metrics_inc(METRIC_MQTT_ACKED);
+            return;
+        }
+    }
+    metrics_inc(METRIC_MQTT_ACK_UNMATCHED);
+}
+#endif
+
+static bool config_reported = false;
+
+static bool is_topic(esp_mqtt_event_handle_t event, const char *topic)
+{
+    return event->topic_len == (int)strlen(topic) && strncmp(event->topic, topic, event->topic_len) == 0;
+}
+
+// Runs in the MQTT task, so the report is enqueued rather than written synchronously
+static void report_config(esp_mqtt_client_handle_t client, const char *result)
+{
+    char message[DEVICE_CONFIG_MAX_ENCODED];
+    int len = device_config_encode(result, message, sizeof(message));
+    if (len > 0) {
+        esp_mqtt_client_enqueue(client, config_topic, message, len, 1, 1, true);
+    }
+}
+
+static void handle_config_update(esp_mqtt_client_handle_t client, esp_mqtt_event_handle_t event)
+{
+    char err[64] = "ok";
+    bool changed = false;
+    // Updates never need more than one buffer; anything fragmented is too large anyway
+    if (event->data_len != event->total_data_len) {
+        if (event->current_data_offset == 0) {
+            report_config(client, "update too large");
+        }
+        return;
+    }
+    device_config_layer_t layer = is_topic(event, config_set_topic) ? DEVICE_CONFIG_DEVICE : DEVICE_CONFIG_FLEET;
+    if (device_config_apply_json(layer, event->data, event->data_len, &changed, err, sizeof(err)) != ESP_OK) {
+        ESP_LOGW(TAG, "Configuration update rejected: %s", err);
+        report_config(client, err);
+        return;
+    }
+    ESP_LOGI(TAG, "%s configuration update %s", layer == DEVICE_CONFIG_DEVICE ? "Device" : "Fleet",
+             changed ? "applied" : "leaves the active configuration unchanged");
+    report_config(client, changed ? "applied" : "unchanged");
+}
+
+static void handle_log_request(esp_mqtt_event_handle_t event)
+{
+    if (event->data_len != event->total_data_len) {
+        return;
+    }
+    if (event->data_len > 0 && event_log_set_levels(event->data, event->data_len) != ESP_OK) {
+        ESP_LOGW(TAG, "Bad log level request: %.*s", event->data_len, event->data);
+    }
+    atomic_store(&log_upload_requested, true);
+    xTaskNotifyGive(dispatch_task_handle);
+}
+
 // MQTT event handler
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
@@ -33,11 +168,45 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     int msg_id;
     
     switch (event->event_id) {
-    case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+    case MQTT_EVENT_CONNECTED: {
+        mqtt_transport_stats_t transport = mqtt_transport_get_stats();
+        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED (TLS handshake %lu ms, %s)", (unsigned long)transport.handshake_ms,
+                 transport.session_offered ? "session offered" : "full");
+        boot_timeline_mark(BOOT_PHASE_CONNACK);
+#if RUNTIME_METRICS
+        client_task_handle = xTaskGetCurrentTaskHandle();
+        if (mqtt_lost_us != 0) {
+            metrics_inc(METRIC_MQTT_RECONNECTS);
+            metrics_observe(METRIC_MQTT_RECONNECT_MS, (uint32_t)((esp_timer_get_time() - mqtt_lost_us) / 1000));
+            mqtt_lost_us = 0;
+        }
+#endif
+        mqtt_connected = true;
+        xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_BIT);
+        // Clean sessions forget subscriptions; a retained update is delivered straight away
+        // Fleet first so the last report after a reconnect is the merged result of both
+        esp_mqtt_client_subscribe(client, CONFIG_FLEET_SET_TOPIC, 1);
+        esp_mqtt_client_subscribe(client, config_set_topic, 1);
+        esp_mqtt_client_subscribe(client, log_get_topic, 1);
+        if (!config_reported) {
+            config_reported = true;
+            report_config(client, "boot");
+        }
+        // Send whatever waited while we were offline, alarms first
+        if (dispatch_task_handle != NULL) {
+            xTaskNotifyGive(dispatch_task_handle);
+        }
         break;
+    }
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+#if RUNTIME_METRICS
+        if (mqtt_connected) {
+            mqtt_lost_us = esp_timer_get_time();
+        }
+#endif
+        mqtt_connected = false;
+        xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED_BIT);
         break;
     case MQTT_EVENT_SUBSCRIBED:
         ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -46,12 +215,22 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        EVENT_LOG(LOG_EVENT_MQTT_ACKED, LOG_INT(event->msg_id));
+        boot_timeline_mark(BOOT_PHASE_FIRST_PUBACK);
+#if RUNTIME_METRICS
+        ack_track_acked(event->msg_id);
+#endif
         break;
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
+        ESP_LOGI(TAG, "MQTT_EVENT_DATA, topic=%.*s, %d bytes", event->topic_len, event->topic, event->data_len);
+        if (is_topic(event, config_set_topic) || is_topic(event, CONFIG_FLEET_SET_TOPIC)) {
+            handle_config_update(client, event);
+        } else if (is_topic(event, log_get_topic)) {
+            handle_log_request(event);
+        }
+        break;
+    case MQTT_EVENT_BEFORE_CONNECT:
+        boot_timeline_mark(BOOT_PHASE_MQTT_DIAL);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -64,24 +243,297 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
 void mqtt_init()
 {
+    const mqtt_transport_profile_t *profile = mqtt_transport_profile();
     esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = MQTT_BROKER_URL,
+        .broker.address.hostname = MQTT_BROKER_HOST,
+        .broker.address.port = profile->port,
         .credentials.username = MQTT_BROKER_USRNAME,
         .credentials.authentication.password = MQTT_BROKER_PASSWORD,
         .credentials.client_id = MQTT_CLIENT_ID,
+        .session.keepalive = profile->keepalive_s,
+        .buffer.size = profile->buffer_size,
+        .buffer.out_size = profile->out_buffer_size,
+        .network.transport = mqtt_transport_create(),
+        .outbox.limit = MQTT_OUTBOX_LIMIT_BYTES,
     };
+    ESP_LOGI(TAG, "Broker %s:%u over %s, keepalive %d s", MQTT_BROKER_HOST, (unsigned)profile->port, profile->name,
+             profile->keepalive_s);
     
+    snprintf(config_topic, sizeof(config_topic), "%s%s/%s", MQTT_TOPIC, DEVICE_CONFIG_SUBTOPIC, device_config_device_id());
+    snprintf(config_set_topic, sizeof(config_set_topic), "%s/set", config_topic);
+    snprintf(log_topic, sizeof(log_topic), "%s%s/%s", MQTT_TOPIC, EVENT_LOG_SUBTOPIC, device_config_device_id());
+    snprintf(log_get_topic, sizeof(log_get_topic), "%s/get", log_topic);
+
+    MEM_EVENT_GROUP_CREATE(&mqtt_event_group);
+    publish_queue_init(&publish_queue);
+    MEM_MUTEX_CREATE(&publish_queue_lock);
+    outbox_ready = (mqtt_outbox_init() == ESP_OK);
+    MEM_TASK_CREATE(dispatch_task, "mqtt_dispatch", DISPATCH_TASK_STACK, 3, &dispatch_task_handle);
+
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+}
+
+void mqtt_start(void)
+{
+    boot_timeline_mark(BOOT_PHASE_MQTT_START);
     esp_mqtt_client_start(mqtt_client);
 }
 
-void mqtt_publish_leak_data(const char* data)
+bool mqtt_wait_connected(TickType_t timeout)
+{
+    EventBits_t bits = xEventGroupWaitBits(mqtt_event_group, MQTT_CONNECTED_BIT, pdFALSE, pdTRUE, timeout);
+    return (bits & MQTT_CONNECTED_BIT) != 0;
+}
+
+static int publish_queue_pending(void)
+{
+    xSemaphoreTake(publish_queue_lock, portMAX_DELAY);
+    int pending = publish_queue_alarms(&publish_queue) + publish_queue_telemetry(&publish_queue);
+    xSemaphoreGive(publish_queue_lock);
+    return pending;
+}
+
+// Wait until every queued message, scheduler and flash outbox included, has been acknowledged by the broker
+bool mqtt_wait_sent(TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (esp_mqtt_client_get_outbox_size(mqtt_client) > 0 || publish_queue_pending() > 0 ||
+           (outbox_ready && mqtt_outbox_pending() > 0)) {
+        if (!mqtt_connected || xTaskGetTickCount() - start >= timeout) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    return true;
+}
+
+// Publish an arbitrary (possibly binary) payload. len == 0 means data is a NUL-terminated string.
+int mqtt_publish(const char *topic, const char *data, int len, int qos, int retain)
 {
-    if (mqtt_client != NULL) {
-        int msg_id = esp_mqtt_client_publish(mqtt_client, MQTT_TOPIC, data, 0, 1, 0);
-        ESP_LOGI(TAG, "Published leak data: %s, msg_id=%d", data, msg_id);
-    } else {
+    if (mqtt_client == NULL) {
         ESP_LOGE(TAG, "MQTT client not initialized");
+        return -1;
+    }
+    // Offline, or the client's RAM outbox is into the share reserved for alarms: persist to flash instead
+    bool backlogged = qos > 0 && esp_mqtt_client_get_outbox_size(mqtt_client) > MQTT_OUTBOX_LIMIT_BYTES - MQTT_ALARM_RESERVE_BYTES;
+    if ((!mqtt_connected || backlogged) && outbox_ready) {
+        esp_err_t err = mqtt_outbox_append(topic, data, len, qos, retain);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to queue publish to %s: %s", topic, esp_err_to_name(err));
+            return -1;
+        }
+        EVENT_LOG(LOG_EVENT_MQTT_QUEUED, LOG_STR(mqtt_connected ? "Backlogged" : "Offline"),
+                  LOG_INT(len > 0 ? len : (int)strlen(data)), LOG_UINT(mqtt_outbox_pending()));
+        return 0;
     }
-}
\ No newline at end of file
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, data, len, qos, retain);
+#if RUNTIME_METRICS
+    metrics_inc(msg_id < 0 ? METRIC_MQTT_PUBLISH_FAILED : METRIC_MQTT_PUBLISHED);
+    ack_track_sent(msg_id, qos);
+#endif
+    // Topics are often the caller's stack buffers, which the deferred record cannot point at
+    EVENT_LOG(LOG_EVENT_MQTT_PUBLISHED, LOG_INT(len > 0 ? len : (int)strlen(data)), LOG_INT(qos), LOG_INT(msg_id));
+    return msg_id;
+}
+
+// Persist an alarm taken off the queue. Caller holds publish_queue_lock.
+static bool store_alarm(const publish_msg_t *msg)
+{
+    if (outbox_ready && mqtt_outbox_append(msg->topic, (const char *)msg->data, msg->len, 1, 1) == ESP_OK) {
+        return true;
+    }
+    alarms_dropped++;
+#if RUNTIME_METRICS
+    metrics_inc(METRIC_ALARMS_DROPPED);
+#endif
+    ESP_LOGW(TAG, "Dropped alarm for %s (%lu so far)", msg->topic, (unsigned long)alarms_dropped);
+    return false;
+}
+
+// Move every queued alarm to flash, oldest first, behind any already there. Caller holds publish_queue_lock.
+static void spill_alarms(void)
+{
+    static publish_msg_t msg;
+    while (publish_queue_pop(&publish_queue, false, &msg)) {
+        store_alarm(&msg);
+    }
+}
+
+int mqtt_submit(publish_class_t cls, const char *topic, const char *data, int len)
+{
+    publish_msg_t evicted;
+    bool has_evicted = false;
+    xSemaphoreTake(publish_queue_lock, portMAX_DELAY);
+    bool queued = publish_queue_push(&publish_queue, cls, topic, data, len > 0 ? (size_t)len : 0,
+                                     (uint32_t)(esp_timer_get_time() / 1000), &evicted, &has_evicted);
+    if (has_evicted) {
+        // Long backlog: the oldest alarm goes to flash rather than being lost, and the rest follow it below
+        store_alarm(&evicted);
+    }
+    // Offline alarms go to flash so a reset cannot lose them; once one alarm is there the newer ones line up
+    // behind it instead of overtaking it from RAM
+    if (queued && cls == PUBLISH_ALARM && outbox_ready && (!mqtt_connected || mqtt_outbox_retained() > 0)) {
+        spill_alarms();
+    }
+    xSemaphoreGive(publish_queue_lock);
+    if (!queued) {
+        ESP_LOGE(TAG, "Publish to %s does not fit the scheduler", topic);
+        return -1;
+    }
+    xTaskNotifyGive(dispatch_task_handle);
+    return 0;
+}
+
+// Hand scheduled snapshots to the client: every alarm, then telemetry while the link keeps up.
+// Returns true if telemetry is still waiting for the backlog to clear.
+static bool dispatch_scheduled(void)
+{
+    static publish_msg_t msg;
+
+    while (mqtt_connected) {
+        bool allow_telemetry = esp_mqtt_client_get_outbox_size(mqtt_client) <= MQTT_TELEMETRY_MAX_BACKLOG_BYTES;
+        xSemaphoreTake(publish_queue_lock, portMAX_DELAY);
+        bool have = publish_queue_pop(&publish_queue, allow_telemetry, &msg);
+        bool waiting = publish_queue_telemetry(&publish_queue) > 0;
+        xSemaphoreGive(publish_queue_lock);
+        if (!have) {
+            return waiting;
+        }
+
+        bool alarm = msg.cls == PUBLISH_ALARM;
+        int msg_id = esp_mqtt_client_publish(mqtt_client, msg.topic, (const char *)msg.data, msg.len, alarm ? 1 : 0,
+                                             alarm ? 1 : 0);
+#if RUNTIME_METRICS
+        metrics_inc(msg_id < 0 ? METRIC_MQTT_PUBLISH_FAILED : METRIC_MQTT_PUBLISHED);
+        ack_track_sent(msg_id, alarm ? 1 : 0);
+        if (alarm && msg_id >= 0) {
+            metrics_observe(METRIC_ALARM_QUEUED_MS, (uint32_t)(esp_timer_get_time() / 1000) - msg.queued_ms);
+        }
+#endif
+        if (msg_id < 0) {
+            // Telemetry is superseded soon enough; an alarm must survive the failure, and the alarms queued
+            // after it must not overtake it
+            if (alarm) {
+                xSemaphoreTake(publish_queue_lock, portMAX_DELAY);
+                if (store_alarm(&msg)) {
+                    spill_alarms();
+                }
+                xSemaphoreGive(publish_queue_lock);
+            }
+            return false;
+        }
+        EVENT_LOG(LOG_EVENT_MQTT_DISPATCHED, LOG_STR(alarm ? "alarm" : "telemetry"), LOG_INT(msg.len), LOG_INT(msg_id));
+    }
+    return false;
+}
+
+// Decode the whole ring into QoS 0 messages of whole lines, oldest first, ending with a summary line.
+// At most one ring's worth is read, so records written meanwhile cannot keep the upload going.
+static void upload_event_log(void)
+{
+    static char chunk[EVENT_LOG_UPLOAD_CHUNK];
+    event_log_cursor_t cursor;
+    event_log_record_t record;
+    int len = 0;
+    int sent = 0;
+
+    event_log_cursor_oldest(&cursor);
+    for (int i = 0; i < EVENT_LOG_RECORDS && mqtt_connected && event_log_next(&cursor, &record); i++) {
+        char line[EVENT_LOG_MAX_LINE];
+        int line_len = event_log_format(&record, line, sizeof(line));
+        if (len + line_len + 1 > (int)sizeof(chunk)) {
+            esp_mqtt_client_publish(mqtt_client, log_topic, chunk, len, 0, 0);
+            len = 0;
+        }
+        memcpy(chunk + len, line, line_len);
+        len += line_len;
+        chunk[len++] = '\n';
+        sent++;
+    }
+    char levels[64];
+    event_log_levels(levels, sizeof(levels));
+    if (len + EVENT_LOG_MAX_LINE > (int)sizeof(chunk)) {
+        esp_mqtt_client_publish(mqtt_client, log_topic, chunk, len, 0, 0);
+        len = 0;
+    }
+    len += snprintf(chunk + len, sizeof(chunk) - len, "-- %d record(s), %lu lost, levels %s\n", sent,
+                    (unsigned long)cursor.lost, levels);
+    esp_mqtt_client_publish(mqtt_client, log_topic, chunk, len, 0, 0);
+    ESP_LOGI(TAG, "Uploaded %d log record(s) to %s", sent, log_topic);
+}
+
+// Single sender for scheduled snapshots and the flash outbox. Alarms are dispatched between
+// every outbox round, so a long replay after a reconnect never delays them by more than one round.
+static void dispatch_task(void *pvParameters)
+{
+    static char topic[OUTBOX_MAX_TOPIC + 1];
+    static uint8_t data[OUTBOX_MAX_PAYLOAD];
+    bool telemetry_waiting = false;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, telemetry_waiting ? pdMS_TO_TICKS(MQTT_DISPATCH_RETRY_MS) : portMAX_DELAY);
+        telemetry_waiting = dispatch_scheduled();
+        if (mqtt_connected && atomic_exchange(&log_upload_requested, false)) {
+            upload_event_log();
+        }
+        if (!outbox_ready || !mqtt_connected || mqtt_outbox_pending() == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "Draining %lu queued publish(es)", (unsigned long)mqtt_outbox_pending());
+
+        while (mqtt_connected && mqtt_outbox_pending() > 0) {
+            telemetry_waiting = dispatch_scheduled();
+            // Let the client flush its RAM outbox before handing it more
+            if (esp_mqtt_client_get_outbox_size(mqtt_client) > OUTBOX_DRAIN_MAX_CLIENT_BYTES) {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(OUTBOX_DRAIN_INTERVAL_MS));
+                continue;
+            }
+            for (int i = 0; i < OUTBOX_DRAIN_BATCH && mqtt_connected; i++) {
+                size_t len = sizeof(data);
+                int qos = 0;
+                int retain = 0;
+                uint32_t seq = 0;
+                if (mqtt_outbox_peek(topic, sizeof(topic), data, &len, &qos, &retain, &seq) != ESP_OK) {
+                    break;
+                }
+                int msg_id = esp_mqtt_client_publish(mqtt_client, topic, (const char *)data, len, qos, retain);
+#if RUNTIME_METRICS
+                metrics_inc(msg_id < 0 ? METRIC_MQTT_PUBLISH_FAILED : METRIC_MQTT_PUBLISHED);
+                ack_track_sent(msg_id, qos);
+#endif
+                if (msg_id < 0) {
+                    break;
+                }
+                mqtt_outbox_pop(seq);
+            }
+            // A new alarm cuts the pause short
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(OUTBOX_DRAIN_INTERVAL_MS));
+        }
+
+        mqtt_outbox_stats_t stats = mqtt_outbox_get_stats();
+        xSemaphoreTake(publish_queue_lock, portMAX_DELAY);
+        publish_queue_stats_t sched = publish_queue.stats;
+        uint32_t dropped = alarms_dropped;
+        xSemaphoreGive(publish_queue_lock);
+        ESP_LOGI(TAG, "Outbox: %lu pending, %lu drained, %lu dropped", (unsigned long)mqtt_outbox_pending(),
+                 (unsigned long)stats.drained, (unsigned long)stats.dropped);
+        ESP_LOGI(TAG, "Scheduler: %lu alarms, %lu telemetry (%lu coalesced, %lu superseded), %lu evicted, "
+                 "%lu alarm(s) dropped", (unsigned long)sched.alarms, (unsigned long)sched.telemetry,
+                 (unsigned long)sched.coalesced, (unsigned long)sched.superseded, (unsigned long)sched.evicted,
+                 (unsigned long)dropped);
+    }
+}
+
+#if RUNTIME_METRICS
+void mqtt_sample_metrics(void)
+{
+    if (dispatch_task_handle != NULL) {
+        metrics_set(METRIC_STACK_OUTBOX, (int32_t)uxTaskGetStackHighWaterMark(dispatch_task_handle));
+    }
+    if (client_task_handle != NULL) {
+        metrics_set(METRIC_STACK_MQTT, (int32_t)uxTaskGetStackHighWaterMark(client_task_handle));
+    }
+    metrics_set(METRIC_OUTBOX_PENDING, outbox_ready ? (int32_t)mqtt_outbox_pending() : 0);
+}
+#endif
@@ -1,15 +1,41 @@
 #ifndef IOT_MQTT_H 
 #define IOT_MQTT_H
 
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "publish_queue.h"
+
 // MQTT configuration
-#define MQTT_BROKER_URL "wss://6489701bc20a41caa3c7f6e6a6b9f9c9.s1.eu.hivemq.cloud:8884/mqtt"
+// Port, WebSocket path, keepalive and buffer sizes come from MQTT_TRANSPORT_PROFILE (mqtt_transport.h)
+#define MQTT_BROKER_HOST "6489701bc20a41caa3c7f6e6a6b9f9c9.s1.eu.hivemq.cloud"
 #define MQTT_BROKER_USRNAME "leak_detector"
 #define MQTT_BROKER_PASSWORD "leak_Detect0r"
 #define MQTT_CLIENT_ID "esp32_leak_detector"
 #define MQTT_TOPIC "/leak"
 
+// Publish scheduling
+#define MQTT_OUTBOX_LIMIT_BYTES 8192            // Cap on the client's RAM outbox (QoS 1 publishes awaiting their ack)
+#define MQTT_ALARM_RESERVE_BYTES 2048           // Share of that cap only alarms may use; other QoS 1 traffic spills to flash
+#define MQTT_TELEMETRY_MAX_BACKLOG_BYTES 1024   // Hold QoS 0 telemetry while more than this awaits acknowledgement
+#define MQTT_DISPATCH_RETRY_MS 500              // Recheck the backlog this often while telemetry is held
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+// Create the client, scheduler and flash outbox; publishes are accepted from here on and wait as if offline
 void mqtt_init();
-void mqtt_publish_leak_data(const char* data);
+// Start connecting to the broker. Call once the network is up: a dial that fails for lack of an IP address
+// costs a full esp-mqtt reconnect delay.
+void mqtt_start(void);
+// Block until the client has a broker session. Returns false on timeout.
+bool mqtt_wait_connected(TickType_t timeout);
+// Block until nothing is left unacknowledged (e.g. before deep sleep). Returns false on timeout or disconnect.
+bool mqtt_wait_sent(TickType_t timeout);
+// Schedule a snapshot: alarms go out QoS 1 retained ahead of everything else, telemetry QoS 0 with only
+// the newest message per topic kept while it waits. Alarms submitted offline are stored in the flash outbox and
+// replayed retained, in order. len == 0 means data is a NUL-terminated string.
+int mqtt_submit(publish_class_t cls, const char *topic, const char *data, int len);
+// Publish straight to the client (or the flash outbox when offline or backlogged)
+int mqtt_publish(const char *topic, const char *data, int len, int qos, int retain);
+// Refresh the MQTT-side gauges (outbox task stack, queued publishes) before a metrics snapshot
+void mqtt_sample_metrics(void);
 
 #endif
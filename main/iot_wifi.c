@@ -8,18 +8,34 @@
 #include <esp_log.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <esp_attr.h>
 #include <nvs_flash.h>
+#include <nvs.h>
 
 #include <wifi_provisioning/manager.h>
 #include <wifi_provisioning/scheme_softap.h>
 
+#include "iot_wifi.h"
+#include "mem_profile.h"
+#include "power_mgmt.h"
+#include "metrics.h"
+#include "boot_timeline.h"
+
 #define CONFIG_EXAMPLE_PROV_MGR_CONNECTION_CNT 5
 
+#define FAST_CACHE_MAGIC 0x57464331     // "WFC1"
+#define FAST_CACHE_NVS_NAMESPACE "wifi_fast"
+#define FAST_CACHE_NVS_KEY "cache"
+
 static const char *TAG = "IOT_WIFI";
 
 /* Global variable to store the received SSID */
 static char received_ssid[33] = {0}; /* WiFi SSID can be up to 32 characters + null terminator */
 static bool ssid_received = false;
+static bool provisioning = false;       // wifi_init() found no credentials and started the provisioning service
 
 // Event group to signal when we are connected
 static EventGroupHandle_t s_wifi_event_group;
@@ -27,6 +43,200 @@ static EventGroupHandle_t s_wifi_event_group;
 // Event bit definitions
 const int WIFI_CONNECTED_EVENT = BIT0;
 
+// Last good association and lease. The RTC copy survives deep sleep; NVS survives power loss.
+typedef struct {
+    uint32_t magic;
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+} wifi_fast_cache_t;
+
+static RTC_DATA_ATTR wifi_fast_cache_t rtc_fast_cache;
+
+static esp_netif_t *sta_netif;
+static wifi_config_t sta_config;
+static bool fast_attempt = false;       // Current attempt uses the cached channel/BSSID
+static bool ip_reused = false;          // Cached lease applied statically for the current attempt
+static esp_timer_handle_t reconnect_timer;
+static uint32_t backoff_ms = 0;
+
+// Phase timestamps for the connection in progress
+static wifi_connect_timing_t timing;
+static int64_t connection_start_us;
+static int64_t attempt_start_us;
+static int64_t assoc_us;
+static bool reconnecting = false;       // Current connection replaces one that was lost
+
+static bool fast_cache_valid(const wifi_fast_cache_t *cache)
+{
+    return cache->magic == FAST_CACHE_MAGIC && cache->channel != 0 &&
+           strncmp(cache->ssid, (const char *)sta_config.sta.ssid, sizeof(cache->ssid)) == 0;
+}
+
+static bool fast_cache_read_nvs(wifi_fast_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(FAST_CACHE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    size_t len = sizeof(*cache);
+    esp_err_t err = nvs_get_blob(nvs, FAST_CACHE_NVS_KEY, cache, &len);
+    nvs_close(nvs);
+    return err == ESP_OK && len == sizeof(*cache);
+}
+
+static bool fast_cache_load(wifi_fast_cache_t *cache)
+{
+    if (fast_cache_valid(&rtc_fast_cache)) {
+        *cache = rtc_fast_cache;
+        return true;
+    }
+    if (!fast_cache_read_nvs(cache) || !fast_cache_valid(cache)) {
+        return false;
+    }
+    rtc_fast_cache = *cache;
+    return true;
+}
+
+static void fast_cache_store(const wifi_fast_cache_t *cache)
+{
+    bool changed = memcmp(&rtc_fast_cache, cache, sizeof(*cache)) != 0;
+    rtc_fast_cache = *cache;
+    if (!changed) {
+        return;
+    }
+    // Only touch flash when the AP or lease actually differs from the stored copy, not merely from a dropped RTC one
+    wifi_fast_cache_t stored;
+    if (fast_cache_read_nvs(&stored) && memcmp(&stored, cache, sizeof(*cache)) == 0) {
+        return;
+    }
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(FAST_CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, FAST_CACHE_NVS_KEY, cache, sizeof(*cache));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save fast-connect cache: %s", esp_err_to_name(err));
+    }
+}
+
+// Point the station config at the cached AP so the driver probes one channel instead of scanning all of them
+static void apply_fast_config(const wifi_fast_cache_t *cache)
+{
+    sta_config.sta.channel = cache->channel;
+    memcpy(sta_config.sta.bssid, cache->bssid, sizeof(sta_config.sta.bssid));
+    sta_config.sta.bssid_set = true;
+    sta_config.sta.scan_method = WIFI_FAST_SCAN;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+    fast_attempt = true;
+
+#if WIFI_FAST_REUSE_IP
+    esp_err_t err = esp_netif_dhcpc_stop(sta_netif);
+    if (err == ESP_OK || err == ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+        esp_netif_dns_info_t dns = { .ip.u_addr.ip4 = cache->dns, .ip.type = ESP_IPADDR_TYPE_V4 };
+        ESP_ERROR_CHECK(esp_netif_set_ip_info(sta_netif, &cache->ip_info));
+        esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+        ip_reused = true;
+    }
+#endif
+}
+
+static void apply_full_scan_config(void)
+{
+    sta_config.sta.channel = 0;
+    memset(sta_config.sta.bssid, 0, sizeof(sta_config.sta.bssid));
+    sta_config.sta.bssid_set = false;
+    sta_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    sta_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+    fast_attempt = false;
+
+    if (ip_reused) {
+        esp_netif_dhcpc_start(sta_netif);
+        ip_reused = false;
+    }
+}
+
+static void start_connect(void)
+{
+    timing.attempts++;
+    attempt_start_us = esp_timer_get_time();
+    if (timing.attempts == 1) {
+        timing.driver_start_us = attempt_start_us - connection_start_us;
+    }
+    esp_wifi_connect();
+}
+
+static void reconnect_timer_cb(void *arg)
+{
+    start_connect();
+}
+
+// Exponential backoff with up to 25% jitter so a fleet that lost the same AP does not retry in lockstep
+static void schedule_reconnect(void)
+{
+    backoff_ms = backoff_ms == 0 ? WIFI_RECONNECT_BACKOFF_MIN_MS : backoff_ms * 2;
+    if (backoff_ms > WIFI_RECONNECT_BACKOFF_MAX_MS) {
+        backoff_ms = WIFI_RECONNECT_BACKOFF_MAX_MS;
+    }
+    uint32_t delay_ms = backoff_ms + esp_random() % (backoff_ms / 4 + 1);
+    ESP_LOGI(TAG, "Retrying in %lu ms", (unsigned long)delay_ms);
+    esp_timer_stop(reconnect_timer);
+    ESP_ERROR_CHECK(esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000));
+}
+
+static void on_got_ip(const ip_event_got_ip_t *event)
+{
+    int64_t now = esp_timer_get_time();
+    boot_timeline_mark(BOOT_PHASE_GOT_IP);
+    timing.fast_path = fast_attempt;
+    timing.ip_reused = ip_reused;
+    timing.assoc_us = assoc_us - attempt_start_us;
+    timing.ip_us = now - assoc_us;
+    timing.total_us = now - connection_start_us;
+    backoff_ms = 0;
+#if RUNTIME_METRICS
+    if (reconnecting) {
+        metrics_inc(METRIC_WIFI_RECONNECTS);
+        metrics_observe(METRIC_WIFI_RECONNECT_MS, (uint32_t)(timing.total_us / 1000));
+    }
+#endif
+    reconnecting = false;
+
+    ESP_LOGI(TAG, "Connect timing (%s%s, %lu attempt%s): start %ld ms, assoc %ld ms, ip %ld ms, total %ld ms",
+             timing.fast_path ? "fast" : "scan", timing.ip_reused ? ", cached lease" : "",
+             (unsigned long)timing.attempts, timing.attempts == 1 ? "" : "s",
+             (long)(timing.driver_start_us / 1000), (long)(timing.assoc_us / 1000),
+             (long)(timing.ip_us / 1000), (long)(timing.total_us / 1000));
+
+    if (sta_config.sta.ssid[0] == '\0') {
+        // Connected by the provisioning manager, which owns the station config
+        esp_wifi_get_config(WIFI_IF_STA, &sta_config);
+    }
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        wifi_fast_cache_t cache = { .magic = FAST_CACHE_MAGIC, .channel = ap.primary, .ip_info = event->ip_info };
+        strncpy(cache.ssid, (const char *)sta_config.sta.ssid, sizeof(cache.ssid) - 1);
+        memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+        esp_netif_dns_info_t dns;
+        if (esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+            cache.dns = dns.ip.u_addr.ip4;
+        }
+        fast_cache_store(&cache);
+    }
+}
+
+void wifi_get_connect_timing(wifi_connect_timing_t *out)
+{
+    *out = timing;
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_PROV_EVENT) {
@@ -73,12 +283,41 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
     else if (event_base == WIFI_EVENT) {
         switch (event_id) {
             case WIFI_EVENT_STA_START:
-                esp_wifi_connect();
+                start_connect();
+                break;
+            case WIFI_EVENT_STA_CONNECTED:
+                assoc_us = esp_timer_get_time();
+                boot_timeline_mark(BOOT_PHASE_ASSOCIATED);
                 break;
-            case WIFI_EVENT_STA_DISCONNECTED:
-                ESP_LOGI(TAG, "Disconnected. Connecting to the AP again...");
-                esp_wifi_connect();
+            case WIFI_EVENT_STA_DISCONNECTED: {
+                wifi_event_sta_disconnected_t *disconnected = (wifi_event_sta_disconnected_t *)event_data;
+                xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_EVENT);
+                if (timing.total_us != 0) {
+                    // Lost an established connection: time the reconnect from here and try the same AP first
+                    ESP_LOGI(TAG, "Disconnected (reason %d). Connecting to the AP again...", disconnected->reason);
+                    memset(&timing, 0, sizeof(timing));
+                    connection_start_us = esp_timer_get_time();
+                    reconnecting = true;
+                    if (WIFI_FAST_CONNECT && fast_cache_valid(&rtc_fast_cache)) {
+                        apply_fast_config(&rtc_fast_cache);
+                        start_connect();
+                    } else {
+                        schedule_reconnect();
+                    }
+                } else if (fast_attempt) {
+                    // Cached AP is gone, moved channel or just missed a probe; fall back to a full scan straight
+                    // away. Only the RTC copy is dropped: the full scan rewrites flash if it lands on another AP,
+                    // and a transient miss leaves the stored copy for the next boot.
+                    ESP_LOGW(TAG, "Fast connect failed (reason %d), falling back to full scan", disconnected->reason);
+                    rtc_fast_cache.magic = 0;
+                    apply_full_scan_config();
+                    start_connect();
+                } else {
+                    ESP_LOGI(TAG, "Connect failed (reason %d)", disconnected->reason);
+                    schedule_reconnect();
+                }
                 break;
+            }
             case WIFI_EVENT_AP_STACONNECTED:
                 ESP_LOGI(TAG, "SoftAP transport: Connected!");
                 break;
@@ -92,6 +331,7 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Connected with IP Address:" IPSTR, IP2STR(&event->ip_info.ip));
+        on_got_ip(event);
         /* Signal main application to continue execution */
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_EVENT);
     }
@@ -116,9 +356,46 @@ static void wifi_init_sta(void)
 {
     /* Start Wi-Fi in station mode */
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    // Credentials are already in flash; keep per-boot channel/BSSID tweaks in RAM to spare the flash
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &sta_config));
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+#if POWER_MANAGEMENT
+    sta_config.sta.listen_interval = POWER_LISTEN_INTERVAL;
+#endif
+
+    wifi_fast_cache_t cache;
+    if (WIFI_FAST_CONNECT && fast_cache_load(&cache)) {
+        ESP_LOGI(TAG, "Fast connect to " MACSTR " on channel %d", MAC2STR(cache.bssid), cache.channel);
+        apply_fast_config(&cache);
+    } else {
+        apply_full_scan_config();
+    }
     ESP_ERROR_CHECK(esp_wifi_start());
+    boot_timeline_mark(BOOT_PHASE_WIFI_STARTED);
+}
+
+// SoftAP interface and event handlers that only the provisioning flow uses
+static void provisioning_support_init(void)
+{
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(PROTOCOMM_SECURITY_SESSION_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+    esp_netif_create_default_wifi_ap();
 }
 
+#if WIFI_LEAN_BOOT
+// esp_wifi_init() loads the station config from NVS, so a stored SSID is exactly what
+// wifi_prov_mgr_is_provisioned() checks, without bringing the manager up to ask
+static bool wifi_has_stored_credentials(void)
+{
+    wifi_config_t stored;
+    if (esp_wifi_get_config(WIFI_IF_STA, &stored) != ESP_OK) {
+        return false;
+    }
+    return stored.sta.ssid[0] != '\0';
+}
+#endif
+
 static void get_device_service_name(char *service_name, size_t max)
 {
     uint8_t eth_mac[6];
@@ -131,6 +408,8 @@ static void get_device_service_name(char *service_name, size_t max)
 
 void wifi_init()
 {
+    connection_start_us = esp_timer_get_time();
+
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         /* NVS partition was truncated
@@ -140,22 +419,51 @@ void wifi_init()
         /* Retry nvs_flash_init */
         ESP_ERROR_CHECK(nvs_flash_init());
     }
+    boot_timeline_mark(BOOT_PHASE_NVS_INIT);
 
     ESP_ERROR_CHECK(esp_netif_init());
 
     /* Initialize the event loop */
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    s_wifi_event_group = xEventGroupCreate();
+    MEM_EVENT_GROUP_CREATE(&s_wifi_event_group);
 
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(PROTOCOMM_SECURITY_SESSION_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
     
-    esp_netif_create_default_wifi_sta();
-    esp_netif_create_default_wifi_ap();
+    sta_netif = esp_netif_create_default_wifi_sta();
+    boot_timeline_mark(BOOT_PHASE_NETIF_READY);
+#if !WIFI_LEAN_BOOT
+    provisioning_support_init();
+#endif
+
+    const esp_timer_create_args_t reconnect_timer_args = {
+        .callback = reconnect_timer_cb,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &reconnect_timer));
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+#if STATIC_MEMORY_PROFILE
+    cfg.static_rx_buf_num = WIFI_STATIC_RX_BUFFERS;
+    cfg.dynamic_rx_buf_num = WIFI_DYNAMIC_RX_BUFFERS;
+    cfg.dynamic_tx_buf_num = WIFI_DYNAMIC_TX_BUFFERS;
+    cfg.rx_ba_win = WIFI_RX_BA_WINDOW;
+#endif
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+#if POWER_MANAGEMENT
+    // Radio off between beacon wakes; automatic light sleep needs a modem-sleep mode while associated
+    ESP_ERROR_CHECK(esp_wifi_set_ps(POWER_WIFI_PS));
+#endif
+
+#if WIFI_LEAN_BOOT
+    if (wifi_has_stored_credentials()) {
+        boot_timeline_mark(BOOT_PHASE_PROV_CHECKED);
+        ESP_LOGI(TAG, "Already provisioned, starting Wi-Fi STA");
+        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
+        wifi_init_sta();
+        return;
+    }
+    provisioning_support_init();
+#endif
 
     /* Configuration for the provisioning manager */
     wifi_prov_mgr_config_t config = {
@@ -173,9 +481,11 @@ void wifi_init()
         bool provisioned = false;
 
         ESP_ERROR_CHECK(wifi_prov_mgr_is_provisioned(&provisioned));
+        boot_timeline_mark(BOOT_PHASE_PROV_CHECKED);
 
         if (!provisioned) {
             ESP_LOGI(TAG, "Starting provisioning");
+            provisioning = true;
     
             /* What is the Device Service Name that we want
              * This translates to :
@@ -234,7 +544,16 @@ void wifi_init()
             /* Start Wi-Fi station */
             wifi_init_sta();
         }
-        
-            /* Wait for Wi-Fi connection */
-            xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_EVENT, true, true, portMAX_DELAY);
+}
+
+bool wifi_provisioning(void)
+{
+    return provisioning;
+}
+
+bool wifi_wait_connected(TickType_t timeout)
+{
+    /* Wait for Wi-Fi connection */
+    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_EVENT, false, true, timeout);
+    return (bits & WIFI_CONNECTED_EVENT) != 0;
 }
\ No newline at end of file
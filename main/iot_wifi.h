@@ -1,12 +1,41 @@
 #ifndef IOT_WIFI_H
 #define IOT_WIFI_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <esp_event.h>
+#include <freertos/FreeRTOS.h>
+
+#define WIFI_LEAN_BOOT 1                    // Skip the provisioning manager and SoftAP netif when credentials are stored
+
+//-------------Fast reconnect---------------//
+#define WIFI_FAST_CONNECT 1                 // Associate directly with the cached channel/BSSID before scanning
+#define WIFI_FAST_REUSE_IP 0                // Also apply the cached IP lease statically, skipping DHCP entirely.
+                                            // Only safe when the AP reserves the address for this device.
+#define WIFI_RECONNECT_BACKOFF_MIN_MS 500   // First retry delay after a failed full-scan connect
+#define WIFI_RECONNECT_BACKOFF_MAX_MS 60000 // Retry delay cap
+
+// Duration of each phase of the most recent connection, in microseconds
+typedef struct {
+    bool fast_path;             // Associated using the cached channel/BSSID
+    bool ip_reused;             // Used the cached lease instead of DHCP
+    uint32_t attempts;          // esp_wifi_connect() calls for this connection
+    int64_t driver_start_us;    // wifi_init() entry (or disconnect) -> first connect attempt
+    int64_t assoc_us;           // Connect attempt that succeeded -> associated
+    int64_t ip_us;              // Associated -> got IP
+    int64_t total_us;           // wifi_init() entry (or disconnect) -> got IP
+} wifi_connect_timing_t;
 
 // Function declarations
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 static void wifi_init_sta(void);
 static void get_device_service_name(char *service_name, size_t max);
+// Start Wi-Fi (or provisioning) without waiting for a connection
 void wifi_init();
+// True when wifi_init() found no stored credentials and is waiting to be provisioned
+bool wifi_provisioning(void);
+// Block until the station has an IP address. Returns false on timeout.
+bool wifi_wait_connected(TickType_t timeout);
+void wifi_get_connect_timing(wifi_connect_timing_t *timing);
 
 #endif // IOT_WIFI_H
@@ -0,0 +1,208 @@
+#include "leak_classifier.h"
+
+#define DEFAULT_LEAK_THRESHOLD_MV 1740
+#define DEFAULT_FLUSH_THRESHOLD_MV 1000
+#define DEFAULT_HYSTERESIS_MV 30
+#define DEFAULT_EMA_TIME_MS 200         // Filter time constant
+#define DEFAULT_DEBOUNCE_MS 500
+#define DEFAULT_LEAK_CONFIRM_MS 3000    // A flush drop crosses the leak band in ~1-2 s; a leak sits there
+#define DEFAULT_REFILL_TIMEOUT_MS 60000 // Normal refill completes well within a minute
+// At slow sample rates a time constant can round down to a single reading; never trust just one
+#define MIN_DEBOUNCE_SAMPLES 2
+#define MIN_LEAK_CONFIRM_SAMPLES 3
+
+static uint32_t ms_to_samples(uint32_t ms, uint32_t sample_period_us)
+{
+    uint64_t samples = ((uint64_t)ms * 1000 + sample_period_us - 1) / sample_period_us;
+    if (samples < 1) {
+        samples = 1;
+    }
+    return samples > UINT32_MAX ? UINT32_MAX : (uint32_t)samples;
+}
+
+void leak_classifier_default_config(leak_classifier_config_t *cfg, uint32_t sample_period_us)
+{
+    if (sample_period_us == 0) {
+        sample_period_us = 1;
+    }
+
+    // Largest power of two not exceeding the time constant in samples
+    uint32_t tau = ms_to_samples(DEFAULT_EMA_TIME_MS, sample_period_us);
+    uint8_t shift = 0;
+    while (shift < 15 && (2u << shift) <= tau) {
+        shift++;
+    }
+
+    cfg->leak_threshold_mv = DEFAULT_LEAK_THRESHOLD_MV;
+    cfg->flush_threshold_mv = DEFAULT_FLUSH_THRESHOLD_MV;
+    cfg->hysteresis_mv = DEFAULT_HYSTERESIS_MV;
+    cfg->ema_shift = shift;
+    cfg->debounce_samples = ms_to_samples(DEFAULT_DEBOUNCE_MS, sample_period_us);
+    if (cfg->debounce_samples < MIN_DEBOUNCE_SAMPLES) {
+        cfg->debounce_samples = MIN_DEBOUNCE_SAMPLES;
+    }
+    cfg->leak_confirm_samples = ms_to_samples(DEFAULT_LEAK_CONFIRM_MS, sample_period_us);
+    if (cfg->leak_confirm_samples < MIN_LEAK_CONFIRM_SAMPLES) {
+        cfg->leak_confirm_samples = MIN_LEAK_CONFIRM_SAMPLES;
+    }
+    cfg->refill_timeout_samples = ms_to_samples(DEFAULT_REFILL_TIMEOUT_MS, sample_period_us);
+}
+
+void leak_classifier_init(leak_classifier_t *c, const leak_classifier_config_t *cfg)
+{
+    c->cfg = *cfg;
+    c->median_idx = 0;
+    c->primed = false;
+    c->ema_q8 = 0;
+    c->state = TANK_STATE_FULL;
+    c->candidate = TANK_STATE_FULL;
+    c->candidate_count = 0;
+    c->candidate_mv = 0;
+    c->samples_in_state = 0;
+    c->transitions = 0;
+}
+
+static uint32_t rescale_count(uint32_t count, uint32_t old_period_us, uint32_t new_period_us)
+{
+    uint64_t scaled = (uint64_t)count * old_period_us / new_period_us;
+    return scaled > UINT32_MAX ? UINT32_MAX : (uint32_t)scaled;
+}
+
+void leak_classifier_retime(leak_classifier_t *c, const leak_classifier_config_t *cfg,
+                            uint32_t old_period_us, uint32_t new_period_us)
+{
+    if (old_period_us != new_period_us && new_period_us != 0) {
+        // Elapsed time in the state is real; a pending candidate was only seen at discrete readings,
+        // so its count may shrink to the slower rate but is never inflated by a faster one
+        c->samples_in_state = rescale_count(c->samples_in_state, old_period_us, new_period_us);
+        if (new_period_us > old_period_us) {
+            c->candidate_count = rescale_count(c->candidate_count, old_period_us, new_period_us);
+        }
+    }
+    c->cfg = *cfg;
+}
+
+static int median3(int a, int b, int c)
+{
+    if (a > b) {
+        int t = a; a = b; b = t;
+    }
+    if (b > c) {
+        b = c;
+    }
+    return a > b ? a : b;
+}
+
+// State the filtered level points to, with hysteresis relative to the current state
+static tank_state_t target_state(const leak_classifier_t *c, int mv)
+{
+    const leak_classifier_config_t *cfg = &c->cfg;
+    bool below_flush = mv < cfg->flush_threshold_mv - cfg->hysteresis_mv;
+    bool above_flush = mv > cfg->flush_threshold_mv + cfg->hysteresis_mv;
+    bool below_full = mv < cfg->leak_threshold_mv - cfg->hysteresis_mv;
+    bool above_full = mv > cfg->leak_threshold_mv + cfg->hysteresis_mv;
+
+    switch (c->state) {
+    case TANK_STATE_FULL:
+        if (below_flush) return TANK_STATE_FLUSHING;
+        if (below_full) return TANK_STATE_LEAKING;
+        return TANK_STATE_FULL;
+    case TANK_STATE_FLUSHING:
+        if (above_full) return TANK_STATE_FULL;
+        if (above_flush) return TANK_STATE_REFILLING;
+        return TANK_STATE_FLUSHING;
+    case TANK_STATE_REFILLING:
+        if (below_flush) return TANK_STATE_FLUSHING;
+        if (above_full) return TANK_STATE_FULL;
+        if (c->samples_in_state >= cfg->refill_timeout_samples) return TANK_STATE_LEAKING;
+        return TANK_STATE_REFILLING;
+    case TANK_STATE_LEAKING:
+    default:
+        if (below_flush) return TANK_STATE_FLUSHING;
+        if (above_full) return TANK_STATE_FULL;
+        return TANK_STATE_LEAKING;
+    }
+}
+
+static void classifier_step(leak_classifier_t *c, int sample_mv)
+{
+    //-------------Median-of-3 spike rejection---------------//
+    if (!c->primed) {
+        c->median_buf[0] = c->median_buf[1] = c->median_buf[2] = sample_mv;
+        c->ema_q8 = (int32_t)sample_mv << 8;
+        c->primed = true;
+    }
+    c->median_buf[c->median_idx] = sample_mv;
+    c->median_idx = (c->median_idx + 1) % 3;
+    int median = median3(c->median_buf[0], c->median_buf[1], c->median_buf[2]);
+
+    //-------------Fixed-point EMA---------------//
+    c->ema_q8 += (((int32_t)median << 8) - c->ema_q8) >> c->cfg.ema_shift;
+
+    //-------------Debounced state machine---------------//
+    if (c->samples_in_state < UINT32_MAX) {
+        c->samples_in_state++;
+    }
+    int level = c->ema_q8 >> 8;
+    tank_state_t next = target_state(c, level);
+    if (next == c->state) {
+        c->candidate_count = 0;
+        return;
+    }
+    if (next != c->candidate || c->candidate_count == 0) {
+        c->candidate = next;
+        c->candidate_count = 0;
+        c->candidate_mv = level;
+    }
+    uint32_t required = c->cfg.debounce_samples;
+    if (next == TANK_STATE_LEAKING && c->state == TANK_STATE_FULL) {
+        required = c->cfg.leak_confirm_samples;
+    }
+    if (++c->candidate_count >= required) {
+        // A leak drifts down; a level climbing through the leak band is a refill whose flush was missed
+        if (next == TANK_STATE_LEAKING && c->state == TANK_STATE_FULL &&
+            level > c->candidate_mv + c->cfg.hysteresis_mv) {
+            next = TANK_STATE_REFILLING;
+        }
+        c->state = next;
+        c->candidate_count = 0;
+        c->samples_in_state = 0;
+        c->transitions++;
+    }
+}
+
+tank_state_t leak_classifier_feed(leak_classifier_t *c, const int *samples_mv, int count)
+{
+    for (int i = 0; i < count; i++) {
+        classifier_step(c, samples_mv[i]);
+    }
+    return c->state;
+}
+
+int leak_classifier_voltage(const leak_classifier_t *c)
+{
+    return (int)(c->ema_q8 >> 8);
+}
+
+const char *leak_classifier_state_name(tank_state_t state)
+{
+    switch (state) {
+    case TANK_STATE_FULL: return "full";
+    case TANK_STATE_FLUSHING: return "flushing";
+    case TANK_STATE_REFILLING: return "refilling";
+    case TANK_STATE_LEAKING: return "leaking";
+    default: return "unknown";
+    }
+}
+
+bool leak_detection(int voltage, int leak_threshold, int flush_threshold){
+    return (leak_threshold > voltage && voltage > flush_threshold);
+}
+
+bool full_tank_detection(int voltage, int leak_threshold){
+    return (voltage > leak_threshold);
+}
+
+bool flush_detection(int voltage, int flush_threshold){
+    return (flush_threshold > voltage);
+}
@@ -0,0 +1,59 @@
+#ifndef LEAK_CLASSIFIER_H
+#define LEAK_CLASSIFIER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Incremental tank-state classifier. Pure integer code with no driver or RTOS
+// dependencies: callers own the state struct and feed it blocks of mV samples.
+
+typedef enum {
+    TANK_STATE_FULL = 0,
+    TANK_STATE_FLUSHING,
+    TANK_STATE_REFILLING,
+    TANK_STATE_LEAKING,
+} tank_state_t;
+
+typedef struct {
+    int leak_threshold_mv;          // Below this (minus hysteresis) the tank is no longer full
+    int flush_threshold_mv;         // Below this (minus hysteresis) the tank is being flushed
+    int hysteresis_mv;              // Half-width of the band around each threshold
+    uint8_t ema_shift;              // EMA weight = 1 / 2^ema_shift
+    uint32_t debounce_samples;      // Samples a new state must persist before it is accepted
+    uint32_t leak_confirm_samples;  // Longer persistence required for FULL -> LEAKING, so a flush drop passing
+                                    // through the leak band is not mistaken for a leak
+    uint32_t refill_timeout_samples;// Refill that never reaches full within this many samples is a leak
+} leak_classifier_config_t;
+
+typedef struct {
+    leak_classifier_config_t cfg;
+    int median_buf[3];
+    uint8_t median_idx;
+    bool primed;
+    int32_t ema_q8;                 // Filtered voltage in mV, Q24.8
+    tank_state_t state;
+    tank_state_t candidate;
+    uint32_t candidate_count;
+    int candidate_mv;               // Filtered level when the current candidate first appeared
+    uint32_t samples_in_state;
+    uint32_t transitions;
+} leak_classifier_t;
+
+// Fill cfg with the default thresholds, converting time constants to sample counts for the given sample period
+void leak_classifier_default_config(leak_classifier_config_t *cfg, uint32_t sample_period_us);
+void leak_classifier_init(leak_classifier_t *c, const leak_classifier_config_t *cfg);
+// Switch to a new sample period without losing state. cfg must already be derived for the new period;
+// time spent in the current state is converted so refill timeouts keep running in real time.
+void leak_classifier_retime(leak_classifier_t *c, const leak_classifier_config_t *cfg,
+                            uint32_t old_period_us, uint32_t new_period_us);
+// Run every sample of the block through the filters and state machine. Returns the state after the block.
+tank_state_t leak_classifier_feed(leak_classifier_t *c, const int *samples_mv, int count);
+int leak_classifier_voltage(const leak_classifier_t *c);
+const char *leak_classifier_state_name(tank_state_t state);
+
+// Instantaneous single-reading threshold checks (no filtering or debounce)
+bool leak_detection(int voltage, int leak_threshold, int flush_threshold);
+bool full_tank_detection(int voltage, int leak_threshhold);
+bool flush_detection(int voltage, int flush_threshold);
+
+#endif // LEAK_CLASSIFIER_H
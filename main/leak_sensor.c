@@ -1,31 +1,177 @@
 #include "leak_sensor.h"
+#include "adc_lut.h"
 #include "esp_log.h"
 #include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_continuous.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
+#include "soc/soc_caps.h"
+#include "esp_timer.h"
+#include "power_mgmt.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <stdbool.h>
-
-#include "mqtt_client.h"
+#include <stdlib.h>
+#include <string.h>
 
 static const char *TAG = "LEAK_SENSOR";
 
 // ADC configuration
 #define ADC_UNIT ADC_UNIT_1
-#define ADC_CHANNEL ADC_CHANNEL_7  // GPIO35
-#define ADC_ATTEN ADC_ATTEN_DB_12 // DB_11 = 0-3.3V Range
-#define ADC_BITWIDTH ADC_BITWIDTH_9 // 12-bit resolution (range is 9-bit resolution - 12-bit resolution)
+#if LEAK_SENSOR_CONTINUOUS_MODE
+#define ADC_BITWIDTH SOC_ADC_DIGI_MAX_BITWIDTH // Digital controller always samples at 12-bit on ESP32
+#else
+#define ADC_BITWIDTH ADC_BITWIDTH_12 // Full SAR resolution; the calibration LUT is indexed by 12-bit codes
+#endif
+_Static_assert(ADC_BITWIDTH == ADC_LUT_RAW_BITS, "Calibration LUT expects 12-bit raw codes");
+#define OVERSAMPLE_COUNT (1 << (2 * LEAK_SENSOR_OVERSAMPLE_BITS))
+
+// Sensor registry. ADC2 is unavailable while Wi-Fi is running, so every probe must be an ADC1 channel (GPIO32-39).
+static const leak_sensor_probe_t probes[] = {
+    {
+        .name = "",                         // Original single-tank topic
+        .adc_channel = ADC_CHANNEL_7,       // GPIO35
+        .atten = ADC_ATTEN_DB_12,           // DB_11 = 0-3.3V Range
+        .leak_threshold_mv = 1740,
+        .flush_threshold_mv = 1000,
+    },
+    // {
+    //     .name = "stall2",
+    //     .adc_channel = ADC_CHANNEL_6,    // GPIO34
+    //     .atten = ADC_ATTEN_DB_12,
+    //     .leak_threshold_mv = 1740,
+    //     .flush_threshold_mv = 1000,
+    // },
+};
+#define PROBE_COUNT ((int)(sizeof(probes) / sizeof(probes[0])))
+_Static_assert(PROBE_COUNT >= 1 && PROBE_COUNT <= LEAK_SENSOR_MAX_PROBES, "Sensor registry size out of range");
+
+// One frame carries LEAK_SENSOR_FRAME_SAMPLES per probe
+#define ADC_FRAME_BYTES (LEAK_SENSOR_FRAME_SAMPLES * PROBE_COUNT * SOC_ADC_DIGI_RESULT_BYTES)
 
 // ADC handle
+#if LEAK_SENSOR_CONTINUOUS_MODE
+static adc_continuous_handle_t adc1_cont_handle = NULL;
+static bool adc_running = false;
+static uint8_t adc_frame_buf[ADC_FRAME_BYTES];
+static int8_t channel_probe[SOC_ADC_MAX_CHANNEL_NUM];   // ADC channel -> probe index, -1 if unused
+static leak_sensor_scan_t frame_scans[PROBE_COUNT];
+static sample_source_t adc_source;     // Defined below; its sample period is set from the configured scan rate
+#else
 static adc_oneshot_unit_handle_t adc1_handle;
-static adc_cali_handle_t adc1_cali_handle = NULL;
+#endif
 
-// Calibration parameters
-static bool do_calibration1 = false;
+// Calibration runs once at init into one LUT per attenuation in use; probes sharing an attenuation share it
+static adc_lut_t *atten_lut[ADC_ATTEN_DB_12 + 1];
+static const adc_lut_t *probe_lut[PROBE_COUNT];
+static adc_decimator_t probe_decimator[PROBE_COUNT];
 
-void liquid_level_sensor_init(void)
+static int lut_calibrate(void *ctx, int raw)
+{
+    int voltage = 0;
+    if (ctx != NULL) {
+        adc_cali_raw_to_voltage((adc_cali_handle_t)ctx, raw, &voltage);
+    }
+    return voltage;
+}
+
+static void calibration_init(void)
+{
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        int atten = probes[i].atten;
+        if (atten_lut[atten] == NULL) {
+            adc_lut_t *lut = malloc(sizeof(*lut));
+            if (lut == NULL) {
+                ESP_ERROR_CHECK(ESP_ERR_NO_MEM);
+            }
+            //-------------ADC1 Calibration Init---------------//
+            adc_cali_handle_t handle = NULL;
+            if (ADC_CALI_SCHEME_VER_LINE_FITTING) {
+                adc_cali_line_fitting_config_t cali_config = {
+                    .unit_id = ADC_UNIT,
+                    .atten = atten,
+                    .bitwidth = ADC_BITWIDTH,
+                };
+                if (adc_cali_create_scheme_line_fitting(&cali_config, &handle) != ESP_OK) {
+                    ESP_LOGW(TAG, "No line fitting calibration for attenuation %d", atten);
+                    handle = NULL;
+                }
+            }
+            adc_lut_build(lut, lut_calibrate, handle);
+            if (handle != NULL) {
+                adc_cali_delete_scheme_line_fitting(handle);
+            }
+            atten_lut[atten] = lut;
+            ESP_LOGI(TAG, "Calibration LUT for attenuation %d: %d..%d mV", atten,
+                     lut->mv_q4[0] >> ADC_LUT_FRAC_BITS, lut->mv_q4[ADC_LUT_CODES - 1] >> ADC_LUT_FRAC_BITS);
+        }
+        probe_lut[i] = atten_lut[atten];
+    }
+}
+
+// mV of one decimated code, with the probe's trim
+static inline int probe_voltage(int probe, uint32_t code)
+{
+    return adc_lut_mv(probe_lut[probe], code, LEAK_SENSOR_OVERSAMPLE_BITS) + probes[probe].offset_mv;
+}
+
+#if LEAK_SENSOR_CONTINUOUS_MODE
+static void adc_continuous_init(void)
+{
+    //-------------ADC1 Continuous Init---------------//
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = ADC_FRAME_BYTES * LEAK_SENSOR_RING_FRAMES,
+        .conv_frame_size = ADC_FRAME_BYTES,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adc1_cont_handle));
+
+    // The controller converts one pattern entry per sample clock, so every probe gets 1/N of the rate
+    uint32_t sample_freq_hz = LEAK_SENSOR_SAMPLE_FREQ_HZ * PROBE_COUNT;
+    if (sample_freq_hz < SOC_ADC_SAMPLE_FREQ_THRES_LOW) {
+        ESP_LOGW(TAG, "Sample rate %luHz below hardware minimum, using %dHz",
+                 (unsigned long)sample_freq_hz, SOC_ADC_SAMPLE_FREQ_THRES_LOW);
+        sample_freq_hz = SOC_ADC_SAMPLE_FREQ_THRES_LOW;
+    } else if (sample_freq_hz > SOC_ADC_SAMPLE_FREQ_THRES_HIGH) {
+        ESP_LOGW(TAG, "Scan rate %luHz above hardware maximum, using %dHz",
+                 (unsigned long)sample_freq_hz, SOC_ADC_SAMPLE_FREQ_THRES_HIGH);
+        sample_freq_hz = SOC_ADC_SAMPLE_FREQ_THRES_HIGH;
+    }
+
+    //-------------ADC1 Scan Pattern---------------//
+    adc_digi_pattern_config_t pattern[PROBE_COUNT];
+    for (int i = 0; i < SOC_ADC_MAX_CHANNEL_NUM; i++) {
+        channel_probe[i] = -1;
+    }
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        pattern[i] = (adc_digi_pattern_config_t){
+            .atten = probes[i].atten,
+            .channel = probes[i].adc_channel,
+            .unit = ADC_UNIT,
+            .bit_width = ADC_BITWIDTH,
+        };
+        channel_probe[probes[i].adc_channel] = i;
+    }
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = PROBE_COUNT,
+        .adc_pattern = pattern,
+        .sample_freq_hz = sample_freq_hz,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc1_cont_handle, &dig_cfg));
+    ESP_ERROR_CHECK(adc_continuous_start(adc1_cont_handle));
+    adc_running = true;
+
+    // Each probe gets 1/N of the (possibly clamped) scan rate, then 4^n conversions per decimated sample
+    adc_source.sample_period_us =
+        (uint32_t)(((uint64_t)1000000 * PROBE_COUNT * OVERSAMPLE_COUNT + sample_freq_hz / 2) / sample_freq_hz);
+
+    ESP_LOGI(TAG, "ADC continuous mode: %d probe(s), %luHz scan, %d samples/frame per probe, %dx oversampling",
+             PROBE_COUNT, (unsigned long)sample_freq_hz, LEAK_SENSOR_FRAME_SAMPLES, OVERSAMPLE_COUNT);
+}
+#else
+static void adc_oneshot_init(void)
 {
     //-------------ADC1 Init---------------//
     adc_oneshot_unit_init_cfg_t init_config1 = {
@@ -34,57 +180,199 @@ void liquid_level_sensor_init(void)
     ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
 
     //-------------ADC1 Config---------------//
-    adc_oneshot_chan_cfg_t config = {
-        .bitwidth = ADC_BITWIDTH,
-        .atten = ADC_ATTEN,
-    };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, ADC_CHANNEL, &config));
-
-    //-------------ADC1 Calibration Init---------------//
-    if (ADC_CALI_SCHEME_VER_LINE_FITTING) {
-        ESP_LOGI(TAG, "Using Line Fitting Calibration");
-        adc_cali_handle_t handle = NULL;
-        adc_cali_line_fitting_config_t cali_config = {
-            .unit_id = ADC_UNIT,
-            .atten = ADC_ATTEN,
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        adc_oneshot_chan_cfg_t config = {
             .bitwidth = ADC_BITWIDTH,
+            .atten = probes[i].atten,
         };
-        if (adc_cali_create_scheme_line_fitting(&cali_config, &handle) == ESP_OK) {
-            adc1_cali_handle = handle;
-            do_calibration1 = true;
-        }
+        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, probes[i].adc_channel, &config));
+    }
+}
+
+// 4^n back-to-back conversions of one probe, decimated to one reading
+static int oneshot_read_probe(int probe)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < OVERSAMPLE_COUNT; i++) {
+        int adc_raw = 0;
+        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, probes[probe].adc_channel, &adc_raw));
+        sum += adc_raw;
     }
+    return probe_voltage(probe, sum >> LEAK_SENSOR_OVERSAMPLE_BITS);
+}
+#endif
+
+void liquid_level_sensor_init(void)
+{
+    calibration_init();
+
+#if LEAK_SENSOR_CONTINUOUS_MODE
+    adc_continuous_init();
+#else
+    adc_oneshot_init();
+#endif
 
     ESP_LOGI(TAG, "Liquid level sensor initialized");
 }
 
-int liquid_level_sensor_read(void)
+int liquid_level_sensor_probe_count(void)
 {
-    int adc_raw = 0;
-    int voltage = 0;
-    ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, ADC_CHANNEL, &adc_raw));
-    
-    if (do_calibration1) {
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc1_cali_handle, adc_raw, &voltage));
-    }
-    
-    //ESP_LOGI(TAG, "ADC%d Channel[%d] Raw Data: %d, Voltage: %dmV", ADC_UNIT, ADC_CHANNEL, adc_raw, voltage);
-    
-    return voltage;
+    return PROBE_COUNT;
 }
 
-bool leak_detection(int voltage, int leak_threshold, int flush_threshold){
-    int secondary_reading = liquid_level_sensor_read();
+const leak_sensor_probe_t *liquid_level_sensor_probe(int index)
+{
+    return (index >= 0 && index < PROBE_COUNT) ? &probes[index] : NULL;
+}
 
-    //vTaskDelay(pdMS_TO_TICKS(2000));
+// Blocks until the DMA ring hands over one conversion frame, then demultiplexes it per probe and converts to mV.
+// In oneshot mode every probe is converted once.
+static int read_scan(leak_sensor_scan_t *scans, uint32_t timeout_ms, uint32_t *convert_us)
+{
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        scans[i].count = 0;
+    }
+#if LEAK_SENSOR_CONTINUOUS_MODE
+    if (!adc_running) {
+        // Resume after liquid_level_sensor_pause(); the first frame is fresh
+        memset(probe_decimator, 0, sizeof(probe_decimator));
+        ESP_ERROR_CHECK(adc_continuous_start(adc1_cont_handle));
+        adc_running = true;
+    }
+    uint32_t frame_bytes = 0;
+    esp_err_t ret = adc_continuous_read(adc1_cont_handle, adc_frame_buf, ADC_FRAME_BYTES, &frame_bytes, timeout_ms);
+    if (ret != ESP_OK) {
+        if (ret != ESP_ERR_TIMEOUT) {
+            ESP_LOGW(TAG, "adc_continuous_read failed: %s", esp_err_to_name(ret));
+        }
+        return 0;
+    }
 
-    return (leak_threshold > voltage && leak_threshold > secondary_reading && voltage > flush_threshold);
+    int64_t start_us = esp_timer_get_time();
+    int total = 0;
+    // Table lookups only: no calibration math per sample
+    for (uint32_t i = 0; i < frame_bytes; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t *)&adc_frame_buf[i];
+        int probe = p->type1.channel < SOC_ADC_MAX_CHANNEL_NUM ? channel_probe[p->type1.channel] : -1;
+        uint32_t code;
+        if (probe < 0 || !adc_decimator_push(&probe_decimator[probe], p->type1.data, LEAK_SENSOR_OVERSAMPLE_BITS, &code) ||
+            scans[probe].count >= LEAK_SENSOR_FRAME_SAMPLES) {
+            continue;
+        }
+        scans[probe].voltages[scans[probe].count++] = probe_voltage(probe, code);
+        total++;
+    }
+#else
+    (void)timeout_ms;
+    int64_t start_us = esp_timer_get_time();
+    int total = 0;
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        scans[i].voltages[0] = oneshot_read_probe(i);
+        scans[i].count = 1;
+        total++;
+    }
+#endif
+    if (convert_us != NULL) {
+        *convert_us = (uint32_t)(esp_timer_get_time() - start_us);
+    }
+    return total;
+}
+
+// The APB clock must not scale, nor the chip sleep, while the SAR converts or the DMA fills the frame
+int liquid_level_sensor_read_scan(leak_sensor_scan_t *scans, uint32_t timeout_ms, uint32_t *convert_us)
+{
+    power_lock_acquire(POWER_LOCK_ADC);
+    int total = read_scan(scans, timeout_ms, convert_us);
+    power_lock_release(POWER_LOCK_ADC);
+    return total;
 }
 
-bool full_tank_detection(int voltage, int leak_threshold){
-    return (voltage > leak_threshold);
+void liquid_level_sensor_read_all(int *voltages)
+{
+#if LEAK_SENSOR_CONTINUOUS_MODE
+    // Average one full frame so callers get a low-noise reading per probe
+    liquid_level_sensor_read_scan(frame_scans, ADC_MAX_DELAY, NULL);
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        int sum = 0;
+        for (int j = 0; j < frame_scans[i].count; j++) {
+            sum += frame_scans[i].voltages[j];
+        }
+        voltages[i] = frame_scans[i].count > 0 ? sum / frame_scans[i].count : 0;
+    }
+#else
+    power_lock_acquire(POWER_LOCK_ADC);
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        voltages[i] = oneshot_read_probe(i);
+    }
+    power_lock_release(POWER_LOCK_ADC);
+#endif
 }
 
-bool flush_detection(int voltage, int flush_threshold){
-    return (flush_threshold > voltage);
-}
\ No newline at end of file
+// Samples of the first probe only; the others in the frame are discarded
+int liquid_level_sensor_read_frame(int *voltages, int max_samples, uint32_t timeout_ms)
+{
+#if LEAK_SENSOR_CONTINUOUS_MODE
+    liquid_level_sensor_read_scan(frame_scans, timeout_ms, NULL);
+    int count = frame_scans[0].count < max_samples ? frame_scans[0].count : max_samples;
+    for (int i = 0; i < count; i++) {
+        voltages[i] = frame_scans[0].voltages[i];
+    }
+    return count;
+#else
+    if (max_samples < 1) {
+        return 0;
+    }
+    (void)timeout_ms;
+    voltages[0] = liquid_level_sensor_read();
+    return 1;
+#endif
+}
+
+int liquid_level_sensor_read(void)
+{
+    int voltages[PROBE_COUNT];
+    liquid_level_sensor_read_all(voltages);
+    return voltages[0];
+}
+
+// Stop the DMA stream (and its per-frame interrupts) until the next read
+void liquid_level_sensor_pause(void)
+{
+#if LEAK_SENSOR_CONTINUOUS_MODE
+    if (adc_running) {
+        ESP_ERROR_CHECK(adc_continuous_stop(adc1_cont_handle));
+        // Drop frames captured before the stop so the next read is not stale
+        adc_continuous_flush_pool(adc1_cont_handle);
+        adc_running = false;
+    }
+#endif
+}
+
+static int adc_source_read_frame(sample_source_t *src, int *voltages, int max_samples, uint32_t timeout_ms)
+{
+#if !LEAK_SENSOR_CONTINUOUS_MODE
+    // Pace oneshot reads at a fixed period, the way the DMA frame rate paces continuous mode
+    static TickType_t last_wake = 0;
+    if (last_wake == 0) {
+        last_wake = xTaskGetTickCount();
+    } else {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(LEAK_SENSOR_ONESHOT_PERIOD_MS));
+    }
+#endif
+    return liquid_level_sensor_read_frame(voltages, max_samples, timeout_ms);
+}
+
+static sample_source_t adc_source = {
+    .name = "adc",
+#if LEAK_SENSOR_CONTINUOUS_MODE
+    .sample_period_us = 1000000 / LEAK_SENSOR_OUTPUT_FREQ_HZ,   // Replaced with the configured rate at init
+#else
+    .sample_period_us = LEAK_SENSOR_ONESHOT_PERIOD_MS * 1000,
+#endif
+    .read_frame = adc_source_read_frame,
+};
+
+sample_source_t *liquid_level_sensor_source(void)
+{
+    return &adc_source;
+}
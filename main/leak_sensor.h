@@ -2,12 +2,64 @@
 #define LEAK_SENSOR_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include "sample_source.h"
+
+// Acquisition mode: 1 = continuous DMA stream (adc_continuous), 0 = oneshot polling
+#ifndef LEAK_SENSOR_CONTINUOUS_MODE
+#define LEAK_SENSOR_CONTINUOUS_MODE 1
+#endif
+
+// Continuous mode settings. The ESP32 digital controller cannot run slower than
+// SOC_ADC_SAMPLE_FREQ_THRES_LOW (20 kHz), so lower rates are clamped at init.
+#define LEAK_SENSOR_SAMPLE_FREQ_HZ 20000
+#define LEAK_SENSOR_FRAME_SAMPLES 256        // Conversions per probe per DMA frame
+#define LEAK_SENSOR_RING_FRAMES 4            // DMA ring buffer depth in frames
+
+// Oversample and decimate: each output sample sums 4^n conversions for n extra bits of resolution,
+// converted through the calibration LUT. 0 passes every conversion through.
+#ifndef LEAK_SENSOR_OVERSAMPLE_BITS
+#define LEAK_SENSOR_OVERSAMPLE_BITS 2
+#endif
+#define LEAK_SENSOR_OUTPUT_FREQ_HZ (LEAK_SENSOR_SAMPLE_FREQ_HZ >> (2 * LEAK_SENSOR_OVERSAMPLE_BITS))
+
+// Oneshot mode paces itself: each read blocks until the next sample is due
+#define LEAK_SENSOR_ONESHOT_PERIOD_MS 1500
+
+// Sensor registry: one probe per monitored tank, all on ADC1 and sampled in one scan pattern.
+// LEAK_SENSOR_SAMPLE_FREQ_HZ is the rate per probe; the scan runs at that times the probe count.
+#define LEAK_SENSOR_MAX_PROBES 4
+
+typedef struct {
+    const char *name;           // MQTT sub-topic under MQTT_TOPIC; "" publishes on MQTT_TOPIC itself
+    int adc_channel;            // adc_channel_t on ADC1 (ADC_CHANNEL_7 = GPIO35)
+    int atten;                  // adc_atten_t matching the probe's output range
+    int leak_threshold_mv;
+    int flush_threshold_mv;
+    int offset_mv;              // Per-probe trim added after the eFuse calibration curve
+} leak_sensor_probe_t;
+
+// One scan split per probe, in probe order, after decimation
+typedef struct {
+    int count;
+    int voltages[LEAK_SENSOR_FRAME_SAMPLES];
+} leak_sensor_scan_t;
 
 void liquid_level_sensor_init(void);
+int liquid_level_sensor_probe_count(void);
+const leak_sensor_probe_t *liquid_level_sensor_probe(int index);
+// Read one scan frame into scans[0..probe_count-1]. Returns the total sample count, 0 on timeout.
+// convert_us (optional) receives the CPU time spent demultiplexing, decimating and converting the frame.
+int liquid_level_sensor_read_scan(leak_sensor_scan_t *scans, uint32_t timeout_ms, uint32_t *convert_us);
+// One low-noise reading per probe: a frame average in continuous mode, one conversion each in oneshot
+void liquid_level_sensor_read_all(int *voltages);
+// Single-probe API, served by the first registry entry
 int liquid_level_sensor_read(void);
+int liquid_level_sensor_read_frame(int *voltages, int max_samples, uint32_t timeout_ms);
+// Continuous mode: stop sampling between readings; the next read restarts the stream. No-op in oneshot mode.
+void liquid_level_sensor_pause(void);
 int liquid_level_sensor_voltage (int sensor_value);
-bool leak_detection(int voltage, int leak_threshold, int flush_threshold);
-bool full_tank_detection(int voltage, int leak_threshhold);
-bool flush_detection(int voltage, int flush_threshold);
+// ADC-backed sample source for the first probe
+sample_source_t *liquid_level_sensor_source(void);
 
 #endif // LEAK_SENSOR_H
\ No newline at end of file
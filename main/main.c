@@ -1,168 +1,895 @@
 #include <stdio.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "soc/soc_caps.h"
 #include "iot_wifi.h"
 #include "iot_mqtt.h"
 #include "leak_sensor.h"
+#include "leak_classifier.h"
+#include "report_policy.h"
+#include "payload_codec.h"
+#include "telemetry_batch.h"
+#include "sensor_channel.h"
+#include "duty_cycle.h"
+#include "sample_scheduler.h"
+#include "tank_analytics.h"
+#include "metrics.h"
+#include "boot_timeline.h"
+#include "device_config.h"
+#include "event_log.h"
+#include "mem_profile.h"
+#include "power_mgmt.h"
+#include "esp_netif_sntp.h"
+#include "esp_sleep.h"
+#include "esp_attr.h"
 #include <stdbool.h>
+#include <sys/time.h>
+#include <time.h>
 
 static const char *TAG = "MAIN";
 
 // Task handles
 static TaskHandle_t sensor_task_handle = NULL;
 static TaskHandle_t mqtt_task_handle = NULL;
-bool full_tank = true;
-bool leak_detected = false;
-bool flush_detected = false;
 
-// Shared data structure for sensor readings
+#define BOOT_PROFILE_TIMEOUT_MS 30000   // Give up waiting for the first acknowledged publish in the boot report
+
+#define SENSOR_STATS_INTERVAL_MS 60000  // Per-probe CPU cost log period
+
+// Sensor task -> publisher task, lock-free
+static sensor_channel_t sensor_channel;
+
+// Independent detector per sensor registry entry, owned by the sensor task
 typedef struct {
-    int voltage;           // For MQTT publishing
-    bool leak_detected;      // For MQTT publishing
-    bool full_tank;          // For MQTT publishing
-    bool flush_detected;     // For MQTT publishing
-} sensor_data_t;
+    const leak_sensor_probe_t *probe;
+    leak_classifier_t classifier;
+#if ADAPTIVE_SAMPLING
+    sample_scheduler_t scheduler;
+#endif
+    int64_t next_report_us;
+    uint32_t samples;           // Since the last stats log
+    uint32_t cpu_us;            // Share of the frame conversion plus classification, since the last stats log
+} probe_detector_t;
 
-// Global variables
-static sensor_data_t current_sensor_data = {0};
-static SemaphoreHandle_t sensor_data_mutex = NULL;
+// Per-probe reporting state, owned by the publisher task
+typedef struct {
+    char topic[48];             // MQTT_TOPIC plus the probe's sub-topic
+    sensor_record_t latest;
+    bool have_latest;
+    bool have_alarm;            // A state has been published as an alarm
+    tank_state_t alarm_state;   // State carried by the last alarm
+#if REPORT_BY_EXCEPTION
+    report_policy_t policy;
+#endif
+#if TELEMETRY_BATCHING
+    telemetry_batch_t batch;
+#endif
+#if TANK_ANALYTICS
+    tank_analytics_t analytics;
+#endif
+} probe_publisher_t;
+
+static probe_detector_t detectors[LEAK_SENSOR_MAX_PROBES];
+static probe_publisher_t publishers[LEAK_SENSOR_MAX_PROBES];
 
 // Task function declarations
 static void sensor_monitoring_task(void *pvParameters);
 static void mqtt_publishing_task(void *pvParameters);
+static bool publish_snapshot(const sensor_record_t *record);
+#if TELEMETRY_BATCHING || TANK_ANALYTICS
+static int64_t epoch_offset_ms(void);
+#endif
+#if TELEMETRY_BATCHING
+static void flush_telemetry_batch(probe_publisher_t *pub, uint32_t now_ms, uint32_t deadline_ms);
+#endif
+#if RUNTIME_METRICS
+static void publish_metrics(uint32_t now_ms, uint32_t interval_ms);
+#endif
+#if TANK_ANALYTICS
+static int hour_of_day(int64_t timestamp_ms);
+static void publish_analytics(probe_publisher_t *pub, uint32_t now_ms);
+#endif
+
+#if DUTY_CYCLE_MODE
+#define DUTY_CONNECT_TIMEOUT_MS 10000   // Abandon the uplink if Wi-Fi and MQTT are not up by then
+#define DUTY_SEND_TIMEOUT_MS 5000       // Wait this long for broker acks before sleeping
+#define DUTY_SNTP_TIMEOUT_MS 2000
+static RTC_DATA_ATTR duty_cycle_state_t duty_state;  // Survives deep sleep
+static void duty_cycle_run(void);
+static bool duty_cycle_uplink(duty_action_t action);
+#endif
 
 void app_main(void)
 {
+    boot_timeline_start();
+    power_mgmt_init();
+    event_log_init();
     ESP_LOGI(TAG, "Starting Toilet Leak Detector...");
+    device_config_init();
     
-    // Create mutex for protecting shared sensor data
-    sensor_data_mutex = xSemaphoreCreateMutex();
-    if (sensor_data_mutex == NULL) {
-        ESP_LOGE(TAG, "Failed to create mutex");
-        return;
-    }
+#if DUTY_CYCLE_MODE
+    // One reading per wake, then back to deep sleep; does not return
+    duty_cycle_run();
+#endif
+
+    sensor_channel_init(&sensor_channel);
     
     // Initialize liquid level sensor
     liquid_level_sensor_init();
     ESP_LOGI(TAG, "Liquid level sensor initialized");
-    
-    // Initialize WiFi
-    wifi_init();
-    ESP_LOGI(TAG, "WiFi initialization started");
-
-    // Initialize MQTT
-    mqtt_init();
-    ESP_LOGI(TAG, "MQTT initialization started");
+    boot_timeline_mark(BOOT_PHASE_SENSOR_READY);
 
-    // Create sensor monitoring task
-    xTaskCreate(
+    // Sampling starts straight away; readings queue in the channel while the network comes up
+    MEM_TASK_CREATE(
         sensor_monitoring_task,      // Task function
         "sensor_monitor",           // Task name
-        4096,                       // Stack size (bytes)
-        NULL,                       // Task parameters
+        SENSOR_TASK_STACK,          // Stack size (bytes)
         5,                          // Task priority
-        NULL         // Task handle
+        &sensor_task_handle         // Task handle
     );
     
-    // Create MQTT publishing task
-    xTaskCreate(
+    // The publisher drains the channel from the start; until the broker session is up its snapshots wait in
+    // the scheduler and QoS 1 publishes in the flash outbox, as they would during any other outage
+    mqtt_init();
+    MEM_TASK_CREATE(
         mqtt_publishing_task,       // Task function
         "mqtt_publisher",          // Task name
-        4096,                       // Stack size (bytes)
-        NULL,                       // Task parameters
+        PUBLISHER_TASK_STACK,       // Stack size (bytes)
         4,                          // Task priority
-        NULL           // Task handle
+        &mqtt_task_handle           // Task handle
     );
-    
+
+    // Initialize WiFi
+    wifi_init();
+    ESP_LOGI(TAG, "WiFi initialization started");
+    wifi_wait_connected(portMAX_DELAY);
+
+#if TELEMETRY_BATCHING || TANK_ANALYTICS
+    // Batch timestamps and the analytics hour-of-day histograms use wall clock once SNTP has synced
+    esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
+    ESP_ERROR_CHECK(esp_netif_sntp_init(&sntp_config));
+#endif
+
+    mqtt_start();
+    ESP_LOGI(TAG, "MQTT initialization started");
     
     ESP_LOGI(TAG, "All tasks created successfully");
+
+    //-------------Boot-time breakdown---------------//
+    // The publisher sends its first reading as soon as the broker session is up; its PUBACK closes the timeline
+    bool acked = boot_timeline_wait(BOOT_PHASE_FIRST_PUBACK, pdMS_TO_TICKS(BOOT_PROFILE_TIMEOUT_MS));
+    wifi_connect_timing_t wifi_timing;
+    wifi_get_connect_timing(&wifi_timing);
+    boot_timeline_log();
+    ESP_LOGI(TAG, "Boot: wifi %s, %lu attempt(s), first publish %s", wifi_timing.fast_path ? "fast" : "scan",
+             (unsigned long)wifi_timing.attempts, acked ? "acknowledged" : "not acknowledged in time");
+    char boot_record[BOOT_TIMELINE_MAX_ENCODED];
+    int boot_len = boot_timeline_encode(false, boot_record, sizeof(boot_record));
+    if (boot_len > 0) {
+        mqtt_publish(MQTT_TOPIC BOOT_TIMELINE_SUBTOPIC, boot_record, boot_len, 1, 0);
+    }
+    ESP_LOGI(TAG, "Boot heap: %lu bytes free, %lu bytes minimum free",
+             (unsigned long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size());
+}
+
+static const char *probe_label(const leak_sensor_probe_t *probe)
+{
+    return probe->name[0] != '\0' ? probe->name : "default";
+}
+
+// Thresholds come from the runtime configuration (registry values by default), time constants from
+// the current sample period
+static void probe_classifier_config(int probe, const device_config_t *config, uint32_t sample_period_us,
+                                    leak_classifier_config_t *cfg)
+{
+    leak_classifier_default_config(cfg, sample_period_us);
+    cfg->leak_threshold_mv = config->leak_mv[probe];
+    cfg->flush_threshold_mv = config->flush_mv[probe];
 }
 
-// Task to monitor liquid level sensor
+#if ADAPTIVE_SAMPLING
+// Default scheduler with the configured rate limits; per-state targets are kept inside them
+static void scheduler_config(const device_config_t *config, sample_scheduler_config_t *cfg)
+{
+    sample_scheduler_default_config(cfg);
+    cfg->min_period_ms = config->sample_min_ms;
+    cfg->max_period_ms = config->sample_max_ms;
+    cfg->state_period_ms[TANK_STATE_FULL] = config->sample_max_ms;
+    cfg->state_period_ms[TANK_STATE_FLUSHING] = config->sample_min_ms;
+    for (int s = TANK_STATE_REFILLING; s <= TANK_STATE_LEAKING; s++) {
+        if (cfg->state_period_ms[s] < cfg->min_period_ms) {
+            cfg->state_period_ms[s] = cfg->min_period_ms;
+        }
+        if (cfg->state_period_ms[s] > cfg->max_period_ms) {
+            cfg->state_period_ms[s] = cfg->max_period_ms;
+        }
+    }
+}
+#endif
+
+// Log what each probe's detector costs, and how many probes one core could stream at the configured rate
+static void log_probe_costs(int probe_count, int64_t window_us)
+{
+    uint64_t total_cpu_us = 0;
+    uint64_t total_samples = 0;
+    for (int p = 0; p < probe_count; p++) {
+        probe_detector_t *d = &detectors[p];
+        uint32_t load_bp = (uint32_t)((uint64_t)d->cpu_us * 10000 / (uint64_t)window_us);
+        ESP_LOGI(TAG, "Probe %s: %lu samples, %lu us CPU (%lu.%02lu%% of a core), %lu ns/sample",
+                 probe_label(d->probe), (unsigned long)d->samples, (unsigned long)d->cpu_us,
+                 (unsigned long)(load_bp / 100), (unsigned long)(load_bp % 100),
+                 (unsigned long)(d->samples > 0 ? (uint64_t)d->cpu_us * 1000 / d->samples : 0));
+        total_cpu_us += d->cpu_us;
+        total_samples += d->samples;
+        d->cpu_us = 0;
+        d->samples = 0;
+    }
+    if (total_samples > 0 && total_cpu_us > 0) {
+        // ns per decimated sample times samples per second per probe = ns of CPU per second per probe
+        uint64_t ns_per_probe_s = total_cpu_us * 1000 / total_samples * LEAK_SENSOR_OUTPUT_FREQ_HZ;
+        ESP_LOGI(TAG, "Streaming at %d Hz per probe (%d Hz decimated), one core fits ~%lu probes (ADC scan limit %d)",
+                 LEAK_SENSOR_SAMPLE_FREQ_HZ, LEAK_SENSOR_OUTPUT_FREQ_HZ,
+                 (unsigned long)(1000000000ULL / (ns_per_probe_s ? ns_per_probe_s : 1)),
+                 SOC_ADC_SAMPLE_FREQ_THRES_HIGH / LEAK_SENSOR_SAMPLE_FREQ_HZ);
+    }
+}
+
+// Task to monitor the liquid level sensors: one scan covers every probe, each probe has its own detector
 static void sensor_monitoring_task(void *pvParameters)
 {
-    const int LEAK_THRESHOLD_VOLTAGE = 1740;  // Voltage threshold for leak detection in mV
-    const int FLUSH_THRESHOLD_VOLTAGE = 1000; // Voltage threshold for flush detection in mV
-    const int SENSOR_CHECK_INTERVAL_MS = 1500; // Check every 1.5 seconds
-    
+    static leak_sensor_scan_t scans[LEAK_SENSOR_MAX_PROBES];
+    int probe_count = liquid_level_sensor_probe_count();
+    leak_classifier_config_t classifier_cfg;
+    device_config_t config;
+    uint32_t config_generation = device_config_generation();
+    device_config_get(&config);
+
+#if ADAPTIVE_SAMPLING
+    // One scan per scheduled slot; the shared period is the shortest any probe's scheduler asks for
+    sample_scheduler_config_t scheduler_cfg;
+    scheduler_config(&config, &scheduler_cfg);
+    uint32_t period_ms = scheduler_cfg.max_period_ms;
+    for (int p = 0; p < probe_count; p++) {
+        sample_scheduler_init(&detectors[p].scheduler, &scheduler_cfg);
+        if (detectors[p].scheduler.period_ms < period_ms) {
+            period_ms = detectors[p].scheduler.period_ms;
+        }
+    }
+    uint32_t sample_period_us = period_ms * 1000;
+    TickType_t last_wake = xTaskGetTickCount();
+#else
+    // Continuous: one DMA frame per probe per scan. Oneshot: one conversion per probe, paced here.
+    uint32_t sample_period_us = liquid_level_sensor_source()->sample_period_us;
+#if !LEAK_SENSOR_CONTINUOUS_MODE
+    TickType_t last_wake = xTaskGetTickCount();
+#endif
+#endif
+
+    for (int p = 0; p < probe_count; p++) {
+        detectors[p].probe = liquid_level_sensor_probe(p);
+        probe_classifier_config(p, &config, sample_period_us, &classifier_cfg);
+        leak_classifier_init(&detectors[p].classifier, &classifier_cfg);
+    }
+    int64_t stats_start_us = esp_timer_get_time();
+#if RUNTIME_METRICS
+    // Loop period the task aims for: one scheduled slot, one paced oneshot read or one DMA frame
+#if ADAPTIVE_SAMPLING
+    uint32_t expected_period_us = period_ms * 1000;
+#elif LEAK_SENSOR_CONTINUOUS_MODE
+    // A frame holds LEAK_SENSOR_FRAME_SAMPLES conversions per probe, 4^n of them per decimated sample; the source
+    // period already accounts for the probe count and a clamped scan rate
+    const uint32_t expected_period_us =
+        (uint32_t)(((uint64_t)sample_period_us * LEAK_SENSOR_FRAME_SAMPLES) >> (2 * LEAK_SENSOR_OVERSAMPLE_BITS));
+#else
+    const uint32_t expected_period_us = LEAK_SENSOR_ONESHOT_PERIOD_MS * 1000;
+#endif
+    int64_t prev_loop_us = 0;
+#endif
     
-    ESP_LOGI(TAG, "Sensor monitoring task started");
+    ESP_LOGI(TAG, "Sensor monitoring task started, %d probe(s)", probe_count);
     
     while (1) {
-        // Read sensor value
-        int voltage = liquid_level_sensor_read();
-        //int voltage = liquid_level_sensor_voltage(sensor_value); // mV value
-        
-        ESP_LOGI(TAG, "Sensor Voltage: %dmV", voltage);
-        
-        full_tank = full_tank_detection(voltage, LEAK_THRESHOLD_VOLTAGE);
-        if(full_tank == false){
-            //Determine if toilet has been flushed
-            flush_detected = flush_detection(voltage, FLUSH_THRESHOLD_VOLTAGE);
-
-            if(flush_detected == false){
-                //Determine if there is a leak
-                leak_detected = leak_detection(voltage, LEAK_THRESHOLD_VOLTAGE, FLUSH_THRESHOLD_VOLTAGE);
+#if RUNTIME_METRICS
+        int64_t loop_us = esp_timer_get_time();
+        if (prev_loop_us != 0) {
+            int64_t error_us = loop_us - prev_loop_us - expected_period_us;
+            metrics_observe(METRIC_SENSOR_JITTER_US, (uint32_t)(error_us < 0 ? -error_us : error_us));
+        }
+        prev_loop_us = loop_us;
+#endif
+        // Pick up a remote configuration change between scans, so every probe switches at the same reading
+        if (device_config_generation() != config_generation) {
+            config_generation = device_config_generation();
+            device_config_get(&config);
+            uint32_t prev_period_us = sample_period_us;
+#if ADAPTIVE_SAMPLING
+            // New rate limits apply from this slot on, not whenever each scheduler next moves its period
+            scheduler_config(&config, &scheduler_cfg);
+            period_ms = scheduler_cfg.max_period_ms;
+            for (int p = 0; p < probe_count; p++) {
+                sample_scheduler_reconfigure(&detectors[p].scheduler, &scheduler_cfg);
+                if (detectors[p].scheduler.period_ms < period_ms) {
+                    period_ms = detectors[p].scheduler.period_ms;
+                }
+            }
+            sample_period_us = period_ms * 1000;
+#endif
+            for (int p = 0; p < probe_count; p++) {
+                probe_classifier_config(p, &config, sample_period_us, &classifier_cfg);
+                leak_classifier_retime(&detectors[p].classifier, &classifier_cfg, prev_period_us, sample_period_us);
+            }
+            ESP_LOGI(TAG, "Sensor task applied configuration %lu", (unsigned long)config_generation);
+        }
+        uint32_t convert_us = 0;
+        int total = liquid_level_sensor_read_scan(scans, SENSOR_CHECK_INTERVAL_MS, &convert_us);
+#if ADAPTIVE_SAMPLING
+        // The DMA stream stops until the next slot; oneshot already converted each probe once
+        liquid_level_sensor_pause();
+#endif
+        if (total <= 0) {
+            ESP_LOGW(TAG, "No ADC frames received in %dms", SENSOR_CHECK_INTERVAL_MS);
+            continue;
+        }
+#if RUNTIME_METRICS
+        metrics_observe(METRIC_ADC_READ_US, convert_us);
+#endif
+        boot_timeline_mark(BOOT_PHASE_FIRST_SAMPLE);
+#if ADAPTIVE_SAMPLING
+        uint32_t next_period_ms = scheduler_cfg.max_period_ms;
+#endif
+
+        for (int p = 0; p < probe_count; p++) {
+            probe_detector_t *d = &detectors[p];
+            int64_t start_us = esp_timer_get_time();
+#if ADAPTIVE_SAMPLING
+            // A frame average in continuous mode, one conversion in oneshot
+            int reading = 0;
+            for (int i = 0; i < scans[p].count; i++) {
+                reading += scans[p].voltages[i];
+            }
+            reading = scans[p].count > 0 ? reading / scans[p].count : 0;
+            const int *frame = &reading;
+            int count = scans[p].count > 0 ? 1 : 0;
+#else
+            const int *frame = scans[p].voltages;
+            int count = scans[p].count;
+#endif
+
+            tank_state_t prev_state = d->classifier.state;
+            tank_state_t state = leak_classifier_feed(&d->classifier, frame, count);
+            int64_t now_us = esp_timer_get_time();
+
+            // Report on every debounced transition, otherwise once per check interval
+            if (state != prev_state || now_us >= d->next_report_us) {
+                d->next_report_us = now_us + (int64_t)config.check_ms * 1000;
+                int voltage = leak_classifier_voltage(&d->classifier);
+
+                if (state != prev_state) {
+                    EVENT_LOG(LOG_EVENT_TANK_TRANSITION, LOG_STR(probe_label(d->probe)),
+                              LOG_STR(leak_classifier_state_name(prev_state)),
+                              LOG_STR(leak_classifier_state_name(state)), LOG_INT(voltage));
+                } else {
+                    EVENT_LOG(LOG_EVENT_TANK_VOLTAGE, LOG_STR(probe_label(d->probe)), LOG_INT(voltage));
+                }
+
+                // Entering flush or leak latches an event that stays set until the publisher reports it
+                if (state != prev_state && state == TANK_STATE_FLUSHING) {
+                    sensor_channel_latch(&sensor_channel, SENSOR_EVENT_FLUSH << SENSOR_EVENT_SHIFT(p));
+                }
+                if (state != prev_state && state == TANK_STATE_LEAKING) {
+                    sensor_channel_latch(&sensor_channel, SENSOR_EVENT_LEAK << SENSOR_EVENT_SHIFT(p));
+                }
+
+                sensor_record_t record = {
+                    .timestamp_us = now_us,
+                    .voltage_mv = voltage,
+                    .state = state,
+                    .probe = (uint8_t)p,
+                };
+                if (!sensor_channel_push(&sensor_channel, &record)) {
+                    EVENT_LOG(LOG_EVENT_SENSOR_OVERRUN, LOG_UINT(atomic_load(&sensor_channel.overruns)));
+                }
+
+                // Wake the publisher so transitions go out without waiting for its next cycle
+                if (mqtt_task_handle != NULL) {
+                    xTaskNotifyGive(mqtt_task_handle);
+                }
+            }
+
+#if ADAPTIVE_SAMPLING
+            uint32_t probe_period_ms = sample_scheduler_next(&d->scheduler, state, reading, (uint32_t)(now_us / 1000));
+            if (probe_period_ms < next_period_ms) {
+                next_period_ms = probe_period_ms;
+            }
+            if (state != prev_state) {
+                const sample_scheduler_stats_t *st = &d->scheduler.stats;
+                ESP_LOGI(TAG, "Tank %s wants %lu ms; readings full %lu, flushing %lu, refilling %lu, leaking %lu, "
+                              "slope triggers %lu", probe_label(d->probe), (unsigned long)probe_period_ms,
+                         (unsigned long)st->samples_per_state[TANK_STATE_FULL],
+                         (unsigned long)st->samples_per_state[TANK_STATE_FLUSHING],
+                         (unsigned long)st->samples_per_state[TANK_STATE_REFILLING],
+                         (unsigned long)st->samples_per_state[TANK_STATE_LEAKING], (unsigned long)st->slope_triggers);
             }
+#endif
+
+            // The frame conversion is shared, so each probe is charged for its share of the samples
+            d->cpu_us += (uint32_t)((uint64_t)convert_us * scans[p].count / total) +
+                         (uint32_t)(esp_timer_get_time() - start_us);
+            d->samples += scans[p].count;
         }
-        // Update shared data with mutex protection
-        
-        if (xSemaphoreTake(sensor_data_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            current_sensor_data.voltage = voltage;
-            current_sensor_data.leak_detected = leak_detected;
-            current_sensor_data.full_tank = full_tank;
-            current_sensor_data.flush_detected = flush_detected;
-
-            xSemaphoreGive(sensor_data_mutex);
+
+        int64_t now_us = esp_timer_get_time();
+        if (now_us - stats_start_us >= (int64_t)SENSOR_STATS_INTERVAL_MS * 1000) {
+            log_probe_costs(probe_count, now_us - stats_start_us);
+            stats_start_us = now_us;
         }
-        
-        
-        // Wait before next reading
-        vTaskDelay(pdMS_TO_TICKS(SENSOR_CHECK_INTERVAL_MS));
+
+#if ADAPTIVE_SAMPLING
+        if (next_period_ms != period_ms) {
+            // Keep every classifier's debounce and filter time constants in real time at the new rate
+            for (int p = 0; p < probe_count; p++) {
+                probe_classifier_config(p, &config, next_period_ms * 1000, &classifier_cfg);
+                leak_classifier_retime(&detectors[p].classifier, &classifier_cfg, period_ms * 1000,
+                                       next_period_ms * 1000);
+            }
+            EVENT_LOG(LOG_EVENT_SAMPLE_PERIOD, LOG_UINT(next_period_ms));
+            period_ms = next_period_ms;
+            sample_period_us = period_ms * 1000;
+        }
+#if RUNTIME_METRICS
+        expected_period_us = period_ms * 1000;
+#endif
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(period_ms));
+#elif !LEAK_SENSOR_CONTINUOUS_MODE
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(LEAK_SENSOR_ONESHOT_PERIOD_MS));
+#endif
     }
 }
 
+// Latched events of one probe, shifted down to SENSOR_EVENT_* bits
+static uint32_t probe_events(int probe)
+{
+    return (sensor_channel_latched(&sensor_channel) >> SENSOR_EVENT_SHIFT(probe)) & SENSOR_EVENT_MASK;
+}
+
 // Task to publish MQTT data
 static void mqtt_publishing_task(void *pvParameters)
 {
-    const int MQTT_PUBLISH_INTERVAL_MS = 5000; // Publish every 5 seconds
-    sensor_data_t data_to_publish;
-    char mqtt_message[256];
+    int probe_count = liquid_level_sensor_probe_count();
+    sensor_record_t record;
+    device_config_t config;
+    uint32_t config_generation = device_config_generation();
+    device_config_get(&config);
+
+    for (int p = 0; p < probe_count; p++) {
+        probe_publisher_t *pub = &publishers[p];
+        const char *name = liquid_level_sensor_probe(p)->name;
+        snprintf(pub->topic, sizeof(pub->topic), "%s%s%s", MQTT_TOPIC, name[0] != '\0' ? "/" : "", name);
+#if REPORT_BY_EXCEPTION
+        report_policy_init(&pub->policy, config.deadband_mv, config.heartbeat_ms);
+#endif
+#if TELEMETRY_BATCHING
+        telemetry_batch_init(&pub->batch);
+#endif
+#if TANK_ANALYTICS
+        tank_analytics_init(&pub->analytics, (uint32_t)(esp_timer_get_time() / 1000));
+#endif
+    }
     
     ESP_LOGI(TAG, "MQTT publishing task started");
     
     while (1) {
-        // Get current sensor data with mutex protection
-        if (xSemaphoreTake(sensor_data_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            data_to_publish = current_sensor_data; // Copy the data
-            xSemaphoreGive(sensor_data_mutex);
-            
-            /*
-            // Debug log with all internal data
-            ESP_LOGD(TAG, "Internal data - Sensor: %.2f, Voltage: %.2fV, Leak: %s, Time: %llds", 
-                    data_to_publish.sensor_value, data_to_publish.voltage, 
-                    data_to_publish.leak_detected ? "true" : "false", data_to_publish.timestamp);
-            */
-            // Create JSON message with only voltage and leak_detected for MQTT
-            snprintf(mqtt_message, sizeof(mqtt_message),
-                    "{\"voltage\":%dmV,\"full_tank\":%s,\"leak_detected\":%s,\"flush_detected\":%s}",
-                    data_to_publish.voltage,
-                    data_to_publish.full_tank ? "true" : "false",
-                    data_to_publish.leak_detected ? "true" : "false",
-                    data_to_publish.flush_detected ? "true" : "false");
-            
-            // Publish to MQTT
-            mqtt_publish_leak_data(mqtt_message);
-            ESP_LOGI(TAG, "Published to MQTT: %s", mqtt_message);
-        } else {
-            ESP_LOGW(TAG, "Failed to acquire mutex for MQTT publishing");
+#if REPORT_BY_EXCEPTION
+        // Sleep until the sensor task posts a new reading; the timeout keeps the heartbeat alive
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(config.heartbeat_ms));
+#endif
+        if (device_config_generation() != config_generation) {
+            config_generation = device_config_generation();
+            device_config_get(&config);
+#if REPORT_BY_EXCEPTION
+            // Only the limits change; the last report stays the reference for deadband and heartbeat
+            for (int p = 0; p < probe_count; p++) {
+                publishers[p].policy.deadband_mv = config.deadband_mv;
+                publishers[p].policy.heartbeat_ms = config.heartbeat_ms;
+            }
+#endif
+            ESP_LOGI(TAG, "Publisher applied configuration %lu", (unsigned long)config_generation);
+        }
+        bool received[LEAK_SENSOR_MAX_PROBES] = { false };
+
+        // Consume every reading in order so no transition is skipped
+        while (sensor_channel_pop(&sensor_channel, &record)) {
+            if (record.probe >= probe_count) {
+                continue;
+            }
+            probe_publisher_t *pub = &publishers[record.probe];
+            received[record.probe] = true;
+            pub->latest = record;
+            pub->have_latest = true;
+#if TELEMETRY_BATCHING
+            telemetry_sample_t sample = {
+                .timestamp_ms = record.timestamp_us / 1000,
+                .voltage_mv = record.voltage_mv,
+                .state = (uint8_t)record.state,
+                .flags = (record.state == TANK_STATE_FULL ? PAYLOAD_FLAG_FULL_TANK : 0) |
+                         (record.state == TANK_STATE_LEAKING ? PAYLOAD_FLAG_LEAK : 0) |
+                         (record.state == TANK_STATE_FLUSHING ? PAYLOAD_FLAG_FLUSH : 0),
+            };
+            telemetry_batch_add(&pub->batch, &sample, (uint32_t)(record.timestamp_us / 1000));
+#endif
+#if TANK_ANALYTICS
+            tank_analytics_update(&pub->analytics, record.state, record.voltage_mv,
+                                  (uint32_t)(record.timestamp_us / 1000), hour_of_day(record.timestamp_us / 1000));
+#endif
+#if REPORT_BY_EXCEPTION
+            uint32_t record_ms = (uint32_t)(record.timestamp_us / 1000);
+            report_reason_t reason = report_policy_evaluate(&pub->policy, record.state, record.voltage_mv,
+                                                            probe_events(record.probe) != 0, record_ms);
+            // A failed publish is not a report: the next reading is evaluated against the last one delivered
+            if (reason != REPORT_NONE && publish_snapshot(&record)) {
+                report_policy_commit(&pub->policy, reason, record.state, record.voltage_mv, record_ms);
+                EVENT_LOG(LOG_EVENT_REPORTED, LOG_STR(pub->topic), LOG_STR(leak_classifier_state_name(record.state)),
+                          LOG_STR(report_reason_name(reason)));
+            }
+#endif
         }
-        leak_detected = false;
-        flush_detected = false;
+
+        for (int p = 0; p < probe_count; p++) {
+            probe_publisher_t *pub = &publishers[p];
+#if REPORT_BY_EXCEPTION
+            // No fresh readings: still honour the heartbeat with the last known state
+            if (!received[p] && pub->have_latest) {
+                uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+                report_reason_t reason = report_policy_evaluate(&pub->policy, pub->latest.state,
+                                                                pub->latest.voltage_mv, probe_events(p) != 0, now_ms);
+                if (reason != REPORT_NONE && publish_snapshot(&pub->latest)) {
+                    report_policy_commit(&pub->policy, reason, pub->latest.state, pub->latest.voltage_mv, now_ms);
+                }
+            }
+            if (received[p]) {
+                EVENT_LOG(LOG_EVENT_REPORT_STATS, LOG_STR(pub->topic), LOG_UINT(pub->policy.stats.published_transition),
+                          LOG_UINT(pub->policy.stats.published_deadband),
+                          LOG_UINT(pub->policy.stats.published_heartbeat), LOG_UINT(pub->policy.stats.suppressed));
+            }
+#else
+            (void)received;
+            if (pub->have_latest) {
+                publish_snapshot(&pub->latest);
+            }
+#endif
+
+#if TELEMETRY_BATCHING
+            flush_telemetry_batch(pub, (uint32_t)(esp_timer_get_time() / 1000), config.batch_ms);
+#endif
+#if TANK_ANALYTICS
+            publish_analytics(pub, (uint32_t)(esp_timer_get_time() / 1000));
+#endif
+        }
+#if RUNTIME_METRICS
+        publish_metrics((uint32_t)(esp_timer_get_time() / 1000), config.diag_ms);
+#endif
+
+#if !REPORT_BY_EXCEPTION
         // Wait before next publish
-        vTaskDelay(pdMS_TO_TICKS(MQTT_PUBLISH_INTERVAL_MS));
+        vTaskDelay(pdMS_TO_TICKS(config.publish_ms));
+#endif
+    }
+}
+
+// Encode one reading with the latched events and schedule it: state changes and events as a retained
+// alarm, anything else as coalescable telemetry. Events are acknowledged (cleared) only once the
+// message has been accepted by the scheduler.
+static bool publish_snapshot(const sensor_record_t *record)
+{
+    uint8_t mqtt_message[PAYLOAD_MAX_LEN];
+    char cbor_topic[sizeof(publishers[0].topic) + sizeof(PAYLOAD_CBOR_SUBTOPIC)];
+    probe_publisher_t *pub = &publishers[record->probe];
+    uint32_t events = probe_events(record->probe);
+
+    // Encode with the active codec into the stack buffer (no heap use)
+    payload_fields_t fields = {
+        .voltage_mv = record->voltage_mv,
+        .state = record->state,
+        .full_tank = (record->state == TANK_STATE_FULL),
+        .leak_detected = (events & SENSOR_EVENT_LEAK) != 0,
+        .flush_detected = (events & SENSOR_EVENT_FLUSH) != 0,
+    };
+    payload_codec_t codec = payload_codec_get();
+    int payload_len = payload_encode(codec, &fields, mqtt_message, sizeof(mqtt_message));
+    snprintf(cbor_topic, sizeof(cbor_topic), "%s%s", pub->topic, PAYLOAD_CBOR_SUBTOPIC);
+    const char *topic = (codec == PAYLOAD_CODEC_CBOR) ? cbor_topic : pub->topic;
+
+    if (payload_len < 0) {
+        ESP_LOGE(TAG, "Payload does not fit in %d bytes", (int)sizeof(mqtt_message));
+        return false;
+    }
+    bool alarm = events != 0 || !pub->have_alarm || record->state != pub->alarm_state;
+    if (mqtt_submit(alarm ? PUBLISH_ALARM : PUBLISH_TELEMETRY, topic, (const char *)mqtt_message, payload_len) < 0) {
+        EVENT_LOG(LOG_EVENT_SNAPSHOT_FAILED, LOG_UINT(events));
+        return false;
+    }
+    if (alarm) {
+        pub->have_alarm = true;
+        pub->alarm_state = record->state;
+    }
+    sensor_channel_ack(&sensor_channel, events << SENSOR_EVENT_SHIFT(record->probe));
+    // The CBOR topic is a stack buffer, so the record points at the probe's topic
+    EVENT_LOG(LOG_EVENT_SNAPSHOT_SCHEDULED, LOG_INT(payload_len), LOG_STR(payload_codec_name(codec)),
+              LOG_STR(alarm ? "alarm" : "telemetry"), LOG_STR(pub->topic));
+    return true;
+}
+
+#if TELEMETRY_BATCHING || TANK_ANALYTICS
+// Wall clock minus monotonic time in ms, or 0 while SNTP has not set the clock
+static int64_t epoch_offset_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < 1700000000) {
+        return 0;
+    }
+    int64_t wall_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    return wall_ms - esp_timer_get_time() / 1000;
+}
+#endif
+
+#if TELEMETRY_BATCHING
+// Publish a probe's reading history as one delta-encoded message once it is full or its deadline passed
+static void flush_telemetry_batch(probe_publisher_t *pub, uint32_t now_ms, uint32_t deadline_ms)
+{
+    static uint8_t batch_message[TELEMETRY_BATCH_MAX_ENCODED];
+    char topic[sizeof(pub->topic) + sizeof(TELEMETRY_BATCH_SUBTOPIC)];
+
+    if (!telemetry_batch_due(&pub->batch, now_ms, deadline_ms)) {
+        return;
+    }
+    int batch_count = pub->batch.count;
+    int batch_len = telemetry_batch_encode(&pub->batch, epoch_offset_ms(), batch_message, sizeof(batch_message));
+    telemetry_batch_clear(&pub->batch);
+
+    if (batch_len > 0) {
+        snprintf(topic, sizeof(topic), "%s%s", pub->topic, TELEMETRY_BATCH_SUBTOPIC);
+        mqtt_publish(topic, (const char *)batch_message, batch_len, 1, 0);
+        ESP_LOGI(TAG, "Published batch of %d readings in %d bytes to %s", batch_count, batch_len, topic);
+    }
+}
+#endif
+
+#if RUNTIME_METRICS
+#if POWER_MANAGEMENT
+static int32_t permille(uint64_t part_us, uint64_t total_us)
+{
+    return (int32_t)(part_us * 1000 / total_us);
+}
+
+// Per-mode residency since the last diagnostics message, with the average current it implies
+static void publish_power_residency(void)
+{
+    static power_residency_t mark;
+    power_residency_t power;
+    power_mgmt_interval(&mark, &power);
+    if (power.total_us == 0) {
+        return;
+    }
+    uint64_t awake_us = power.sleep_us + power.active_us;
+    uint64_t idle_us = power.total_us > awake_us ? power.total_us - awake_us : 0;
+    uint32_t average_ua = power_mgmt_average_ua(&power);
+    metrics_set(METRIC_PM_SLEEP, permille(power.sleep_us, power.total_us));
+    metrics_set(METRIC_PM_ACTIVE, permille(power.active_us, power.total_us));
+    metrics_set(METRIC_PM_AVG_UA, (int32_t)average_ua);
+    ESP_LOGI(TAG, "Power over %lu s: sleep %ld, idle %ld, adc %ld, net %ld per mille (%lu light sleeps), ~%lu uA",
+             (unsigned long)(power.total_us / 1000000), (long)permille(power.sleep_us, power.total_us),
+             (long)permille(idle_us, power.total_us), (long)permille(power.lock_us[POWER_LOCK_ADC], power.total_us),
+             (long)permille(power.lock_us[POWER_LOCK_NET], power.total_us), (unsigned long)power.sleeps,
+             (unsigned long)average_ua);
+}
+#endif
+
+// Sample heap and stack watermarks, then publish the metrics registry to the diagnostics topic
+static void publish_metrics(uint32_t now_ms, uint32_t interval_ms)
+{
+    static char message[METRICS_MAX_ENCODED];
+    static uint32_t last_ms = 0;
+
+    if (now_ms - last_ms < interval_ms) {
+        return;
+    }
+    last_ms = now_ms;
+    metrics_set(METRIC_HEAP_FREE, (int32_t)esp_get_free_heap_size());
+    metrics_set(METRIC_HEAP_MIN_FREE, (int32_t)esp_get_minimum_free_heap_size());
+    metrics_set(METRIC_HEAP_LARGEST_BLOCK, (int32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    metrics_set(METRIC_STACK_SENSOR, (int32_t)uxTaskGetStackHighWaterMark(sensor_task_handle));
+    metrics_set(METRIC_STACK_PUBLISHER, (int32_t)uxTaskGetStackHighWaterMark(NULL));
+    metrics_set(METRIC_STACK_LOG, event_log_stack_free());
+    metrics_set(METRIC_SENSOR_OVERRUNS, (int32_t)atomic_load(&sensor_channel.overruns));
+    mqtt_sample_metrics();
+#if POWER_MANAGEMENT
+    publish_power_residency();
+#endif
+
+    // A task this close to its stack limit needs a larger peak in mem_profile.h before it overflows in the field
+    static const struct {
+        metric_gauge_t gauge;
+        const char *task;
+    } stacks[] = {
+        { METRIC_STACK_SENSOR, "sensor_monitor" },
+        { METRIC_STACK_PUBLISHER, "mqtt_publisher" },
+        { METRIC_STACK_OUTBOX, "mqtt_dispatch" },
+        { METRIC_STACK_LOG, "log_console" },
+        { METRIC_STACK_MQTT, "mqtt_task" },
+    };
+    for (size_t i = 0; i < sizeof(stacks) / sizeof(stacks[0]); i++) {
+        int32_t free_bytes = metrics_gauge(stacks[i].gauge);
+        if (free_bytes > 0 && free_bytes < TASK_STACK_LOW_WATER) {
+            ESP_LOGW(TAG, "Task %s has only %ld bytes of stack left", stacks[i].task, (long)free_bytes);
+        }
+    }
+
+    int len = metrics_encode(now_ms / 1000, message, sizeof(message));
+    if (len < 0) {
+        ESP_LOGE(TAG, "Metrics do not fit in %d bytes", (int)sizeof(message));
+        return;
+    }
+    // Diagnostics are best effort: QoS 0, never worth a slot in the flash outbox
+    if (mqtt_wait_connected(0)) {
+        mqtt_publish(MQTT_TOPIC METRICS_SUBTOPIC, message, len, 0, 0);
+    }
+    ESP_LOGI(TAG, "Metrics: %s", message);
+}
+#endif
+
+#if TANK_ANALYTICS
+// Local hour of a monotonic timestamp, or -1 until SNTP has set the clock
+static int hour_of_day(int64_t timestamp_ms)
+{
+    int64_t offset_ms = epoch_offset_ms();
+    if (offset_ms == 0) {
+        return -1;
+    }
+    time_t wall = (time_t)((timestamp_ms + offset_ms) / 1000);
+    struct tm local;
+    localtime_r(&wall, &local);
+    return local.tm_hour;
+}
+
+// Publish a probe's refill-cycle summary once per window, then start the next window
+static void publish_analytics(probe_publisher_t *pub, uint32_t now_ms)
+{
+    static char summary[TANK_ANALYTICS_MAX_ENCODED];
+    char topic[sizeof(pub->topic) + sizeof(TANK_ANALYTICS_SUBTOPIC)];
+
+    if (!tank_analytics_due(&pub->analytics, now_ms)) {
+        return;
+    }
+    int len = tank_analytics_encode(&pub->analytics, now_ms, summary, sizeof(summary));
+    tank_analytics_next_window(&pub->analytics, now_ms);
+
+    if (len > 0) {
+        snprintf(topic, sizeof(topic), "%s%s", pub->topic, TANK_ANALYTICS_SUBTOPIC);
+        mqtt_publish(topic, summary, len, 1, 0);
+        ESP_LOGI(TAG, "Published %d byte analytics summary to %s", len, topic);
+    } else {
+        ESP_LOGE(TAG, "Analytics summary does not fit in %d bytes", (int)sizeof(summary));
+    }
+}
+#endif
+
+#if DUTY_CYCLE_MODE
+// One wake of the duty cycle: sample, classify, optionally upload the history, sleep
+static void duty_cycle_run(void)
+{
+    duty_cycle_config_t cfg;
+    duty_cycle_default_config(&cfg);
+    leak_classifier_config_t classifier_cfg;
+    duty_cycle_classifier_config(&classifier_cfg, &cfg);
+    // Updates received during an uplink are saved to NVS and applied to the retained classifier from the next wake
+    device_config_t config;
+    device_config_get(&config);
+    classifier_cfg.leak_threshold_mv = config.leak_mv[0];
+    classifier_cfg.flush_threshold_mv = config.flush_mv[0];
+    if (!duty_cycle_resume(&duty_state, &classifier_cfg)) {
+        ESP_LOGI(TAG, "Duty cycle: cold boot, history reset");
+    }
+
+    // A continuous-mode read averages one DMA frame, a oneshot read is a single conversion
+    liquid_level_sensor_init();
+    boot_timeline_mark(BOOT_PHASE_SENSOR_READY);
+    int voltage = liquid_level_sensor_read();
+    boot_timeline_mark(BOOT_PHASE_FIRST_SAMPLE);
+
+    int64_t now_ms = duty_cycle_now_ms(&duty_state, (uint32_t)(esp_timer_get_time() / 1000));
+    duty_action_t action = duty_cycle_step(&duty_state, &cfg, now_ms, voltage);
+    ESP_LOGI(TAG, "Wake %lu: %d mV, %s, %u readings held, %s",
+             (unsigned long)duty_state.stats.wakes, voltage, leak_classifier_state_name(duty_state.last_state),
+             (unsigned)duty_state.history.count, duty_action_name(action));
+
+    if (action != DUTY_SLEEP) {
+        int64_t radio_start_us = esp_timer_get_time();
+        bool ok = duty_cycle_uplink(action);
+        uint32_t radio_ms = (uint32_t)((esp_timer_get_time() - radio_start_us) / 1000);
+        duty_cycle_uplink_result(&duty_state, duty_cycle_now_ms(&duty_state, (uint32_t)(esp_timer_get_time() / 1000)),
+                                 ok, radio_ms);
+        ESP_LOGI(TAG, "Uplink %s after %lu ms", ok ? "done" : "failed", (unsigned long)radio_ms);
     }
+
+    uint32_t sleep_ms = duty_cycle_sleep_ms(&duty_state, &cfg, (uint32_t)(esp_timer_get_time() / 1000));
+    ESP_LOGI(TAG, "Sleeping %lu ms (radio on %llu of %llu ms awake so far)", (unsigned long)sleep_ms,
+             (unsigned long long)duty_state.stats.radio_ms, (unsigned long long)duty_state.stats.awake_ms);
+    ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup((uint64_t)sleep_ms * 1000));
+    // The ring lives in ordinary RAM and does not survive the sleep
+    event_log_flush();
+    esp_deep_sleep_start();
+}
+
+// Bring the radio up, publish the current state and the history since the last upload, wait for acks
+static bool duty_cycle_uplink(duty_action_t action)
+{
+    static uint8_t batch_message[TELEMETRY_BATCH_MAX_ENCODED];
+    uint8_t mqtt_message[PAYLOAD_MAX_LEN];
+
+    wifi_init();
+    // Nothing to connect to until provisioned, and no sleep/wake cycle is short enough to provision in: stay
+    // awake with the provisioning service up. A cold boot always uplinks on its first wake, so this is reached.
+    if (wifi_provisioning()) {
+        ESP_LOGW(TAG, "Duty cycle: no Wi-Fi credentials, waiting for provisioning");
+        wifi_wait_connected(portMAX_DELAY);
+    }
+    if (!wifi_wait_connected(pdMS_TO_TICKS(DUTY_CONNECT_TIMEOUT_MS))) {
+        return false;
+    }
+
+    // The RTC clock drifts across sleeps; re-anchor the history to wall time on every uplink
+    esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
+    esp_netif_sntp_init(&sntp_config);
+
+    mqtt_init();
+    mqtt_start();
+    if (!mqtt_wait_connected(pdMS_TO_TICKS(DUTY_CONNECT_TIMEOUT_MS))) {
+        return false;
+    }
+    // This wake's timeline completes only after its PUBACKs; report the previous uplink's instead
+    char boot_record[BOOT_TIMELINE_MAX_ENCODED];
+    int boot_len = boot_timeline_encode(true, boot_record, sizeof(boot_record));
+    if (boot_len > 0) {
+        mqtt_publish(MQTT_TOPIC BOOT_TIMELINE_SUBTOPIC, boot_record, boot_len, 1, 0);
+    }
+    if (esp_netif_sntp_sync_wait(pdMS_TO_TICKS(DUTY_SNTP_TIMEOUT_MS)) == ESP_OK) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        int64_t wall_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+        duty_state.epoch_offset_ms = wall_ms - duty_cycle_now_ms(&duty_state, (uint32_t)(esp_timer_get_time() / 1000));
+    }
+
+    tank_state_t state = duty_state.last_state;
+    payload_fields_t fields = {
+        .voltage_mv = leak_classifier_voltage(&duty_state.classifier),
+        .state = state,
+        .full_tank = (state == TANK_STATE_FULL),
+        .leak_detected = (action == DUTY_UPLINK_ALARM),
+        .flush_detected = (state == TANK_STATE_FLUSHING),
+    };
+    payload_codec_t codec = payload_codec_get();
+    int payload_len = payload_encode(codec, &fields, mqtt_message, sizeof(mqtt_message));
+    const char *topic = (codec == PAYLOAD_CODEC_CBOR) ? MQTT_TOPIC PAYLOAD_CBOR_SUBTOPIC : MQTT_TOPIC;
+    // Retained like the continuous-mode alarms, and sent ahead of the history batch
+    if (payload_len < 0 || mqtt_publish(topic, (const char *)mqtt_message, payload_len, 1, 1) < 0) {
+        return false;
+    }
+
+    int batch_len = telemetry_batch_encode(&duty_state.history, duty_state.epoch_offset_ms,
+                                           batch_message, sizeof(batch_message));
+    if (batch_len > 0 &&
+        mqtt_publish(MQTT_TOPIC TELEMETRY_BATCH_SUBTOPIC, (const char *)batch_message, batch_len, 1, 0) < 0) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Uploaded %u readings in %d bytes (%s)", (unsigned)duty_state.history.count, batch_len,
+             duty_action_name(action));
+
+    // Sleeping with messages in flight would lose them
+    return mqtt_wait_sent(pdMS_TO_TICKS(DUTY_SEND_TIMEOUT_MS));
 }
+#endif
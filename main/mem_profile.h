@@ -0,0 +1,61 @@
+#ifndef MEM_PROFILE_H
+#define MEM_PROFILE_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+// Memory budget for the application's own tasks and kernel objects. With the static profile every task stack,
+// TCB, mutex and event group lives in .bss, so it shows up in the footprint report (idf.py footprint) instead
+// of being carved out of the heap at boot, and the Wi-Fi driver keeps fewer preallocated buffers.
+#ifndef STATIC_MEMORY_PROFILE
+#define STATIC_MEMORY_PROFILE 1     // 0: heap-allocate tasks and kernel objects, stock Wi-Fi buffer counts
+#endif
+
+// Task stacks stay at the sizes the tasks have shipped with until the stk_* high-water gauges in the diagnostics
+// message (bytes never touched since the task started) have been read on hardware under a full workload: TLS
+// handshakes, remote config and log uploads included. Only then lower one, leaving TASK_STACK_LOW_WATER spare,
+// with the measured gauge cited next to it. publish_metrics() warns when a gauge drops below that.
+// The esp-mqtt client task keeps CONFIG_MQTT_TASK_STACK_SIZE.
+#define TASK_STACK_LOW_WATER 256
+
+#define SENSOR_TASK_STACK 4096
+#define PUBLISHER_TASK_STACK 4096
+#define DISPATCH_TASK_STACK 3072
+#define LOG_CONSOLE_TASK_STACK 3072
+
+// Wi-Fi driver buffers for one station exchanging small MQTT packets. Each static RX buffer is ~1.6 KB of heap
+// held from esp_wifi_init(); the dynamic counts are ceilings, allocated only under load.
+#define WIFI_STATIC_RX_BUFFERS 4
+#define WIFI_DYNAMIC_RX_BUFFERS 8
+#define WIFI_DYNAMIC_TX_BUFFERS 8
+#define WIFI_RX_BA_WINDOW 4                 // Block-ack window, no larger than the static RX buffers allow
+
+// Creation helpers: each call site gets its own static storage, so use each once per boot (init functions).
+// Handles are written through the last argument in both profiles.
+#if STATIC_MEMORY_PROFILE
+#define MEM_TASK_CREATE(fn, name, stack, prio, handle)                                             \
+    do {                                                                                          \
+        static StackType_t task_stack_[(stack) / sizeof(StackType_t)];                            \
+        static StaticTask_t task_tcb_;                                                            \
+        *(handle) = xTaskCreateStatic((fn), (name), (stack), NULL, (prio), task_stack_, &task_tcb_); \
+    } while (0)
+#define MEM_MUTEX_CREATE(handle)                                                                   \
+    do {                                                                                          \
+        static StaticSemaphore_t mutex_buf_;                                                      \
+        *(handle) = xSemaphoreCreateMutexStatic(&mutex_buf_);                                     \
+    } while (0)
+#define MEM_EVENT_GROUP_CREATE(handle)                                                             \
+    do {                                                                                          \
+        static StaticEventGroup_t group_buf_;                                                     \
+        *(handle) = xEventGroupCreateStatic(&group_buf_);                                         \
+    } while (0)
+#else
+#define MEM_TASK_CREATE(fn, name, stack, prio, handle) \
+    xTaskCreate((fn), (name), (stack), NULL, (prio), (handle))
+#define MEM_MUTEX_CREATE(handle) (*(handle) = xSemaphoreCreateMutex())
+#define MEM_EVENT_GROUP_CREATE(handle) (*(handle) = xEventGroupCreate())
+#endif
+
+#endif // MEM_PROFILE_H
@@ -0,0 +1,147 @@
+#include "metrics.h"
+
+#include <stdio.h>
+
+static const char *const counter_names[METRIC_COUNTER_COUNT] = {
+    [METRIC_MQTT_PUBLISHED] = "pub",
+    [METRIC_MQTT_PUBLISH_FAILED] = "pub_fail",
+    [METRIC_MQTT_ACKED] = "ack",
+    [METRIC_MQTT_ACK_UNMATCHED] = "ack_lost",
+    [METRIC_MQTT_RECONNECTS] = "mqtt_reconn",
+    [METRIC_WIFI_RECONNECTS] = "wifi_reconn",
+    [METRIC_MQTT_TX_BYTES] = "tx_b",
+    [METRIC_MQTT_RX_BYTES] = "rx_b",
+    [METRIC_ALARMS_DROPPED] = "alarm_drop",
+};
+
+static const char *const hist_names[METRIC_HIST_COUNT] = {
+    [METRIC_PUBACK_QOS1_MS] = "ack1_ms",
+    [METRIC_PUBACK_QOS2_MS] = "ack2_ms",
+    [METRIC_SENSOR_JITTER_US] = "jitter_us",
+    [METRIC_ADC_READ_US] = "adc_us",
+    [METRIC_WIFI_RECONNECT_MS] = "wifi_reconn_ms",
+    [METRIC_MQTT_RECONNECT_MS] = "mqtt_reconn_ms",
+    [METRIC_TLS_FULL_MS] = "tls_full_ms",
+    [METRIC_TLS_RESUME_MS] = "tls_resume_ms",
+    [METRIC_ALARM_QUEUED_MS] = "alarm_ms",
+};
+
+static const char *const gauge_names[METRIC_GAUGE_COUNT] = {
+    [METRIC_HEAP_FREE] = "heap",
+    [METRIC_HEAP_MIN_FREE] = "heap_min",
+    [METRIC_HEAP_LARGEST_BLOCK] = "heap_blk",
+    [METRIC_STACK_SENSOR] = "stk_sensor",
+    [METRIC_STACK_PUBLISHER] = "stk_pub",
+    [METRIC_STACK_OUTBOX] = "stk_outbox",
+    [METRIC_STACK_LOG] = "stk_log",
+    [METRIC_STACK_MQTT] = "stk_mqtt",
+    [METRIC_SENSOR_OVERRUNS] = "overruns",
+    [METRIC_OUTBOX_PENDING] = "outbox",
+    [METRIC_PM_SLEEP] = "pm_sleep",
+    [METRIC_PM_ACTIVE] = "pm_active",
+    [METRIC_PM_AVG_UA] = "pm_ua",
+};
+
+static atomic_uint_fast32_t counters[METRIC_COUNTER_COUNT];
+static metric_histogram_t histograms[METRIC_HIST_COUNT];
+static atomic_int_fast32_t gauges[METRIC_GAUGE_COUNT];
+
+void metrics_inc(metric_counter_t id)
+{
+    atomic_fetch_add_explicit(&counters[id], 1, memory_order_relaxed);
+}
+
+void metrics_add(metric_counter_t id, uint32_t n)
+{
+    atomic_fetch_add_explicit(&counters[id], n, memory_order_relaxed);
+}
+
+uint32_t metrics_counter(metric_counter_t id)
+{
+    return (uint32_t)atomic_load_explicit(&counters[id], memory_order_relaxed);
+}
+
+static int bucket_of(uint32_t value)
+{
+    if (value == 0) {
+        return 0;
+    }
+    int bucket = 32 - __builtin_clz(value);
+    return bucket < METRICS_HIST_BUCKETS ? bucket : METRICS_HIST_BUCKETS - 1;
+}
+
+void metrics_observe(metric_hist_t id, uint32_t value)
+{
+    metric_histogram_t *h = &histograms[id];
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(value)], 1, memory_order_relaxed);
+    uint_fast32_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&h->max, &max, value, memory_order_relaxed,
+                                                                  memory_order_relaxed)) {
+    }
+}
+
+void metrics_set(metric_gauge_t id, int32_t value)
+{
+    atomic_store_explicit(&gauges[id], value, memory_order_relaxed);
+}
+
+int32_t metrics_gauge(metric_gauge_t id)
+{
+    return (int32_t)atomic_load_explicit(&gauges[id], memory_order_relaxed);
+}
+
+#define APPEND(...)                                                         \
+    do {                                                                    \
+        if (len < 0 || (size_t)len >= buf_len) {                            \
+            return -1;                                                      \
+        }                                                                   \
+        len += snprintf(buf + len, buf_len - len, __VA_ARGS__);             \
+    } while (0)
+
+int metrics_encode(uint32_t uptime_s, char *buf, size_t buf_len)
+{
+    int len = 0;
+    APPEND("{\"up_s\":%lu,\"c\":{", (unsigned long)uptime_s);
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        APPEND("%s\"%s\":%lu", i ? "," : "", counter_names[i], (unsigned long)metrics_counter((metric_counter_t)i));
+    }
+    APPEND("},\"g\":{");
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+        APPEND("%s\"%s\":%ld", i ? "," : "", gauge_names[i],
+               (long)atomic_load_explicit(&gauges[i], memory_order_relaxed));
+    }
+    APPEND("},\"h\":{");
+    bool first = true;
+    for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+        metric_histogram_t *h = &histograms[i];
+        // Take and clear each field; an update racing with this lands in this window or the next
+        uint32_t count = (uint32_t)atomic_exchange_explicit(&h->count, 0, memory_order_relaxed);
+        uint32_t sum = (uint32_t)atomic_exchange_explicit(&h->sum, 0, memory_order_relaxed);
+        uint32_t max = (uint32_t)atomic_exchange_explicit(&h->max, 0, memory_order_relaxed);
+        uint32_t buckets[METRICS_HIST_BUCKETS];
+        int used = 0;
+        for (int b = 0; b < METRICS_HIST_BUCKETS; b++) {
+            buckets[b] = (uint32_t)atomic_exchange_explicit(&h->buckets[b], 0, memory_order_relaxed);
+            if (buckets[b] != 0) {
+                used = b + 1;
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+        APPEND("%s\"%s\":{\"n\":%lu,\"avg\":%lu,\"max\":%lu,\"b\":[", first ? "" : ",", hist_names[i],
+               (unsigned long)count, (unsigned long)(sum / count), (unsigned long)max);
+        for (int b = 0; b < used; b++) {
+            APPEND(b ? ",%lu" : "%lu", (unsigned long)buckets[b]);
+        }
+        APPEND("]}");
+        first = false;
+    }
+    APPEND("}}");
+    if (len < 0 || (size_t)len >= buf_len) {
+        return -1;
+    }
+    return len;
+}
@@ -0,0 +1,91 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Runtime metrics registry: lock-free counters, gauges and log2 histograms that any task or
+// event handler can update, published periodically as one compact JSON diagnostics message
+#ifndef RUNTIME_METRICS
+#define RUNTIME_METRICS 1
+#endif
+
+#define METRICS_PUBLISH_INTERVAL_MS 300000
+#define METRICS_SUBTOPIC "/diag"
+#define METRICS_HIST_BUCKETS 16     // Bucket 0 holds 0, bucket i holds [2^(i-1), 2^i), the last one everything above
+
+// Monotonic since boot
+typedef enum {
+    METRIC_MQTT_PUBLISHED,          // Handed to the MQTT client
+    METRIC_MQTT_PUBLISH_FAILED,
+    METRIC_MQTT_ACKED,              // PUBACK/PUBCOMP matched to its publish
+    METRIC_MQTT_ACK_UNMATCHED,      // Ack for a msg_id that was no longer tracked
+    METRIC_MQTT_RECONNECTS,
+    METRIC_WIFI_RECONNECTS,
+    METRIC_MQTT_TX_BYTES,           // Broker connection bytes written, TLS record overhead included
+    METRIC_MQTT_RX_BYTES,           // Decrypted bytes read from the broker connection
+    METRIC_ALARMS_DROPPED,          // Alarms that could be neither queued nor stored in the flash outbox
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+// Reset after every publish, so each message describes the last interval
+typedef enum {
+    METRIC_PUBACK_QOS1_MS,          // Publish to PUBACK
+    METRIC_PUBACK_QOS2_MS,          // Publish to PUBCOMP
+    METRIC_SENSOR_JITTER_US,        // Sensor loop period error
+    METRIC_ADC_READ_US,             // Frame demultiplex and conversion
+    METRIC_WIFI_RECONNECT_MS,       // Established link lost to IP again
+    METRIC_MQTT_RECONNECT_MS,       // Broker session lost to CONNACK again
+    METRIC_TLS_FULL_MS,             // TCP connect plus full TLS handshake
+    METRIC_TLS_RESUME_MS,           // Same, with a cached session offered
+    METRIC_ALARM_QUEUED_MS,         // Alarm submitted to handed to the client
+    METRIC_HIST_COUNT
+} metric_hist_t;
+
+// Last sampled value
+typedef enum {
+    METRIC_HEAP_FREE,
+    METRIC_HEAP_MIN_FREE,
+    METRIC_HEAP_LARGEST_BLOCK,
+    METRIC_STACK_SENSOR,            // Stack high-water marks: bytes never used since the task started
+    METRIC_STACK_PUBLISHER,
+    METRIC_STACK_OUTBOX,
+    METRIC_STACK_LOG,
+    METRIC_STACK_MQTT,              // esp-mqtt client task, sampled from its event handler
+    METRIC_SENSOR_OVERRUNS,
+    METRIC_OUTBOX_PENDING,
+    METRIC_PM_SLEEP,                // Light-sleep residency over the last interval, per mille
+    METRIC_PM_ACTIVE,               // Residency with an ADC or network PM lock held, per mille
+    METRIC_PM_AVG_UA,               // Average supply current estimated from the residencies
+    METRIC_GAUGE_COUNT
+} metric_gauge_t;
+
+// Worst-case message, every value at its widest and every histogram with all buckets used, so an encode into
+// METRICS_MAX_ENCODED bytes cannot fail and lose the interval's histograms
+#define METRICS_NAME_MAX 14         // Longest metric name in metrics.c
+#define METRICS_VALUE_MAX 11        // "-2147483648"
+#define METRICS_SCALAR_MAX (4 + METRICS_NAME_MAX + METRICS_VALUE_MAX)                 // ,"name":value
+#define METRICS_HIST_MAX (31 + METRICS_NAME_MAX + (3 + METRICS_HIST_BUCKETS) * (METRICS_VALUE_MAX + 1))
+#define METRICS_MAX_ENCODED (32 + METRICS_VALUE_MAX + (METRIC_COUNTER_COUNT + METRIC_GAUGE_COUNT) * METRICS_SCALAR_MAX + \
+                             METRIC_HIST_COUNT * METRICS_HIST_MAX)
+
+typedef struct {
+    atomic_uint_fast32_t count;
+    atomic_uint_fast32_t sum;
+    atomic_uint_fast32_t max;
+    atomic_uint_fast32_t buckets[METRICS_HIST_BUCKETS];
+} metric_histogram_t;
+
+void metrics_inc(metric_counter_t id);
+void metrics_add(metric_counter_t id, uint32_t n);
+uint32_t metrics_counter(metric_counter_t id);
+void metrics_observe(metric_hist_t id, uint32_t value);
+void metrics_set(metric_gauge_t id, int32_t value);
+int32_t metrics_gauge(metric_gauge_t id);
+// JSON snapshot of every metric; histograms are cleared afterwards. Returns the length, or -1 if it does not fit
+// (never with a METRICS_MAX_ENCODED buffer).
+int metrics_encode(uint32_t uptime_s, char *buf, size_t buf_len);
+
+#endif // METRICS_H
@@ -0,0 +1,355 @@
+#include "mqtt_outbox.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mem_profile.h"
+
+static const char *TAG = "MQTT_OUTBOX";
+
+/*
+ * Log layout: the partition is a ring of flash sectors. Records never straddle a sector;
+ * when one does not fit, the writer moves to the next sector and erases it first. Sectors are
+ * only erased when the ring wraps, so every sector sees the same number of erase cycles.
+ * Delivered records are marked in place by programming the state byte from 0xFF to 0x00,
+ * which flash allows without an erase.
+ */
+#define OUTBOX_SECTOR_SIZE 4096
+#define OUTBOX_MAGIC 0x0B0C
+#define OUTBOX_STATE_PENDING 0xFF
+#define OUTBOX_STATE_SENT 0x00
+#define OUTBOX_ALIGN(n) (((n) + 3u) & ~3u)
+#define OUTBOX_QOS_MASK 0x03
+#define OUTBOX_FLAG_RETAIN 0x80
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;         // 0xFFFF = erased, end of records in this sector
+    uint8_t state;
+    uint8_t flags;          // QoS in the low bits, OUTBOX_FLAG_RETAIN; records from before the flag read as plain QoS
+    uint16_t topic_len;
+    uint16_t data_len;
+    uint32_t seq;
+    uint32_t crc;           // CRC32 of topic + data
+} outbox_record_t;
+
+static const esp_partition_t *outbox_part = NULL;
+static SemaphoreHandle_t outbox_mutex = NULL;
+static uint32_t sector_count;
+static uint32_t write_addr;         // Next free byte
+static uint32_t read_addr;          // Oldest record that may still be pending
+static uint32_t next_seq = 1;
+static uint32_t pending;
+static uint32_t pending_retained;
+static mqtt_outbox_stats_t stats;
+static uint8_t scratch[OUTBOX_MAX_TOPIC + OUTBOX_MAX_PAYLOAD];
+
+static uint32_t sector_of(uint32_t addr)
+{
+    return addr / OUTBOX_SECTOR_SIZE;
+}
+
+static uint32_t sector_start(uint32_t sector)
+{
+    return (sector % sector_count) * OUTBOX_SECTOR_SIZE;
+}
+
+static uint32_t record_size(const outbox_record_t *rec)
+{
+    return OUTBOX_ALIGN(sizeof(outbox_record_t) + rec->topic_len + rec->data_len);
+}
+
+// Read the header at addr. Returns false at the end of a sector's records.
+static bool read_header(uint32_t addr, outbox_record_t *rec)
+{
+    uint32_t offset = addr % OUTBOX_SECTOR_SIZE;
+    if (OUTBOX_SECTOR_SIZE - offset < sizeof(outbox_record_t)) {
+        return false;
+    }
+    if (esp_partition_read(outbox_part, addr, rec, sizeof(*rec)) != ESP_OK || rec->magic != OUTBOX_MAGIC) {
+        return false;
+    }
+    return offset + record_size(rec) <= OUTBOX_SECTOR_SIZE;
+}
+
+// Walk the records of one sector, counting pending ones. Returns the first free address in it.
+static uint32_t scan_sector(uint32_t sector, uint32_t *pending_out, uint32_t *retained_out, uint32_t *last_seq)
+{
+    uint32_t addr = sector_start(sector);
+    uint32_t end = addr + OUTBOX_SECTOR_SIZE;
+    outbox_record_t rec;
+    while (addr < end && read_header(addr, &rec)) {
+        if (rec.state == OUTBOX_STATE_PENDING) {
+            (*pending_out)++;
+            if (rec.flags & OUTBOX_FLAG_RETAIN) {
+                (*retained_out)++;
+            }
+        }
+        if (last_seq != NULL) {
+            *last_seq = rec.seq;
+        }
+        addr += record_size(&rec);
+    }
+    return addr;
+}
+
+static bool range_erased(uint32_t addr, uint32_t end)
+{
+    uint8_t buf[64];
+    while (addr < end) {
+        uint32_t n = end - addr < sizeof(buf) ? end - addr : sizeof(buf);
+        if (esp_partition_read(outbox_part, addr, buf, n) != ESP_OK) {
+            return false;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (buf[i] != 0xFF) {
+                return false;
+            }
+        }
+        addr += n;
+    }
+    return true;
+}
+
+// Erase the sector the writer is moving into, dropping any pending records it still holds
+static void advance_write_sector(uint32_t next_sector)
+{
+    uint32_t start = sector_start(next_sector);
+    if (pending > 0 && sector_of(read_addr) == next_sector % sector_count) {
+        uint32_t lost = 0;
+        uint32_t lost_retained = 0;
+        scan_sector(next_sector, &lost, &lost_retained, NULL);
+        pending -= lost;
+        pending_retained -= lost_retained;
+        stats.dropped += lost;
+        read_addr = sector_start(next_sector + 1);
+        ESP_LOGW(TAG, "Outbox full, dropped %lu oldest record(s)", (unsigned long)lost);
+    }
+    ESP_ERROR_CHECK(esp_partition_erase_range(outbox_part, start, OUTBOX_SECTOR_SIZE));
+    write_addr = start;
+    if (pending == 0) {
+        read_addr = write_addr;
+    }
+}
+
+esp_err_t mqtt_outbox_init(void)
+{
+    outbox_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, OUTBOX_PARTITION_LABEL);
+    if (outbox_part == NULL) {
+        ESP_LOGE(TAG, "No \"%s\" partition, outbox disabled", OUTBOX_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    MEM_MUTEX_CREATE(&outbox_mutex);
+    if (outbox_mutex == NULL) {
+        outbox_part = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    sector_count = outbox_part->size / OUTBOX_SECTOR_SIZE;
+
+    //-------------Find the newest sector (head) and the oldest one (tail)---------------//
+    bool found = false;
+    uint32_t head = 0, tail = 0, max_seq = 0, min_seq = UINT32_MAX;
+    for (uint32_t s = 0; s < sector_count; s++) {
+        outbox_record_t rec;
+        if (!read_header(sector_start(s), &rec)) {
+            continue;
+        }
+        found = true;
+        if (rec.seq >= max_seq) {
+            max_seq = rec.seq;
+            head = s;
+        }
+        if (rec.seq < min_seq) {
+            min_seq = rec.seq;
+            tail = s;
+        }
+    }
+
+    pending = 0;
+    pending_retained = 0;
+    if (!found) {
+        write_addr = 0;
+        read_addr = 0;
+        next_seq = 1;
+        if (!range_erased(0, OUTBOX_SECTOR_SIZE)) {
+            ESP_ERROR_CHECK(esp_partition_erase_range(outbox_part, 0, OUTBOX_SECTOR_SIZE));
+        }
+    } else {
+        uint32_t last_seq = max_seq;
+        for (uint32_t i = 0; i < sector_count; i++) {
+            uint32_t s = (tail + i) % sector_count;
+            uint32_t end = scan_sector(s, &pending, &pending_retained, s == head ? &last_seq : NULL);
+            if (s == head) {
+                write_addr = end;
+                break;
+            }
+        }
+        next_seq = last_seq + 1;
+        read_addr = sector_start(tail);
+
+        // A reset during a write can leave a torn record past the last valid header; never write over it
+        if (!range_erased(write_addr, sector_start(head) + OUTBOX_SECTOR_SIZE)) {
+            advance_write_sector(head + 1);
+        }
+    }
+
+    ESP_LOGI(TAG, "Outbox %luKB, %lu pending record(s), %lu retained", (unsigned long)(outbox_part->size / 1024),
+             (unsigned long)pending, (unsigned long)pending_retained);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_outbox_append(const char *topic, const char *data, int len, int qos, int retain)
+{
+    if (outbox_part == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t topic_len = strlen(topic);
+    if (len <= 0) {
+        len = strlen(data);
+    }
+    if (topic_len > OUTBOX_MAX_TOPIC || len > OUTBOX_MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    outbox_record_t rec = {
+        .magic = OUTBOX_MAGIC,
+        .state = OUTBOX_STATE_PENDING,
+        .flags = (uint8_t)((qos & OUTBOX_QOS_MASK) | (retain ? OUTBOX_FLAG_RETAIN : 0)),
+        .topic_len = (uint16_t)topic_len,
+        .data_len = (uint16_t)len,
+    };
+
+    // scratch is shared with peek and every other appending task: only touch it under the mutex
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    memcpy(scratch, topic, topic_len);
+    memcpy(scratch + topic_len, data, len);
+    rec.crc = esp_rom_crc32_le(0, scratch, topic_len + len);
+    uint32_t size = record_size(&rec);
+    if ((write_addr % OUTBOX_SECTOR_SIZE) + size > OUTBOX_SECTOR_SIZE) {
+        advance_write_sector(sector_of(write_addr) + 1);
+    }
+    rec.seq = next_seq++;
+
+    // Body first, header last: a reset in between leaves no valid-looking record behind
+    esp_err_t err = esp_partition_write(outbox_part, write_addr + sizeof(rec), scratch, topic_len + len);
+    if (err == ESP_OK) {
+        err = esp_partition_write(outbox_part, write_addr, &rec, sizeof(rec));
+    }
+    if (err == ESP_OK) {
+        if (pending == 0) {
+            read_addr = write_addr;
+        }
+        write_addr += size;
+        pending++;
+        if (retain) {
+            pending_retained++;
+        }
+        stats.appended++;
+    } else {
+        ESP_LOGE(TAG, "Outbox write failed: %s", esp_err_to_name(err));
+    }
+    xSemaphoreGive(outbox_mutex);
+    return err;
+}
+
+// Move read_addr to the next pending record. Caller holds the mutex.
+static bool seek_pending(outbox_record_t *rec)
+{
+    uint32_t visited = 0;
+    while (pending > 0 && read_addr != write_addr && visited <= sector_count) {
+        if (!read_header(read_addr, rec)) {
+            read_addr = sector_start(sector_of(read_addr) + 1);
+            visited++;
+            continue;
+        }
+        if (rec->state == OUTBOX_STATE_PENDING) {
+            return true;
+        }
+        read_addr += record_size(rec);
+    }
+    return false;
+}
+
+esp_err_t mqtt_outbox_peek(char *topic, size_t topic_size, uint8_t *data, size_t *len, int *qos, int *retain,
+                           uint32_t *seq)
+{
+    if (outbox_part == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    outbox_record_t rec;
+
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    while (seek_pending(&rec)) {
+        uint32_t body_len = rec.topic_len + rec.data_len;
+        err = esp_partition_read(outbox_part, read_addr + sizeof(rec), scratch, body_len);
+        if (err != ESP_OK) {
+            break;
+        }
+        if (esp_rom_crc32_le(0, scratch, body_len) != rec.crc || rec.topic_len >= topic_size || rec.data_len > *len) {
+            // Unreadable record: mark it delivered so it cannot block the queue
+            uint8_t sent = OUTBOX_STATE_SENT;
+            esp_partition_write(outbox_part, read_addr + offsetof(outbox_record_t, state), &sent, 1);
+            read_addr += record_size(&rec);
+            pending--;
+            if (rec.flags & OUTBOX_FLAG_RETAIN) {
+                pending_retained--;
+            }
+            stats.corrupt++;
+            err = ESP_ERR_NOT_FOUND;
+            continue;
+        }
+        memcpy(topic, scratch, rec.topic_len);
+        topic[rec.topic_len] = '\0';
+        memcpy(data, scratch + rec.topic_len, rec.data_len);
+        *len = rec.data_len;
+        *qos = rec.flags & OUTBOX_QOS_MASK;
+        *retain = (rec.flags & OUTBOX_FLAG_RETAIN) != 0;
+        *seq = rec.seq;
+        err = ESP_OK;
+        break;
+    }
+    xSemaphoreGive(outbox_mutex);
+    return err;
+}
+
+esp_err_t mqtt_outbox_pop(uint32_t seq)
+{
+    if (outbox_part == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    outbox_record_t rec;
+
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    // The record may have been dropped by a wrap since it was peeked
+    if (seek_pending(&rec) && rec.seq == seq) {
+        uint8_t sent = OUTBOX_STATE_SENT;
+        err = esp_partition_write(outbox_part, read_addr + offsetof(outbox_record_t, state), &sent, 1);
+        read_addr += record_size(&rec);
+        pending--;
+        if (rec.flags & OUTBOX_FLAG_RETAIN) {
+            pending_retained--;
+        }
+        stats.drained++;
+    }
+    xSemaphoreGive(outbox_mutex);
+    return err;
+}
+
+uint32_t mqtt_outbox_pending(void)
+{
+    return pending;
+}
+
+uint32_t mqtt_outbox_retained(void)
+{
+    return pending_retained;
+}
+
+mqtt_outbox_stats_t mqtt_outbox_get_stats(void)
+{
+    return stats;
+}
@@ -0,0 +1,37 @@
+#ifndef MQTT_OUTBOX_H
+#define MQTT_OUTBOX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// Persistent store-and-forward queue for publishes made while MQTT is disconnected.
+// Records are appended to a circular log on the "outbox" data partition (see partitions.csv).
+
+#define OUTBOX_PARTITION_LABEL "outbox"
+#define OUTBOX_MAX_TOPIC 64
+#define OUTBOX_MAX_PAYLOAD 1088             // Fits a full telemetry batch
+#define OUTBOX_DRAIN_BATCH 8                // Records published per drain round
+#define OUTBOX_DRAIN_INTERVAL_MS 1000       // Pause between drain rounds
+#define OUTBOX_DRAIN_MAX_CLIENT_BYTES 4096  // Stop draining while the client's RAM outbox holds more than this
+
+typedef struct {
+    uint32_t appended;
+    uint32_t drained;
+    uint32_t dropped;       // Pending records erased because the log wrapped
+    uint32_t corrupt;       // Records skipped on CRC mismatch
+} mqtt_outbox_stats_t;
+
+esp_err_t mqtt_outbox_init(void);
+esp_err_t mqtt_outbox_append(const char *topic, const char *data, int len, int qos, int retain);
+// Copy the oldest pending record out. Returns ESP_ERR_NOT_FOUND when the outbox is empty.
+esp_err_t mqtt_outbox_peek(char *topic, size_t topic_size, uint8_t *data, size_t *len, int *qos, int *retain,
+                           uint32_t *seq);
+// Mark the record returned by mqtt_outbox_peek() as delivered
+esp_err_t mqtt_outbox_pop(uint32_t seq);
+uint32_t mqtt_outbox_pending(void);
+// Pending records stored with the retain flag (alarms)
+uint32_t mqtt_outbox_retained(void);
+mqtt_outbox_stats_t mqtt_outbox_get_stats(void);
+
+#endif // MQTT_OUTBOX_H
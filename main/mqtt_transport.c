@@ -0,0 +1,328 @@
+#include "mqtt_transport.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "esp_transport_ws.h"
+#include "lwip/sockets.h"
+#include "mbedtls/ssl.h"
+#include "boot_timeline.h"
+#include "metrics.h"
+#include "power_mgmt.h"
+
+#if MQTT_TLS_SESSION_RESUME && !defined(CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS)
+#error "MQTT_TLS_SESSION_RESUME needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS"
+#endif
+
+static const char *TAG = "MQTT_TRANSPORT";
+
+static const mqtt_transport_profile_t profiles[] = {
+    [MQTT_PROFILE_WSS] = {
+        .name = "wss",
+        .port = 8884,
+        .ws_path = "/mqtt",
+        .keepalive_s = 120,
+        .buffer_size = 1024,
+        .out_buffer_size = 1024,
+    },
+    [MQTT_PROFILE_MQTTS] = {
+        .name = "mqtts",
+        .port = 8883,
+        .ws_path = NULL,
+        // Each PINGREQ costs a TLS record and two TCP segments each way; NAT bindings outlast this
+        .keepalive_s = 240,
+        // Nothing large is ever received; a full outbox record goes out in a single write
+        .buffer_size = 512,
+        .out_buffer_size = 1280,
+    },
+};
+
+typedef struct {
+    esp_tls_t *tls;
+#if MQTT_TLS_SESSION_RESUME
+    esp_tls_client_session_t *session;
+#endif
+    int record_expansion;
+    mqtt_transport_stats_t stats;
+} tls_transport_t;
+
+static tls_transport_t tls_ctx;
+
+#if MQTT_TLS_SESSION_RESUME
+#define SESSION_MAGIC 0x544c5331     // "TLS1"
+
+// Last session, serialized so it survives deep sleep
+typedef struct {
+    uint32_t magic;
+    uint16_t port;                   // Session belongs to this profile's listener
+    uint16_t len;
+    uint8_t data[MQTT_TLS_SESSION_MAX];
+} rtc_session_t;
+
+static RTC_DATA_ATTR rtc_session_t rtc_session;
+
+// esp-tls wraps a bare mbedtls_ssl_session as the only member of esp_tls_client_session_t, which
+// lets a session be rebuilt from RTC memory and released again with esp_tls_free_client_session()
+static esp_tls_client_session_t *session_restore(void)
+{
+    if (rtc_session.magic != SESSION_MAGIC || rtc_session.port != mqtt_transport_profile()->port) {
+        return NULL;
+    }
+    mbedtls_ssl_session *session = calloc(1, sizeof(*session));
+    if (session == NULL) {
+        return NULL;
+    }
+    mbedtls_ssl_session_init(session);
+    if (mbedtls_ssl_session_load(session, rtc_session.data, rtc_session.len) != 0) {
+        mbedtls_ssl_session_free(session);
+        free(session);
+        rtc_session.magic = 0;
+        return NULL;
+    }
+    return (esp_tls_client_session_t *)session;
+}
+
+static void session_save(tls_transport_t *ctx)
+{
+    esp_tls_client_session_t *session = esp_tls_get_client_session(ctx->tls);
+    if (session == NULL) {
+        return;
+    }
+    if (ctx->session != NULL) {
+        esp_tls_free_client_session(ctx->session);
+    }
+    ctx->session = session;
+
+    size_t len = 0;
+    if (mbedtls_ssl_session_save((const mbedtls_ssl_session *)session, rtc_session.data, sizeof(rtc_session.data), &len) == 0) {
+        rtc_session.magic = SESSION_MAGIC;
+        rtc_session.port = mqtt_transport_profile()->port;
+        rtc_session.len = (uint16_t)len;
+    } else {
+        // Still resumable until the next deep sleep or reset
+        rtc_session.magic = 0;
+        ESP_LOGW(TAG, "TLS session does not fit in RTC memory");
+    }
+}
+#endif
+
+static int tls_close(esp_transport_handle_t t)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    if (ctx->tls == NULL) {
+        return 0;
+    }
+    mqtt_transport_stats_t *s = &ctx->stats;
+    ESP_LOGI(TAG, "Connection closed: tx %lu B in %lu records (%lu B with TLS overhead), rx %lu B",
+             (unsigned long)s->tx_bytes, (unsigned long)s->tx_records, (unsigned long)s->tx_wire_bytes,
+             (unsigned long)s->rx_bytes);
+    int ret = esp_tls_conn_destroy(ctx->tls);
+    ctx->tls = NULL;
+    return ret;
+}
+
+static int tls_connect_locked(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    tls_close(t);
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+
+    esp_tls_cfg_t cfg = {
+        .timeout_ms = timeout_ms,
+    };
+#if MQTT_TLS_SESSION_RESUME
+    if (ctx->session == NULL) {
+        ctx->session = session_restore();
+    }
+    cfg.client_session = ctx->session;
+    ctx->stats.session_offered = ctx->session != NULL;
+#endif
+
+    ctx->tls = esp_tls_init();
+    if (ctx->tls == NULL) {
+        return -1;
+    }
+    int64_t start_us = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, (int)strlen(host), port, &cfg, ctx->tls) <= 0) {
+        // An mbedTLS code means the handshake itself failed; DNS, TCP and timeout errors carry none
+        esp_tls_error_handle_t error_handle = NULL;
+        esp_err_t last_error = ESP_FAIL;
+        int tls_code = 0;
+        int tls_flags = 0;
+        if (esp_tls_get_error_handle(ctx->tls, &error_handle) == ESP_OK) {
+            last_error = esp_tls_get_and_clear_last_error(error_handle, &tls_code, &tls_flags);
+        }
+        ESP_LOGE(TAG, "TLS connection to %s:%d failed: %s (mbedTLS -0x%04x)", host, port,
+                 esp_err_to_name(last_error), (unsigned)-tls_code);
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+#if MQTT_TLS_SESSION_RESUME
+        // The broker rejected the handshake, maybe the offered session: do a full handshake next time. A session
+        // is kept across network failures, which say nothing about it.
+        if (tls_code != 0 && ctx->stats.session_offered) {
+            ESP_LOGW(TAG, "Dropping the cached TLS session");
+            if (ctx->session != NULL) {
+                esp_tls_free_client_session(ctx->session);
+                ctx->session = NULL;
+            }
+            rtc_session.magic = 0;
+        }
+#endif
+        return -1;
+    }
+    ctx->stats.handshake_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000);
+    boot_timeline_mark(BOOT_PHASE_TLS_READY);
+#if RUNTIME_METRICS
+    metrics_observe(ctx->stats.session_offered ? METRIC_TLS_RESUME_MS : METRIC_TLS_FULL_MS, ctx->stats.handshake_ms);
+#endif
+    ESP_LOGI(TAG, "%s: TLS up in %lu ms (%s)", mqtt_transport_profile()->name, (unsigned long)ctx->stats.handshake_ms,
+             ctx->stats.session_offered ? "session offered" : "full handshake");
+
+    ctx->record_expansion = mbedtls_ssl_get_record_expansion(esp_tls_get_ssl_context(ctx->tls));
+    if (ctx->record_expansion < 0) {
+        ctx->record_expansion = 0;
+    }
+#if MQTT_TLS_SESSION_RESUME
+    session_save(ctx);
+#endif
+    return 0;
+}
+
+// The handshake is the most CPU-heavy thing the device does: run it at full clock and finish sooner
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    power_lock_acquire(POWER_LOCK_NET);
+    int ret = tls_connect_locked(t, host, port, timeout_ms);
+    power_lock_release(POWER_LOCK_NET);
+    return ret;
+}
+
+static int tls_poll(tls_transport_t *ctx, int timeout_ms, bool write)
+{
+    int fd = -1;
+    if (ctx->tls == NULL || esp_tls_get_conn_sockfd(ctx->tls, &fd) != ESP_OK || fd < 0) {
+        return -1;
+    }
+    fd_set fds;
+    fd_set errs;
+    FD_ZERO(&fds);
+    FD_ZERO(&errs);
+    FD_SET(fd, &fds);
+    FD_SET(fd, &errs);
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    int ret = select(fd + 1, write ? NULL : &fds, write ? &fds : NULL, &errs, timeout_ms < 0 ? NULL : &tv);
+    if (ret > 0 && FD_ISSET(fd, &errs)) {
+        return -1;
+    }
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    // Decrypted bytes already buffered by mbedtls will not show up on the socket
+    if (ctx->tls != NULL && esp_tls_get_bytes_avail(ctx->tls) > 0) {
+        return 1;
+    }
+    return tls_poll(ctx, timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(esp_transport_get_context_data(t), timeout_ms, true);
+}
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_read(t, timeout_ms);
+    if (poll <= 0) {
+        return poll == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    // Only decryption holds the clock up; waiting in poll leaves the chip free to sleep
+    power_lock_acquire(POWER_LOCK_NET);
+    int ret = esp_tls_conn_read(ctx->tls, buffer, len);
+    power_lock_release(POWER_LOCK_NET);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    if (ret < 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    ctx->stats.rx_bytes += ret;
+#if RUNTIME_METRICS
+    metrics_add(METRIC_MQTT_RX_BYTES, ret);
+#endif
+    return ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    tls_transport_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_write(t, timeout_ms);
+    if (poll <= 0) {
+        return poll == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    power_lock_acquire(POWER_LOCK_NET);
+    int ret = esp_tls_conn_write(ctx->tls, buffer, len);
+    power_lock_release(POWER_LOCK_NET);
+    if (ret < 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    ctx->stats.tx_bytes += ret;
+    ctx->stats.tx_records++;
+    ctx->stats.tx_wire_bytes += ret + ctx->record_expansion;
+#if RUNTIME_METRICS
+    metrics_add(METRIC_MQTT_TX_BYTES, ret + ctx->record_expansion);
+#endif
+    return ret;
+}
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    return tls_close(t);
+}
+
+const mqtt_transport_profile_t *mqtt_transport_profile(void)
+{
+    return &profiles[MQTT_TRANSPORT_PROFILE];
+}
+
+esp_transport_handle_t mqtt_transport_create(void)
+{
+    const mqtt_transport_profile_t *profile = mqtt_transport_profile();
+    esp_transport_handle_t tls = esp_transport_init();
+    if (tls == NULL) {
+        return NULL;
+    }
+    esp_transport_set_context_data(tls, &tls_ctx);
+    esp_transport_set_func(tls, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write, tls_destroy);
+    esp_transport_set_default_port(tls, profile->port);
+    if (profile->ws_path == NULL) {
+        return tls;
+    }
+
+    // WebSocket framing on top, so the upgrade request and frame headers are counted too
+    esp_transport_handle_t ws = esp_transport_ws_init(tls);
+    if (ws == NULL) {
+        return NULL;
+    }
+    esp_transport_ws_set_path(ws, profile->ws_path);
+    esp_transport_ws_set_subprotocol(ws, "mqtt");
+    esp_transport_set_default_port(ws, profile->port);
+    return ws;
+}
+
+mqtt_transport_stats_t mqtt_transport_get_stats(void)
+{
+    return tls_ctx.stats;
+}
@@ -0,0 +1,49 @@
+#ifndef MQTT_TRANSPORT_H
+#define MQTT_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_transport.h"
+
+// Broker transport profiles. Both run over the same esp-tls transport, which caches the TLS session
+// for abbreviated reconnect handshakes and counts the bytes each connection puts on the wire.
+#define MQTT_PROFILE_WSS 0          // wss://host:8884/mqtt: TLS + HTTP upgrade + WebSocket framing per packet
+#define MQTT_PROFILE_MQTTS 1        // mqtts://host:8883: MQTT directly over TLS
+
+#ifndef MQTT_TRANSPORT_PROFILE
+#define MQTT_TRANSPORT_PROFILE MQTT_PROFILE_MQTTS
+#endif
+
+// Offer the last TLS session (ticket or session ID) on reconnect. The serialized session is kept in
+// RTC memory, so deep-sleep wakes resume too. Needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS.
+#ifndef MQTT_TLS_SESSION_RESUME
+#define MQTT_TLS_SESSION_RESUME 1
+#endif
+
+#define MQTT_TLS_SESSION_MAX 512    // Serialized session size without the peer certificate
+
+typedef struct {
+    const char *name;
+    uint16_t port;
+    const char *ws_path;            // NULL for raw MQTT over TLS
+    int keepalive_s;
+    int buffer_size;                // esp-mqtt receive buffer
+    int out_buffer_size;            // esp-mqtt send buffer; fits the largest publish in one TLS record
+} mqtt_transport_profile_t;
+
+// Per-connection counters, reset when a new connection is dialed
+typedef struct {
+    uint32_t handshake_ms;          // TCP connect plus TLS handshake
+    bool session_offered;           // A cached session was offered to the broker
+    uint32_t tx_bytes;              // Written into TLS: MQTT packets plus any HTTP/WebSocket framing
+    uint32_t rx_bytes;
+    uint32_t tx_records;
+    uint32_t tx_wire_bytes;         // tx_bytes plus TLS record overhead
+} mqtt_transport_stats_t;
+
+const mqtt_transport_profile_t *mqtt_transport_profile(void);
+// Transport handle for esp_mqtt_client_config_t.network.transport
+esp_transport_handle_t mqtt_transport_create(void);
+mqtt_transport_stats_t mqtt_transport_get_stats(void);
+
+#endif // MQTT_TRANSPORT_H
@@ -0,0 +1,106 @@
+#include "payload_codec.h"
+
+#include <stdio.h>
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NINT 1
+#define CBOR_MAJOR_MAP 5
+
+static payload_codec_t active_codec = PAYLOAD_CODEC_DEFAULT;
+
+int payload_encode_json(const payload_fields_t *fields, uint8_t *buf, size_t buf_len)
+{
+    int len = snprintf((char *)buf, buf_len,
+                       "{\"voltage\":%d,\"state\":\"%s\",\"full_tank\":%s,\"leak_detected\":%s,\"flush_detected\":%s}",
+                       fields->voltage_mv,
+                       leak_classifier_state_name(fields->state),
+                       fields->full_tank ? "true" : "false",
+                       fields->leak_detected ? "true" : "false",
+                       fields->flush_detected ? "true" : "false");
+    if (len < 0 || (size_t)len >= buf_len) {
+        return -1;
+    }
+    return len;
+}
+
+// Write a CBOR head (major type + argument) using the shortest encoding
+static size_t cbor_put_head(uint8_t *p, uint8_t major, uint32_t value)
+{
+    uint8_t mt = (uint8_t)(major << 5);
+    if (value < 24) {
+        p[0] = mt | (uint8_t)value;
+        return 1;
+    }
+    if (value <= 0xFF) {
+        p[0] = mt | 24;
+        p[1] = (uint8_t)value;
+        return 2;
+    }
+    if (value <= 0xFFFF) {
+        p[0] = mt | 25;
+        p[1] = (uint8_t)(value >> 8);
+        p[2] = (uint8_t)value;
+        return 3;
+    }
+    p[0] = mt | 26;
+    p[1] = (uint8_t)(value >> 24);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 8);
+    p[4] = (uint8_t)value;
+    return 5;
+}
+
+static size_t cbor_put_int(uint8_t *p, int32_t value)
+{
+    if (value >= 0) {
+        return cbor_put_head(p, CBOR_MAJOR_UINT, (uint32_t)value);
+    }
+    return cbor_put_head(p, CBOR_MAJOR_NINT, (uint32_t)(-1 - value));
+}
+
+int payload_encode_cbor(const payload_fields_t *fields, uint8_t *buf, size_t buf_len)
+{
+    // Worst case: map head + 3 one-byte keys + 5-byte voltage + 1-byte state + 1-byte flags
+    if (buf_len < 1 + 3 + 5 + 1 + 1) {
+        return -1;
+    }
+
+    uint32_t flags = (fields->full_tank ? PAYLOAD_FLAG_FULL_TANK : 0) |
+                     (fields->leak_detected ? PAYLOAD_FLAG_LEAK : 0) |
+                     (fields->flush_detected ? PAYLOAD_FLAG_FLUSH : 0);
+
+    size_t n = cbor_put_head(buf, CBOR_MAJOR_MAP, 3);
+    n += cbor_put_head(buf + n, CBOR_MAJOR_UINT, PAYLOAD_KEY_VOLTAGE);
+    n += cbor_put_int(buf + n, fields->voltage_mv);
+    n += cbor_put_head(buf + n, CBOR_MAJOR_UINT, PAYLOAD_KEY_STATE);
+    n += cbor_put_head(buf + n, CBOR_MAJOR_UINT, (uint32_t)fields->state);
+    n += cbor_put_head(buf + n, CBOR_MAJOR_UINT, PAYLOAD_KEY_FLAGS);
+    n += cbor_put_head(buf + n, CBOR_MAJOR_UINT, flags);
+    return (int)n;
+}
+
+int payload_encode(payload_codec_t codec, const payload_fields_t *fields, uint8_t *buf, size_t buf_len)
+{
+    switch (codec) {
+    case PAYLOAD_CODEC_CBOR:
+        return payload_encode_cbor(fields, buf, buf_len);
+    case PAYLOAD_CODEC_JSON:
+    default:
+        return payload_encode_json(fields, buf, buf_len);
+    }
+}
+
+void payload_codec_set(payload_codec_t codec)
+{
+    active_codec = codec;
+}
+
+payload_codec_t payload_codec_get(void)
+{
+    return active_codec;
+}
+
+const char *payload_codec_name(payload_codec_t codec)
+{
+    return codec == PAYLOAD_CODEC_CBOR ? "cbor" : "json";
+}
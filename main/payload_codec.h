@@ -0,0 +1,51 @@
+#ifndef PAYLOAD_CODEC_H
+#define PAYLOAD_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "leak_classifier.h"
+
+// Telemetry payload encoders. Both write into a caller-provided buffer and never allocate.
+
+typedef enum {
+    PAYLOAD_CODEC_JSON = 0,     // Text, published on MQTT_TOPIC
+    PAYLOAD_CODEC_CBOR,         // Binary, published on MQTT_TOPIC PAYLOAD_CBOR_SUBTOPIC
+} payload_codec_t;
+
+// Codec used at boot; can be changed at runtime with payload_codec_set()
+#ifndef PAYLOAD_CODEC_DEFAULT
+#define PAYLOAD_CODEC_DEFAULT PAYLOAD_CODEC_JSON
+#endif
+
+#define PAYLOAD_CBOR_SUBTOPIC "/cbor"
+#define PAYLOAD_MAX_LEN 160
+
+// CBOR map keys (small unsigned integers keep each key to one byte)
+#define PAYLOAD_KEY_VOLTAGE 0       // int, mV
+#define PAYLOAD_KEY_STATE 1         // uint, tank_state_t
+#define PAYLOAD_KEY_FLAGS 2         // uint, PAYLOAD_FLAG_* bitmask
+
+#define PAYLOAD_FLAG_FULL_TANK (1u << 0)
+#define PAYLOAD_FLAG_LEAK (1u << 1)
+#define PAYLOAD_FLAG_FLUSH (1u << 2)
+
+typedef struct {
+    int voltage_mv;
+    tank_state_t state;
+    bool full_tank;
+    bool leak_detected;
+    bool flush_detected;
+} payload_fields_t;
+
+// Each encoder returns the number of bytes written, or -1 if the buffer is too small.
+// The JSON encoder also NUL-terminates (the terminator is not counted).
+int payload_encode_json(const payload_fields_t *fields, uint8_t *buf, size_t buf_len);
+int payload_encode_cbor(const payload_fields_t *fields, uint8_t *buf, size_t buf_len);
+int payload_encode(payload_codec_t codec, const payload_fields_t *fields, uint8_t *buf, size_t buf_len);
+
+void payload_codec_set(payload_codec_t codec);
+payload_codec_t payload_codec_get(void);
+const char *payload_codec_name(payload_codec_t codec);
+
+#endif // PAYLOAD_CODEC_H
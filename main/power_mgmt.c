@@ -0,0 +1,166 @@
+#include "power_mgmt.h"
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+
+#if POWER_MANAGEMENT && !defined(CONFIG_PM_ENABLE)
+#error "POWER_MANAGEMENT needs CONFIG_PM_ENABLE"
+#endif
+#if POWER_MANAGEMENT && POWER_LIGHT_SLEEP && !defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE)
+#error "POWER_LIGHT_SLEEP needs CONFIG_FREERTOS_USE_TICKLESS_IDLE"
+#endif
+#if POWER_MANAGEMENT && POWER_LIGHT_SLEEP && !defined(CONFIG_PM_LIGHT_SLEEP_CALLBACKS)
+#error "POWER_LIGHT_SLEEP residency needs CONFIG_PM_LIGHT_SLEEP_CALLBACKS"
+#endif
+
+static const char *TAG = "POWER";
+
+#if POWER_MANAGEMENT
+static esp_pm_lock_handle_t locks[POWER_LOCK_COUNT];
+static const char *const lock_names[POWER_LOCK_COUNT] = {
+    [POWER_LOCK_ADC] = "adc",
+    [POWER_LOCK_NET] = "net",
+};
+static const esp_pm_lock_type_t lock_types[POWER_LOCK_COUNT] = {
+    [POWER_LOCK_ADC] = ESP_PM_APB_FREQ_MAX,
+    [POWER_LOCK_NET] = ESP_PM_CPU_FREQ_MAX,
+};
+#endif
+
+// Accounting shared by the locking tasks and the sleep callbacks, which run with the scheduler stopped
+static portMUX_TYPE residency_lock = portMUX_INITIALIZER_UNLOCKED;
+static power_residency_t residency;
+static int holders[POWER_LOCK_COUNT];
+static int active_holders;
+static int64_t lock_since_us[POWER_LOCK_COUNT];
+static int64_t active_since_us;
+
+#if POWER_MANAGEMENT && POWER_LIGHT_SLEEP
+static int64_t sleep_since_us;
+
+static esp_err_t IRAM_ATTR sleep_enter_cb(int64_t sleep_time_us, void *arg)
+{
+    portENTER_CRITICAL_SAFE(&residency_lock);
+    sleep_since_us = esp_timer_get_time();
+    portEXIT_CRITICAL_SAFE(&residency_lock);
+    return ESP_OK;
+}
+
+// Measured here rather than taken from the callback argument, so aborted sleeps count as what they were
+static esp_err_t IRAM_ATTR sleep_exit_cb(int64_t sleep_time_us, void *arg)
+{
+    portENTER_CRITICAL_SAFE(&residency_lock);
+    if (sleep_since_us != 0) {
+        residency.sleep_us += esp_timer_get_time() - sleep_since_us;
+        residency.sleeps++;
+        sleep_since_us = 0;
+    }
+    portEXIT_CRITICAL_SAFE(&residency_lock);
+    return ESP_OK;
+}
+#endif
+
+void power_mgmt_init(void)
+{
+#if POWER_MANAGEMENT
+    for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+        ESP_ERROR_CHECK(esp_pm_lock_create(lock_types[i], 0, lock_names[i], &locks[i]));
+    }
+#if POWER_LIGHT_SLEEP
+    esp_pm_sleep_cbs_register_config_t cbs = {
+        .enter_cb = sleep_enter_cb,
+        .exit_cb = sleep_exit_cb,
+    };
+    ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&cbs));
+#endif
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = POWER_MAX_FREQ_MHZ,
+        .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+        .light_sleep_enable = POWER_LIGHT_SLEEP,
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+    ESP_LOGI(TAG, "DFS %d-%d MHz, light sleep %s", POWER_MIN_FREQ_MHZ, POWER_MAX_FREQ_MHZ,
+             POWER_LIGHT_SLEEP ? "on" : "off");
+#else
+    ESP_LOGI(TAG, "Power management off, CPU fixed at %d MHz", POWER_MAX_FREQ_MHZ);
+#endif
+}
+
+void power_lock_acquire(power_lock_t lock)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&residency_lock);
+    if (holders[lock]++ == 0) {
+        lock_since_us[lock] = now;
+    }
+    if (active_holders++ == 0) {
+        active_since_us = now;
+    }
+    portEXIT_CRITICAL(&residency_lock);
+#if POWER_MANAGEMENT
+    esp_pm_lock_acquire(locks[lock]);
+#endif
+}
+
+void power_lock_release(power_lock_t lock)
+{
+#if POWER_MANAGEMENT
+    esp_pm_lock_release(locks[lock]);
+#endif
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&residency_lock);
+    if (--holders[lock] == 0) {
+        residency.lock_us[lock] += now - lock_since_us[lock];
+    }
+    if (--active_holders == 0) {
+        residency.active_us += now - active_since_us;
+    }
+    portEXIT_CRITICAL(&residency_lock);
+}
+
+void power_mgmt_interval(power_residency_t *mark, power_residency_t *interval)
+{
+    power_residency_t now;
+    int64_t now_us = esp_timer_get_time();
+    portENTER_CRITICAL(&residency_lock);
+    now = residency;
+    // Locks still held count up to now
+    for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+        if (holders[i] > 0) {
+            now.lock_us[i] += now_us - lock_since_us[i];
+        }
+    }
+    if (active_holders > 0) {
+        now.active_us += now_us - active_since_us;
+    }
+    portEXIT_CRITICAL(&residency_lock);
+    now.total_us = (uint64_t)now_us;
+
+    interval->total_us = now.total_us - mark->total_us;
+    interval->sleep_us = now.sleep_us - mark->sleep_us;
+    interval->active_us = now.active_us - mark->active_us;
+    for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+        interval->lock_us[i] = now.lock_us[i] - mark->lock_us[i];
+    }
+    interval->sleeps = now.sleeps - mark->sleeps;
+    *mark = now;
+}
+
+uint32_t power_mgmt_average_ua(const power_residency_t *interval)
+{
+    if (interval->total_us == 0) {
+        return 0;
+    }
+    // The network lock dominates when both are held; the rest of the active time is ADC work
+    uint64_t net_us = interval->lock_us[POWER_LOCK_NET];
+    uint64_t adc_us = interval->active_us > net_us ? interval->active_us - net_us : 0;
+    uint64_t awake_us = interval->sleep_us + interval->active_us;
+    uint64_t idle_us = interval->total_us > awake_us ? interval->total_us - awake_us : 0;
+    uint64_t charge = interval->sleep_us * POWER_SLEEP_UA + idle_us * POWER_IDLE_UA + adc_us * POWER_ADC_UA +
+                      net_us * POWER_NET_UA;
+    return (uint32_t)(charge / interval->total_us);
+}
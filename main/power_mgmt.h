@@ -0,0 +1,58 @@
+#ifndef POWER_MGMT_H
+#define POWER_MGMT_H
+
+#include <stdint.h>
+
+// Power management: dynamic frequency scaling and automatic light sleep whenever every task is blocked, with
+// application PM locks held only while the ADC is sampling or TLS is working. Residency in each mode is
+// accounted so the diagnostics message can carry an average-current estimate. Needs CONFIG_PM_ENABLE,
+// CONFIG_FREERTOS_USE_TICKLESS_IDLE and CONFIG_PM_LIGHT_SLEEP_CALLBACKS.
+#ifndef POWER_MANAGEMENT
+#define POWER_MANAGEMENT 1
+#endif
+
+#define POWER_MAX_FREQ_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define POWER_MIN_FREQ_MHZ 40           // XTAL: the lowest clock Wi-Fi keeps working at
+#define POWER_LIGHT_SLEEP 1             // 0: DFS only, the CPU idles at POWER_MIN_FREQ_MHZ instead of sleeping
+
+// Wi-Fi modem sleep: the station wakes for every POWER_LISTEN_INTERVAL-th beacon; the AP buffers downlink
+// traffic in between, so inbound commands and PINGRESPs wait up to that long (3 x 102.4 ms by default). The
+// MQTT keepalive stays as the transport profile sets it: esp-mqtt times pings from its own tick, so their phase
+// against the beacons cannot be pinned from here, and a PINGREQ simply wakes the radio to transmit.
+#define POWER_WIFI_PS WIFI_PS_MAX_MODEM
+#define POWER_LISTEN_INTERVAL 3
+
+// Nominal supply current per mode for the estimate. Calibrate once against a metered unit; the residency
+// gauges are what vary from unit to unit.
+#define POWER_SLEEP_UA 800              // Light sleep, Wi-Fi associated
+#define POWER_IDLE_UA 15000             // Awake at the minimum clock, or held up by the Wi-Fi driver
+#define POWER_ADC_UA 30000              // ADC lock: APB at 80 MHz
+#define POWER_NET_UA 110000             // Network lock: CPU at full clock, radio transmitting or receiving
+
+// Application PM locks. Each may be taken from several tasks at once and nests.
+typedef enum {
+    POWER_LOCK_ADC,                     // APB at full clock for the SAR/DMA clocking; no light sleep
+    POWER_LOCK_NET,                     // CPU at full clock for TLS; no light sleep
+    POWER_LOCK_COUNT
+} power_lock_t;
+
+// Time in each mode. Light sleep and the application locks exclude each other; idle is the rest.
+typedef struct {
+    uint64_t total_us;
+    uint64_t sleep_us;                  // Automatic light sleep
+    uint64_t active_us;                 // At least one application lock held
+    uint64_t lock_us[POWER_LOCK_COUNT];
+    uint32_t sleeps;                    // Light-sleep entries
+} power_residency_t;
+
+// Configure DFS and light sleep and create the locks. Call first thing in app_main.
+void power_mgmt_init(void);
+void power_lock_acquire(power_lock_t lock);
+void power_lock_release(power_lock_t lock);
+// Residency since *mark into *interval, then move *mark to now. A zeroed mark gives the time since boot.
+void power_mgmt_interval(power_residency_t *mark, power_residency_t *interval);
+// Average supply current over an interval from the nominal per-mode currents, in microamps. Only meaningful
+// with POWER_MANAGEMENT: without it the CPU never leaves the full clock.
+uint32_t power_mgmt_average_ua(const power_residency_t *interval);
+
+#endif // POWER_MGMT_H
@@ -0,0 +1,140 @@
+#include "publish_queue.h"
+
+#include <string.h>
+
+void publish_queue_init(publish_queue_t *q)
+{
+    memset(q, 0, sizeof(*q));
+}
+
+static bool fill(publish_msg_t *msg, publish_class_t cls, const char *topic, const void *data, size_t len,
+                 uint32_t now_ms)
+{
+    if (len == 0) {
+        len = strlen((const char *)data);
+    }
+    if (strlen(topic) >= sizeof(msg->topic) || len > sizeof(msg->data)) {
+        return false;
+    }
+    msg->cls = cls;
+    msg->queued_ms = now_ms;
+    msg->len = (uint16_t)len;
+    strcpy(msg->topic, topic);
+    memcpy(msg->data, data, len);
+    return true;
+}
+
+static int find_telemetry(const publish_queue_t *q, const char *topic)
+{
+    for (int i = 0; i < PUBLISH_TELEMETRY_SLOTS; i++) {
+        if (q->telemetry_used[i] && strcmp(q->telemetry[i].topic, topic) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Slot waiting longest, or -1 if none is in use
+static int oldest_telemetry(const publish_queue_t *q)
+{
+    int oldest = -1;
+    for (int i = 0; i < PUBLISH_TELEMETRY_SLOTS; i++) {
+        if (q->telemetry_used[i] &&
+            (oldest < 0 || (int32_t)(q->telemetry[i].queued_ms - q->telemetry[oldest].queued_ms) < 0)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+bool publish_queue_push(publish_queue_t *q, publish_class_t cls, const char *topic, const void *data, size_t len,
+                        uint32_t now_ms, publish_msg_t *evicted, bool *has_evicted)
+{
+    *has_evicted = false;
+
+    if (cls == PUBLISH_ALARM) {
+        publish_msg_t msg;
+        if (!fill(&msg, cls, topic, data, len, now_ms)) {
+            return false;
+        }
+        // A waiting reading for this topic is older than the alarm and would only follow it out of order
+        int stale = find_telemetry(q, topic);
+        if (stale >= 0) {
+            q->telemetry_used[stale] = false;
+            q->stats.superseded++;
+        }
+        if (q->alarm_count == PUBLISH_ALARM_SLOTS) {
+            *evicted = q->alarms[q->alarm_head];
+            *has_evicted = true;
+            q->alarm_head = (q->alarm_head + 1) % PUBLISH_ALARM_SLOTS;
+            q->alarm_count--;
+            q->stats.evicted++;
+        }
+        q->alarms[(q->alarm_head + q->alarm_count) % PUBLISH_ALARM_SLOTS] = msg;
+        q->alarm_count++;
+        q->stats.alarms++;
+        return true;
+    }
+
+    int slot = find_telemetry(q, topic);
+    if (slot >= 0) {
+        // Keep the slot's place in line so a steady stream of readings cannot starve it
+        uint32_t queued_ms = q->telemetry[slot].queued_ms;
+        if (!fill(&q->telemetry[slot], cls, topic, data, len, now_ms)) {
+            return false;
+        }
+        q->telemetry[slot].queued_ms = queued_ms;
+        q->stats.coalesced++;
+        q->stats.telemetry++;
+        return true;
+    }
+    for (int i = 0; i < PUBLISH_TELEMETRY_SLOTS && slot < 0; i++) {
+        if (!q->telemetry_used[i]) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        slot = oldest_telemetry(q);
+        q->stats.evicted++;
+    }
+    if (!fill(&q->telemetry[slot], cls, topic, data, len, now_ms)) {
+        return false;
+    }
+    q->telemetry_used[slot] = true;
+    q->stats.telemetry++;
+    return true;
+}
+
+bool publish_queue_pop(publish_queue_t *q, bool allow_telemetry, publish_msg_t *out)
+{
+    if (q->alarm_count > 0) {
+        *out = q->alarms[q->alarm_head];
+        q->alarm_head = (q->alarm_head + 1) % PUBLISH_ALARM_SLOTS;
+        q->alarm_count--;
+        return true;
+    }
+    if (!allow_telemetry) {
+        return false;
+    }
+    int slot = oldest_telemetry(q);
+    if (slot < 0) {
+        return false;
+    }
+    *out = q->telemetry[slot];
+    q->telemetry_used[slot] = false;
+    return true;
+}
+
+int publish_queue_alarms(const publish_queue_t *q)
+{
+    return q->alarm_count;
+}
+
+int publish_queue_telemetry(const publish_queue_t *q)
+{
+    int n = 0;
+    for (int i = 0; i < PUBLISH_TELEMETRY_SLOTS; i++) {
+        n += q->telemetry_used[i];
+    }
+    return n;
+}
@@ -0,0 +1,55 @@
+#ifndef PUBLISH_QUEUE_H
+#define PUBLISH_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "payload_codec.h"
+
+// Priority classes for reading snapshots waiting to be handed to the MQTT client
+typedef enum {
+    PUBLISH_ALARM,          // State changes and latched events: QoS 1, retained, sent before anything else
+    PUBLISH_TELEMETRY,      // Routine readings: QoS 0, only the newest message per topic is kept while waiting
+} publish_class_t;
+
+#define PUBLISH_ALARM_SLOTS 8
+#define PUBLISH_TELEMETRY_SLOTS 8       // One per topic: probes times payload codecs
+#define PUBLISH_MAX_TOPIC 64
+#define PUBLISH_MAX_PAYLOAD PAYLOAD_MAX_LEN
+
+typedef struct {
+    publish_class_t cls;
+    uint32_t queued_ms;
+    uint16_t len;
+    char topic[PUBLISH_MAX_TOPIC];
+    uint8_t data[PUBLISH_MAX_PAYLOAD];
+} publish_msg_t;
+
+typedef struct {
+    uint32_t alarms;
+    uint32_t telemetry;
+    uint32_t coalesced;     // Telemetry replaced by a newer reading for the same topic
+    uint32_t superseded;    // Telemetry discarded because an alarm for the same topic overtook it
+    uint32_t evicted;       // Alarms pushed out of a full FIFO (handed back to the caller) or telemetry slots reused
+} publish_queue_stats_t;
+
+typedef struct {
+    publish_msg_t alarms[PUBLISH_ALARM_SLOTS];  // FIFO ring
+    int alarm_head;
+    int alarm_count;
+    publish_msg_t telemetry[PUBLISH_TELEMETRY_SLOTS];
+    bool telemetry_used[PUBLISH_TELEMETRY_SLOTS];
+    publish_queue_stats_t stats;
+} publish_queue_t;
+
+void publish_queue_init(publish_queue_t *q);
+// Queue a message; len == 0 means data is a NUL-terminated string. Returns false if it does not fit a slot.
+// An alarm arriving at a full FIFO pushes the oldest one out into *evicted and sets *has_evicted.
+bool publish_queue_push(publish_queue_t *q, publish_class_t cls, const char *topic, const void *data, size_t len,
+                        uint32_t now_ms, publish_msg_t *evicted, bool *has_evicted);
+// Remove and return the next message: the oldest alarm, else (if allowed) the telemetry waiting longest
+bool publish_queue_pop(publish_queue_t *q, bool allow_telemetry, publish_msg_t *out);
+int publish_queue_alarms(const publish_queue_t *q);
+int publish_queue_telemetry(const publish_queue_t *q);
+
+#endif // PUBLISH_QUEUE_H
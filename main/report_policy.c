@@ -0,0 +1,59 @@
+#include "report_policy.h"
+
+#include <stdlib.h>
+
+void report_policy_init(report_policy_t *p, int deadband_mv, uint32_t heartbeat_ms)
+{
+    p->deadband_mv = deadband_mv;
+    p->heartbeat_ms = heartbeat_ms;
+    p->has_last = false;
+    p->last_state = TANK_STATE_FULL;
+    p->last_voltage = 0;
+    p->last_publish_ms = 0;
+    p->stats = (report_policy_stats_t){0};
+}
+
+report_reason_t report_policy_evaluate(report_policy_t *p, tank_state_t state, int voltage_mv,
+                                       bool events_pending, uint32_t now_ms)
+{
+    report_reason_t reason = REPORT_NONE;
+
+    if (!p->has_last || state != p->last_state || events_pending) {
+        reason = REPORT_TRANSITION;
+    } else if (abs(voltage_mv - p->last_voltage) > p->deadband_mv) {
+        reason = REPORT_DEADBAND;
+    } else if ((uint32_t)(now_ms - p->last_publish_ms) >= p->heartbeat_ms) {
+        reason = REPORT_HEARTBEAT;
+    }
+
+    if (reason == REPORT_NONE) {
+        p->stats.suppressed++;
+    }
+    return reason;
+}
+
+void report_policy_commit(report_policy_t *p, report_reason_t reason, tank_state_t state, int voltage_mv,
+                          uint32_t now_ms)
+{
+    switch (reason) {
+    case REPORT_TRANSITION: p->stats.published_transition++; break;
+    case REPORT_DEADBAND: p->stats.published_deadband++; break;
+    case REPORT_HEARTBEAT: p->stats.published_heartbeat++; break;
+    default: return;
+    }
+
+    p->has_last = true;
+    p->last_state = state;
+    p->last_voltage = voltage_mv;
+    p->last_publish_ms = now_ms;
+}
+
+const char *report_reason_name(report_reason_t reason)
+{
+    switch (reason) {
+    case REPORT_TRANSITION: return "transition";
+    case REPORT_DEADBAND: return "deadband";
+    case REPORT_HEARTBEAT: return "heartbeat";
+    default: return "none";
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef REPORT_POLICY_H
+#define REPORT_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "leak_classifier.h"
+
+// Publish mode: 1 = report-by-exception (transitions, deadband, heartbeat), 0 = fixed-interval polling
+#ifndef REPORT_BY_EXCEPTION
+#define REPORT_BY_EXCEPTION 1
+#endif
+
+#define REPORT_DEADBAND_MV 50           // Publish when voltage moves further than this from the last report
+#define REPORT_HEARTBEAT_MS 300000      // Publish at least this often while nothing changes
+
+typedef enum {
+    REPORT_NONE = 0,
+    REPORT_TRANSITION,
+    REPORT_DEADBAND,
+    REPORT_HEARTBEAT,
+} report_reason_t;
+
+typedef struct {
+    uint32_t published_transition;
+    uint32_t published_deadband;
+    uint32_t published_heartbeat;
+    uint32_t suppressed;
+} report_policy_stats_t;
+
+typedef struct {
+    int deadband_mv;
+    uint32_t heartbeat_ms;
+    bool has_last;
+    tank_state_t last_state;
+    int last_voltage;
+    uint32_t last_publish_ms;
+    report_policy_stats_t stats;
+} report_policy_t;
+
+void report_policy_init(report_policy_t *p, int deadband_mv, uint32_t heartbeat_ms);
+// Decide whether the snapshot must be published. Nothing is recorded until report_policy_commit().
+report_reason_t report_policy_evaluate(report_policy_t *p, tank_state_t state, int voltage_mv,
+                                       bool events_pending, uint32_t now_ms);
+// Record a snapshot as the last report once it has actually been published
+void report_policy_commit(report_policy_t *p, report_reason_t reason, tank_state_t state, int voltage_mv,
+                          uint32_t now_ms);
+const char *report_reason_name(report_reason_t reason);
+
+#endif // REPORT_POLICY_H
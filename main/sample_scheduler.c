@@ -0,0 +1,94 @@
+#include "sample_scheduler.h"
+
+#include <stdlib.h>
+
+void sample_scheduler_default_config(sample_scheduler_config_t *cfg)
+{
+    cfg->min_period_ms = SAMPLE_PERIOD_MIN_MS;
+    cfg->max_period_ms = SAMPLE_PERIOD_MAX_MS;
+    cfg->state_period_ms[TANK_STATE_FULL] = SAMPLE_PERIOD_MAX_MS;
+    cfg->state_period_ms[TANK_STATE_FLUSHING] = SAMPLE_PERIOD_MIN_MS;
+    cfg->state_period_ms[TANK_STATE_REFILLING] = SAMPLE_PERIOD_REFILLING_MS;
+    cfg->state_period_ms[TANK_STATE_LEAKING] = SAMPLE_PERIOD_LEAKING_MS;
+    cfg->slew_up_shift = SAMPLE_SLEW_UP_SHIFT;
+    cfg->slew_down_shift = SAMPLE_SLEW_DOWN_SHIFT;
+    cfg->slope_fast_mv_per_s = SAMPLE_SLOPE_FAST_MV_PER_S;
+    cfg->slope_noise_mv = SAMPLE_SLOPE_NOISE_MV;
+    cfg->fast_hold_ms = SAMPLE_FAST_HOLD_MS;
+}
+
+void sample_scheduler_init(sample_scheduler_t *s, const sample_scheduler_config_t *cfg)
+{
+    s->cfg = *cfg;
+    // Start fast so the classifier settles quickly after boot
+    s->period_ms = cfg->min_period_ms;
+    s->has_last = false;
+    s->last_mv = 0;
+    s->last_ms = 0;
+    s->holding = false;
+    s->hold_until_ms = 0;
+    s->stats = (sample_scheduler_stats_t){0};
+}
+
+void sample_scheduler_reconfigure(sample_scheduler_t *s, const sample_scheduler_config_t *cfg)
+{
+    s->cfg = *cfg;
+    if (s->period_ms < cfg->min_period_ms) {
+        s->period_ms = cfg->min_period_ms;
+    } else if (s->period_ms > cfg->max_period_ms) {
+        s->period_ms = cfg->max_period_ms;
+    }
+}
+
+uint32_t sample_scheduler_next(sample_scheduler_t *s, tank_state_t state, int voltage_mv, uint32_t now_ms)
+{
+    const sample_scheduler_config_t *cfg = &s->cfg;
+    if (state <= TANK_STATE_LEAKING) {
+        s->stats.samples_per_state[state]++;
+    }
+
+    uint32_t target = state <= TANK_STATE_LEAKING ? cfg->state_period_ms[state] : cfg->min_period_ms;
+
+    // A moving level means something is happening before the classifier has caught up
+    if (s->has_last) {
+        int delta = abs(voltage_mv - s->last_mv);
+        uint32_t dt_ms = now_ms - s->last_ms;
+        if (delta > cfg->slope_noise_mv &&
+            (dt_ms == 0 || (int64_t)delta * 1000 > (int64_t)cfg->slope_fast_mv_per_s * dt_ms)) {
+            s->stats.slope_triggers++;
+            s->holding = true;
+            s->hold_until_ms = now_ms + cfg->fast_hold_ms;
+        }
+    }
+    // Keep sampling fast while the classifier catches up with what the slope showed
+    if (s->holding) {
+        if ((int32_t)(now_ms - s->hold_until_ms) < 0) {
+            target = cfg->min_period_ms;
+        } else {
+            s->holding = false;
+        }
+    }
+    s->has_last = true;
+    s->last_mv = voltage_mv;
+    s->last_ms = now_ms;
+
+    // Slew-limit the period in both directions
+    uint32_t period = s->period_ms;
+    if (target > period) {
+        uint64_t limit = (uint64_t)period << cfg->slew_up_shift;
+        period = limit < target ? (uint32_t)limit : target;
+    } else if (target < period) {
+        uint32_t limit = period >> cfg->slew_down_shift;
+        period = limit > target ? limit : target;
+    }
+    if (period < cfg->min_period_ms) {
+        period = cfg->min_period_ms;
+    } else if (period > cfg->max_period_ms) {
+        period = cfg->max_period_ms;
+    }
+    if (period != s->period_ms) {
+        s->stats.period_changes++;
+        s->period_ms = period;
+    }
+    return period;
+}
@@ -0,0 +1,62 @@
+#ifndef SAMPLE_SCHEDULER_H
+#define SAMPLE_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "leak_classifier.h"
+
+// Sampling mode: 1 = period adapts to tank state and signal slope, 0 = stream every ADC sample
+#ifndef ADAPTIVE_SAMPLING
+#define ADAPTIVE_SAMPLING 1
+#endif
+
+#define SAMPLE_PERIOD_MIN_MS 50             // Fastest rate, used to resolve flush and refill curves
+#define SAMPLE_PERIOD_MAX_MS 4000           // Slowest rate, used while the tank sits full and stable. Kept below
+                                            // the shortest flush (drop + empty hold) so none is slept through.
+#define SAMPLE_PERIOD_REFILLING_MS 200      // Refill ramps take tens of seconds; 5 readings/s resolve the curve
+#define SAMPLE_PERIOD_LEAKING_MS 1000       // Leaks drift slowly but should be tracked closely
+#define SAMPLE_SLEW_UP_SHIFT 1              // Slowing down: period may at most double per reading
+#define SAMPLE_SLEW_DOWN_SHIFT 4            // Speeding up: period may shrink by up to 16x per reading
+#define SAMPLE_SLOPE_FAST_MV_PER_S 20       // Signal moving faster than this forces the minimum period
+#define SAMPLE_SLOPE_NOISE_MV 10            // Changes smaller than this are noise, not slope
+#define SAMPLE_FAST_HOLD_MS 5000            // Stay at the minimum period this long after the slope last triggered
+
+// Chooses the delay to the next reading from the classified state and how fast the level moves.
+// Pure integer code with no driver dependencies.
+
+typedef struct {
+    uint32_t min_period_ms;
+    uint32_t max_period_ms;
+    uint32_t state_period_ms[TANK_STATE_LEAKING + 1];  // Target period for each settled state
+    uint8_t slew_up_shift;
+    uint8_t slew_down_shift;
+    int slope_fast_mv_per_s;
+    int slope_noise_mv;
+    uint32_t fast_hold_ms;
+} sample_scheduler_config_t;
+
+typedef struct {
+    uint32_t samples_per_state[TANK_STATE_LEAKING + 1];
+    uint32_t slope_triggers;        // Readings where the slope forced the minimum period
+    uint32_t period_changes;
+} sample_scheduler_stats_t;
+
+typedef struct {
+    sample_scheduler_config_t cfg;
+    uint32_t period_ms;
+    bool has_last;
+    int last_mv;
+    uint32_t last_ms;
+    bool holding;
+    uint32_t hold_until_ms;
+    sample_scheduler_stats_t stats;
+} sample_scheduler_t;
+
+void sample_scheduler_default_config(sample_scheduler_config_t *cfg);
+void sample_scheduler_init(sample_scheduler_t *s, const sample_scheduler_config_t *cfg);
+// Swap in new limits, moving the current period inside them straight away rather than at the next reading
+void sample_scheduler_reconfigure(sample_scheduler_t *s, const sample_scheduler_config_t *cfg);
+// Account a reading and return the delay in ms until the next one should be taken
+uint32_t sample_scheduler_next(sample_scheduler_t *s, tank_state_t state, int voltage_mv, uint32_t now_ms);
+
+#endif // SAMPLE_SCHEDULER_H
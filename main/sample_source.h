@@ -0,0 +1,20 @@
+#ifndef SAMPLE_SOURCE_H
+#define SAMPLE_SOURCE_H
+
+#include <stdint.h>
+
+// Hardware abstraction for a stream of sensor voltages. The firmware binds this to the ADC
+// (leak_sensor.c); the host harness binds it to recorded or synthetic traces.
+
+typedef struct sample_source sample_source_t;
+
+struct sample_source {
+    const char *name;
+    uint32_t sample_period_us;      // Time between consecutive samples
+    // Block until the next frame is available and copy up to max_samples mV values into voltages.
+    // Returns the number of samples written, 0 on timeout, -1 once the source is exhausted.
+    int (*read_frame)(sample_source_t *src, int *voltages, int max_samples, uint32_t timeout_ms);
+    void *ctx;
+};
+
+#endif // SAMPLE_SOURCE_H
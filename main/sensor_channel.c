@@ -0,0 +1,55 @@
+#include "sensor_channel.h"
+
+#define SENSOR_CHANNEL_MASK (SENSOR_CHANNEL_DEPTH - 1)
+
+_Static_assert((SENSOR_CHANNEL_DEPTH & SENSOR_CHANNEL_MASK) == 0, "SENSOR_CHANNEL_DEPTH must be a power of two");
+
+void sensor_channel_init(sensor_channel_t *ch)
+{
+    atomic_init(&ch->head, 0);
+    atomic_init(&ch->tail, 0);
+    atomic_init(&ch->events, 0);
+    atomic_init(&ch->overruns, 0);
+}
+
+bool sensor_channel_push(sensor_channel_t *ch, const sensor_record_t *record)
+{
+    uint32_t head = atomic_load_explicit(&ch->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ch->tail, memory_order_acquire);
+    if ((uint32_t)(head - tail) >= SENSOR_CHANNEL_DEPTH) {
+        atomic_fetch_add_explicit(&ch->overruns, 1, memory_order_relaxed);
+        return false;
+    }
+    ch->slots[head & SENSOR_CHANNEL_MASK] = *record;
+    // Publish the slot contents before the new head becomes visible
+    atomic_store_explicit(&ch->head, head + 1, memory_order_release);
+    return true;
+}
+
+void sensor_channel_latch(sensor_channel_t *ch, uint32_t events)
+{
+    atomic_fetch_or_explicit(&ch->events, events, memory_order_release);
+}
+
+bool sensor_channel_pop(sensor_channel_t *ch, sensor_record_t *record)
+{
+    uint32_t tail = atomic_load_explicit(&ch->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ch->head, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    *record = ch->slots[tail & SENSOR_CHANNEL_MASK];
+    // Hand the slot back to the producer only after it has been copied out
+    atomic_store_explicit(&ch->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+uint32_t sensor_channel_latched(sensor_channel_t *ch)
+{
+    return atomic_load_explicit(&ch->events, memory_order_acquire);
+}
+
+void sensor_channel_ack(sensor_channel_t *ch, uint32_t events)
+{
+    atomic_fetch_and_explicit(&ch->events, ~events, memory_order_acq_rel);
+}
@@ -0,0 +1,46 @@
+#ifndef SENSOR_CHANNEL_H
+#define SENSOR_CHANNEL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "leak_classifier.h"
+
+// Lock-free single-producer/single-consumer channel from the sensor task to the publisher.
+// The producer only writes head, the consumer only writes tail, so neither ever blocks.
+
+#define SENSOR_CHANNEL_DEPTH 32     // Must be a power of two
+
+// Events latched by the producer and cleared only once the consumer acknowledges publishing them.
+// Each probe owns two bits: shift by SENSOR_EVENT_SHIFT(probe).
+#define SENSOR_EVENT_FLUSH (1u << 0)
+#define SENSOR_EVENT_LEAK (1u << 1)
+#define SENSOR_EVENT_MASK (SENSOR_EVENT_FLUSH | SENSOR_EVENT_LEAK)
+#define SENSOR_EVENT_SHIFT(probe) (2u * (uint32_t)(probe))
+
+typedef struct {
+    int64_t timestamp_us;   // Monotonic (esp_timer) time of the reading
+    int voltage_mv;
+    tank_state_t state;
+    uint8_t probe;          // Index into the sensor registry
+} sensor_record_t;
+
+typedef struct {
+    sensor_record_t slots[SENSOR_CHANNEL_DEPTH];
+    atomic_uint_fast32_t head;      // Next slot the producer writes
+    atomic_uint_fast32_t tail;      // Next slot the consumer reads
+    atomic_uint_fast32_t events;    // SENSOR_EVENT_* bits awaiting acknowledgement
+    atomic_uint_fast32_t overruns;  // Records dropped because the consumer fell behind
+} sensor_channel_t;
+
+void sensor_channel_init(sensor_channel_t *ch);
+// Producer side
+bool sensor_channel_push(sensor_channel_t *ch, const sensor_record_t *record);
+void sensor_channel_latch(sensor_channel_t *ch, uint32_t events);
+// Consumer side
+bool sensor_channel_pop(sensor_channel_t *ch, sensor_record_t *record);
+uint32_t sensor_channel_latched(sensor_channel_t *ch);
+// Clear exactly the events that were published; bits latched since then stay set
+void sensor_channel_ack(sensor_channel_t *ch, uint32_t events);
+
+#endif // SENSOR_CHANNEL_H
@@ -0,0 +1,182 @@
+#include "tank_analytics.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static void welford_add(welford_t *w, float x)
+{
+    w->n++;
+    float delta = x - w->mean;
+    w->mean += delta / (float)w->n;
+    w->m2 += delta * (x - w->mean);
+}
+
+static float welford_stddev(const welford_t *w)
+{
+    return w->n > 1 ? sqrtf(w->m2 / (float)(w->n - 1)) : 0.0f;
+}
+
+static void hist_inc(uint16_t *hist, int hour)
+{
+    if (hour >= 0 && hist[hour] < UINT16_MAX) {
+        hist[hour]++;
+    }
+}
+
+// Clear every bin from the previous hour up to the current one, so each holds the last 24 h only
+static void roll_hour(tank_analytics_t *a, int hour)
+{
+    if (hour < 0) {
+        // Clock not set yet: keep the bins, and their hour, for when it is
+        return;
+    }
+    hour %= TANK_ANALYTICS_HOURS;
+    if (a->hour < 0) {
+        a->hour = hour;
+        return;
+    }
+    while (a->hour != hour) {
+        a->hour = (a->hour + 1) % TANK_ANALYTICS_HOURS;
+        a->flush_hist[a->hour] = 0;
+        a->phantom_hist[a->hour] = 0;
+    }
+}
+
+void tank_analytics_init(tank_analytics_t *a, uint32_t now_ms)
+{
+    memset(a, 0, sizeof(*a));
+    a->hour = -1;
+    a->window_start_ms = now_ms;
+}
+
+void tank_analytics_update(tank_analytics_t *a, tank_state_t state, int voltage_mv, uint32_t now_ms, int hour_of_day)
+{
+    roll_hour(a, hour_of_day);
+    int hour = hour_of_day >= 0 ? a->hour : -1;
+
+    if (a->have_state && state != a->state) {
+        if (a->state == TANK_STATE_LEAKING) {
+            a->leak_ms += now_ms - a->leak_start_ms;
+        }
+        switch (state) {
+        case TANK_STATE_FLUSHING:
+            a->flushes++;
+            hist_inc(a->flush_hist, hour);
+            a->in_flush_cycle = true;
+            a->flush_start_ms = now_ms;
+            break;
+        case TANK_STATE_REFILLING:
+            // Refilling without a flush first means the valve is replacing water that leaked out
+            if (!a->in_flush_cycle) {
+                a->phantom_refills++;
+                a->phantom_total++;
+                hist_inc(a->phantom_hist, hour);
+                if (a->have_phantom) {
+                    welford_add(&a->phantom_gap_ms, (float)(now_ms - a->last_phantom_ms));
+                }
+                a->have_phantom = true;
+                a->last_phantom_ms = now_ms;
+            }
+            break;
+        case TANK_STATE_FULL:
+            a->full_since_ms = now_ms;
+            if (a->in_flush_cycle) {
+                float refill_ms = (float)(now_ms - a->flush_start_ms);
+                welford_add(&a->refill_ms, refill_ms);
+                welford_add(&a->refill_ms_total, refill_ms);
+                a->cycles_total++;
+                a->in_flush_cycle = false;
+            }
+            break;
+        case TANK_STATE_LEAKING:
+            a->leaks++;
+            a->leak_start_ms = now_ms;
+            break;
+        }
+    }
+    if (!a->have_state) {
+        a->full_since_ms = now_ms;
+    }
+    a->state = state;
+    a->have_state = true;
+
+    if (state == TANK_STATE_FULL && now_ms - a->full_since_ms >= TANK_ANALYTICS_SETTLE_MS) {
+        welford_add(&a->full_mv, (float)voltage_mv);
+        // Seeded here so the first window already reports drift against where the level started
+        if (!a->have_baseline) {
+            a->full_baseline_mv = (float)voltage_mv;
+            a->have_baseline = true;
+        }
+    }
+}
+
+bool tank_analytics_due(const tank_analytics_t *a, uint32_t now_ms)
+{
+    return now_ms - a->window_start_ms >= TANK_ANALYTICS_SUMMARY_MS;
+}
+
+static int append_hist(char *buf, size_t buf_len, int len, const char *key, const uint16_t *hist)
+{
+    if (len < 0 || (size_t)len >= buf_len) {
+        return -1;
+    }
+    len += snprintf(buf + len, buf_len - len, ",\"%s\":[", key);
+    for (int h = 0; h < TANK_ANALYTICS_HOURS && len > 0 && (size_t)len < buf_len; h++) {
+        len += snprintf(buf + len, buf_len - len, h ? ",%u" : "%u", (unsigned)hist[h]);
+    }
+    if (len < 0 || (size_t)len >= buf_len) {
+        return -1;
+    }
+    len += snprintf(buf + len, buf_len - len, "]");
+    return len;
+}
+
+int tank_analytics_encode(const tank_analytics_t *a, uint32_t now_ms, char *buf, size_t buf_len)
+{
+    uint32_t leak_ms = a->leak_ms;
+    if (a->have_state && a->state == TANK_STATE_LEAKING) {
+        leak_ms += now_ms - a->leak_start_ms;
+    }
+    float drift_mv = (a->have_baseline && a->full_mv.n > 0) ? a->full_mv.mean - a->full_baseline_mv : 0.0f;
+
+    int len = snprintf(buf, buf_len,
+                       "{\"window_s\":%lu,\"flushes\":%lu,"
+                       "\"refill_s\":{\"n\":%lu,\"mean\":%.1f,\"sd\":%.1f},"
+                       "\"refill_s_all\":{\"n\":%lu,\"mean\":%.1f,\"sd\":%.1f},"
+                       "\"phantom_refills\":%lu,\"phantom_gap_s\":%.0f,\"leaks\":%lu,\"leak_s\":%lu,"
+                       "\"full_mv\":{\"mean\":%.1f,\"sd\":%.1f},\"full_drift_mv\":%.1f",
+                       (unsigned long)((now_ms - a->window_start_ms) / 1000), (unsigned long)a->flushes,
+                       (unsigned long)a->refill_ms.n, a->refill_ms.mean / 1000.0, welford_stddev(&a->refill_ms) / 1000.0,
+                       (unsigned long)a->refill_ms_total.n, a->refill_ms_total.mean / 1000.0,
+                       welford_stddev(&a->refill_ms_total) / 1000.0,
+                       (unsigned long)a->phantom_refills, a->phantom_gap_ms.mean / 1000.0, (unsigned long)a->leaks,
+                       (unsigned long)(leak_ms / 1000), a->full_mv.mean, welford_stddev(&a->full_mv), drift_mv);
+    len = append_hist(buf, buf_len, len, "flush_hist", a->flush_hist);
+    len = append_hist(buf, buf_len, len, "phantom_hist", a->phantom_hist);
+    if (len < 0 || (size_t)len + 1 >= buf_len) {
+        return -1;
+    }
+    buf[len++] = '}';
+    buf[len] = '\0';
+    return len;
+}
+
+void tank_analytics_next_window(tank_analytics_t *a, uint32_t now_ms)
+{
+    // The full-tank level drifts slowly as a flapper wears or the float fouls; track it across windows
+    if (a->full_mv.n > 0) {
+        a->full_baseline_mv += (a->full_mv.mean - a->full_baseline_mv) / (1 << TANK_ANALYTICS_BASELINE_SHIFT);
+    }
+    if (a->have_state && a->state == TANK_STATE_LEAKING) {
+        a->leak_start_ms = now_ms;  // The rest of an ongoing leak counts towards the new window
+    }
+    a->window_start_ms = now_ms;
+    a->flushes = 0;
+    a->phantom_refills = 0;
+    a->leaks = 0;
+    a->leak_ms = 0;
+    memset(&a->refill_ms, 0, sizeof(a->refill_ms));
+    memset(&a->phantom_gap_ms, 0, sizeof(a->phantom_gap_ms));
+    memset(&a->full_mv, 0, sizeof(a->full_mv));
+}
@@ -0,0 +1,74 @@
+#ifndef TANK_ANALYTICS_H
+#define TANK_ANALYTICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "leak_classifier.h"
+
+// Refill-cycle analytics: streaming statistics over tank state transitions in fixed memory,
+// published as a compact summary instead of the raw reading stream
+#ifndef TANK_ANALYTICS
+#define TANK_ANALYTICS 1
+#endif
+
+#define TANK_ANALYTICS_SUMMARY_MS 3600000   // Summary cadence; window statistics restart after each one
+#define TANK_ANALYTICS_SUBTOPIC "/stats"
+#define TANK_ANALYTICS_SETTLE_MS 10000      // Full-level statistics skip the first readings after a refill
+#define TANK_ANALYTICS_BASELINE_SHIFT 3     // Full-level baseline starts at the first settled reading, then
+                                            // follows window means with weight 1/8
+#define TANK_ANALYTICS_HOURS 24
+#define TANK_ANALYTICS_MAX_ENCODED 640
+
+// Welford running mean and variance
+typedef struct {
+    uint32_t n;
+    float mean;
+    float m2;
+} welford_t;
+
+typedef struct {
+    // Cycle tracking
+    tank_state_t state;
+    bool have_state;
+    bool in_flush_cycle;            // Flushed, not yet back to full
+    uint32_t flush_start_ms;
+    bool have_phantom;
+    uint32_t last_phantom_ms;
+    uint32_t leak_start_ms;
+    uint32_t full_since_ms;
+
+    // Current window, restarted by tank_analytics_next_window()
+    uint32_t window_start_ms;
+    uint32_t flushes;
+    uint32_t phantom_refills;       // Refills no flush started: the fill valve topping up a leak
+    uint32_t leaks;
+    uint32_t leak_ms;
+    welford_t refill_ms;            // Flush start to full again
+    welford_t phantom_gap_ms;       // Time between phantom refills
+    welford_t full_mv;              // Resting level while full
+
+    // Lifetime
+    welford_t refill_ms_total;
+    bool have_baseline;
+    float full_baseline_mv;
+    uint32_t cycles_total;
+    uint32_t phantom_total;
+
+    // Rolling 24 h histograms by hour of day; a bin is cleared when its hour comes round again
+    int hour;
+    uint16_t flush_hist[TANK_ANALYTICS_HOURS];
+    uint16_t phantom_hist[TANK_ANALYTICS_HOURS];
+} tank_analytics_t;
+
+void tank_analytics_init(tank_analytics_t *a, uint32_t now_ms);
+// Feed every reported reading; hour_of_day is 0-23 local time, or -1 while the clock is not set, in which case
+// the hour-of-day histograms skip the reading rather than file it under a boot-relative hour
+void tank_analytics_update(tank_analytics_t *a, tank_state_t state, int voltage_mv, uint32_t now_ms, int hour_of_day);
+bool tank_analytics_due(const tank_analytics_t *a, uint32_t now_ms);
+// JSON summary of the current window. Returns the length, or -1 if it does not fit.
+int tank_analytics_encode(const tank_analytics_t *a, uint32_t now_ms, char *buf, size_t buf_len);
+// Fold the window into the lifetime statistics and start a new one
+void tank_analytics_next_window(tank_analytics_t *a, uint32_t now_ms);
+
+#endif // TANK_ANALYTICS_H
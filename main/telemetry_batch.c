@@ -0,0 +1,84 @@
+#include "telemetry_batch.h"
+
+void telemetry_batch_init(telemetry_batch_t *b)
+{
+    b->head = 0;
+    b->count = 0;
+    b->opened_ms = 0;
+    b->dropped = 0;
+}
+
+bool telemetry_batch_add(telemetry_batch_t *b, const telemetry_sample_t *sample, uint32_t now_ms)
+{
+    if (b->count == 0) {
+        b->opened_ms = now_ms;
+    }
+    if (b->count == TELEMETRY_BATCH_CAPACITY) {
+        // Ring is full and the publisher has not caught up: overwrite the oldest reading
+        b->head = (b->head + 1) % TELEMETRY_BATCH_CAPACITY;
+        b->count--;
+        b->dropped++;
+    }
+    b->samples[(b->head + b->count) % TELEMETRY_BATCH_CAPACITY] = *sample;
+    b->count++;
+    return b->count == TELEMETRY_BATCH_CAPACITY;
+}
+
+bool telemetry_batch_due(const telemetry_batch_t *b, uint32_t now_ms, uint32_t deadline_ms)
+{
+    if (b->count == 0) {
+        return false;
+    }
+    return b->count == TELEMETRY_BATCH_CAPACITY || (uint32_t)(now_ms - b->opened_ms) >= deadline_ms;
+}
+
+void telemetry_batch_clear(telemetry_batch_t *b)
+{
+    b->head = 0;
+    b->count = 0;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int telemetry_batch_encode(const telemetry_batch_t *b, int64_t epoch_offset_ms, uint8_t *buf, size_t buf_len)
+{
+    if (b->count == 0 || buf_len < 19) {
+        return -1;
+    }
+
+    const telemetry_sample_t *first = &b->samples[b->head];
+    size_t n = 0;
+    int64_t base_ms = first->timestamp_ms + epoch_offset_ms;
+    buf[n++] = TELEMETRY_BATCH_VERSION | (epoch_offset_ms != 0 ? TELEMETRY_BATCH_SYNCED : 0);
+    n += put_varint(buf + n, b->count);
+    n += put_varint(buf + n, base_ms < 0 ? 0 : (uint64_t)base_ms);
+    n += put_varint(buf + n, zigzag(first->voltage_mv));
+
+    const telemetry_sample_t *prev = first;
+    for (uint16_t i = 0; i < b->count; i++) {
+        const telemetry_sample_t *s = &b->samples[(b->head + i) % TELEMETRY_BATCH_CAPACITY];
+        if (buf_len - n < 16) {
+            return -1;
+        }
+        int64_t dt = s->timestamp_ms - prev->timestamp_ms;
+        n += put_varint(buf + n, dt < 0 ? 0 : (uint64_t)dt);
+        n += put_varint(buf + n, zigzag((int64_t)s->voltage_mv - prev->voltage_mv));
+        buf[n++] = (uint8_t)((s->state & 0x03) | (s->flags << 2));
+        prev = s;
+    }
+    return (int)n;
+}
@@ -0,0 +1,58 @@
+#ifndef TELEMETRY_BATCH_H
+#define TELEMETRY_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Batch every sensor reading into one delta/varint-encoded MQTT message
+#ifndef TELEMETRY_BATCHING
+#define TELEMETRY_BATCHING 1
+#endif
+
+#define TELEMETRY_BATCH_CAPACITY 64         // Readings held in RAM before a forced flush
+#define TELEMETRY_BATCH_DEADLINE_MS 120000  // Flush a partial batch after this long
+#define TELEMETRY_BATCH_SUBTOPIC "/batch"
+// Header (1 + 3 + 10 + 5) plus worst-case per-sample record (10 + 5 + 1)
+#define TELEMETRY_BATCH_MAX_ENCODED (19 + TELEMETRY_BATCH_CAPACITY * 16)
+
+/*
+ * Wire format (all integers are LEB128 varints, signed values zigzag-encoded):
+ *   u8      version (low 7 bits) | 0x80 if timestamps are wall-clock (SNTP synced)
+ *   varint  sample count
+ *   varint  timestamp of first sample, ms (epoch if synced, else since boot)
+ *   zigzag  voltage of first sample, mV
+ *   then per sample:
+ *     varint  ms since previous sample (0 for the first)
+ *     zigzag  mV change since previous sample (0 for the first)
+ *     u8      tank state (bits 0-1) | payload flags << 2
+ */
+#define TELEMETRY_BATCH_VERSION 1
+#define TELEMETRY_BATCH_SYNCED 0x80
+
+typedef struct {
+    int64_t timestamp_ms;       // Monotonic, ms since boot
+    int voltage_mv;
+    uint8_t state;
+    uint8_t flags;
+} telemetry_sample_t;
+
+typedef struct {
+    telemetry_sample_t samples[TELEMETRY_BATCH_CAPACITY];
+    uint16_t head;              // Index of the oldest sample
+    uint16_t count;
+    uint32_t opened_ms;         // Monotonic time the first sample of this batch arrived
+    uint32_t dropped;           // Samples overwritten because the batch could not be flushed
+} telemetry_batch_t;
+
+void telemetry_batch_init(telemetry_batch_t *b);
+// Append a reading; when full the oldest one is overwritten. Returns true once the batch is full.
+bool telemetry_batch_add(telemetry_batch_t *b, const telemetry_sample_t *sample, uint32_t now_ms);
+bool telemetry_batch_due(const telemetry_batch_t *b, uint32_t now_ms, uint32_t deadline_ms);
+// Encode all held samples. Sample timestamps are monotonic ms; epoch_offset_ms (wall clock minus
+// monotonic, 0 if SNTP has not synced yet) is added to the base timestamp.
+// Returns bytes written or -1 if buf is too small; the batch is left untouched.
+int telemetry_batch_encode(const telemetry_batch_t *b, int64_t epoch_offset_ms, uint8_t *buf, size_t buf_len);
+void telemetry_batch_clear(telemetry_batch_t *b);
+
+#endif // TELEMETRY_BATCH_H
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+# Per-component static RAM and flash footprint of the application image, compared against a stored baseline.
+#
+# Input is the per-archive report from esp-idf-size ("--format json2 --archives"; the legacy idf_size.py
+# "--json --archives" output is read too). RAM is everything placed in DRAM/IRAM/RTC memory, .bss included:
+# that is what the heap does not get. Flash is everything the image stores: code, rodata and the initial
+# contents of .data and IRAM code.
+#
+# Exits 1 when a component, or the total, grew past its tolerance, so it can gate CI. Run through the build:
+#   idf.py footprint            report against tools/footprint_baseline.json
+#   idf.py footprint-baseline   accept the current build as the new baseline
+
+import argparse
+import json
+import os
+import sys
+
+# Sections that take RAM but nothing in the image
+NOLOAD_SUFFIXES = ('.bss', '.noinit')
+
+
+def component_name(archive):
+    name = os.path.basename(archive)
+    if name.startswith('lib'):
+        name = name[3:]
+    if name.endswith('.a'):
+        name = name[:-2]
+    return name or archive
+
+
+def archives_of(report):
+    if isinstance(report.get('archives'), dict):
+        return report['archives']
+    return {k: v for k, v in report.items() if isinstance(v, dict)}
+
+
+def sizes_json2(entry):
+    ram = flash = 0
+    for mem_name, mem in entry['memory_types'].items():
+        is_flash = mem_name.lower().startswith('flash')
+        sections = mem.get('sections') or {}
+        if is_flash:
+            flash += mem.get('size', 0)
+            continue
+        ram += mem.get('size', 0)
+        if sections:
+            flash += sum(s.get('size', 0) for name, s in sections.items() if not name.endswith(NOLOAD_SUFFIXES))
+    return ram, flash
+
+
+def sizes_legacy(entry):
+    if 'ram_st_total' in entry and 'flash_total' in entry:
+        return entry['ram_st_total'], entry['flash_total']
+    ram = flash = 0
+    for name, size in entry.items():
+        if not isinstance(size, int):
+            continue
+        if name.startswith(('.flash', 'flash')):
+            flash += size
+        else:
+            ram += size
+            if not name.endswith(('bss', 'noinit')):
+                flash += size
+    return ram, flash
+
+
+def load_report(path):
+    with open(path) as f:
+        report = json.load(f)
+    components = {}
+    for archive, entry in archives_of(report).items():
+        ram, flash = sizes_json2(entry) if 'memory_types' in entry else sizes_legacy(entry)
+        if ram == 0 and flash == 0:
+            continue
+        name = component_name(archive)
+        prev = components.get(name, {'ram': 0, 'flash': 0})
+        components[name] = {'ram': prev['ram'] + ram, 'flash': prev['flash'] + flash}
+    return components
+
+
+def totals(components):
+    return {
+        'ram': sum(c['ram'] for c in components.values()),
+        'flash': sum(c['flash'] for c in components.values()),
+    }
+
+
+def delta(now, then):
+    d = now - then
+    return '' if d == 0 else '{:+d}'.format(d)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Per-component RAM/flash footprint against a baseline')
+    parser.add_argument('report', help='esp-idf-size json2 --archives output')
+    parser.add_argument('baseline', help='stored baseline (created by --update)')
+    parser.add_argument('--update', action='store_true', help='write the report as the new baseline')
+    parser.add_argument('--ram-tolerance', type=int, default=256, help='bytes a component may grow (default 256)')
+    parser.add_argument('--flash-tolerance', type=int, default=1024,
+                        help='bytes a component may grow (default 1024)')
+    parser.add_argument('--top', type=int, default=25, help='components listed, largest first (regressions always)')
+    args = parser.parse_args()
+
+    components = load_report(args.report)
+    total = totals(components)
+
+    if args.update:
+        with open(args.baseline, 'w') as f:
+            json.dump({'total': total, 'components': dict(sorted(components.items()))}, f, indent=2)
+            f.write('\n')
+        print('Baseline written to {}: {} B RAM, {} B flash'.format(args.baseline, total['ram'], total['flash']))
+        return 0
+
+    base = {}
+    base_total = None
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            stored = json.load(f)
+        base = stored.get('components', {})
+        base_total = stored.get('total')
+    else:
+        print('No baseline at {}; run "idf.py footprint-baseline" to create one'.format(args.baseline))
+
+    zero = {'ram': 0, 'flash': 0}
+    regressions = set()
+    for name in set(components) | set(base):
+        now = components.get(name, zero)
+        then = base.get(name, zero) if base_total else now
+        if now['ram'] - then['ram'] > args.ram_tolerance or now['flash'] - then['flash'] > args.flash_tolerance:
+            regressions.add(name)
+
+    ranked = sorted(components, key=lambda n: components[n]['ram'] + components[n]['flash'], reverse=True)
+    shown = ranked[:args.top] + sorted(regressions - set(ranked[:args.top]))
+    print('{:<28} {:>9} {:>8} {:>9} {:>8}'.format('component', 'RAM', 'delta', 'flash', 'delta'))
+    for name in shown:
+        now = components.get(name, zero)
+        then = base.get(name, zero) if base_total else now
+        print('{:<28} {:>9} {:>8} {:>9} {:>8}{}'.format(name[:28], now['ram'], delta(now['ram'], then['ram']),
+                                                     now['flash'], delta(now['flash'], then['flash']),
+                                                     '  REGRESSION' if name in regressions else ''))
+    if len(ranked) > args.top:
+        print('... {} smaller components not listed'.format(len(ranked) - args.top))
+    then = base_total or total
+    print('{:<28} {:>9} {:>8} {:>9} {:>8}'.format('total', total['ram'], delta(total['ram'], then['ram']),
+                                                  total['flash'], delta(total['flash'], then['flash'])))
+
+    total_regressed = base_total is not None and (total['ram'] - base_total['ram'] > args.ram_tolerance or
+                                                  total['flash'] - base_total['flash'] > args.flash_tolerance)
+    if regressions or total_regressed:
+        print('Footprint grew past the tolerance ({} B RAM, {} B flash per component); if intended, '
+              'accept it with "idf.py footprint-baseline"'.format(args.ram_tolerance, args.flash_tolerance))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())